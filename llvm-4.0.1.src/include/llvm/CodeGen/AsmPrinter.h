@@ -236,6 +236,28 @@ public:
   /// Emit a table with all XRay instrumentation points.
   void emitXRayTable();
 
+  //===------------------------------------------------------------------===//
+  // TyChe allocator call sites.
+  //===------------------------------------------------------------------===//
+public:
+  // An allocator call of the current function: the label at its return
+  // address and the TyChe site of the call.
+  struct TyCheCallSite {
+    const MCSymbol *ReturnAddress;
+    uint64_t SiteID;
+    uint64_t TypeID;
+    uint32_t Kind;
+  };
+
+  // The allocator calls of the current function.
+  std::vector<TyCheCallSite> TyCheCallSites;
+
+  /// Emit the .tyche_callsites records of the current function.
+  void emitTyCheCallSites();
+
+  /// Emit the .tyche_frames record of the current function.
+  void emitTyCheFrame();
+
   //===------------------------------------------------------------------===//
   // MachineFunctionPass Implementation.
   //===------------------------------------------------------------------===//
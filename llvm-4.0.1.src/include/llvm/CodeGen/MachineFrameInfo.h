@@ -662,8 +662,6 @@ public:
 
   /// dump - Print the function to stderr.
   void dump(const MachineFunction &MF) const;
-
-  void dumpFrameInfo(const MachineFunction &MF, raw_ostream &OS) const;
 };
 
 } // End llvm namespace
@@ -194,6 +194,19 @@ struct LandingPadInfo {
       : LandingPadBlock(MBB), LandingPadLabel(nullptr) {}
 };
 
+/// A TyChe allocation site: the IDs and names that the EffectiveSan pass
+/// records for an allocator or deallocator call.  The sites of a function live
+/// in a table owned by its MachineFunction.  The SDNodes and MachineInstrs of
+/// the call only carry their index in the table, and all other nodes carry 0.
+struct TyCheSite {
+  std::vector<uint64_t> Nodes;
+  std::vector<std::string> Names;
+  unsigned Kind = 0;                      // tyche::DBSiteKind of the call.
+
+  /// Return the IDs and then the names, each followed by a '#'.
+  std::string dump() const;
+};
+
 class MachineFunction {
   const Function *Fn;
   const TargetMachine &Target;
@@ -299,6 +312,9 @@ class MachineFunction {
   /// List of the indices in FilterIds corresponding to filter terminators.
   std::vector<unsigned> FilterEnds;
 
+  /// TyChe allocation sites of the function.  Site N is TyCheSites[N - 1].
+  std::vector<TyCheSite> TyCheSites;
+
   EHPersonality PersonalityTypeCache = EHPersonality::Unknown;
 
   /// \}
@@ -406,6 +422,17 @@ public:
   MachineConstantPool *getConstantPool() { return ConstantPool; }
   const MachineConstantPool *getConstantPool() const { return ConstantPool; }
 
+  /// Add a TyChe allocation site to the function and return its index, which
+  /// is never 0.
+  unsigned addTyCheSite(TyCheSite Site) {
+    TyCheSites.push_back(std::move(Site));
+    return TyCheSites.size();
+  }
+
+  /// Return the TyChe allocation site with index \p Idx, or an empty site if
+  /// \p Idx is 0.
+  const TyCheSite &getTyCheSite(unsigned Idx) const;
+
   /// getWinEHFuncInfo - Return information about how the current function uses
   /// Windows exception handling. Returns null for functions that don't use
   /// funclets for exception handling.
@@ -29,8 +29,6 @@
 #include "llvm/Support/ArrayRecycler.h"
 #include "llvm/Target/TargetOpcodes.h"
 
-#include <sstream>
-
 namespace llvm {
 
 class StringRef;
@@ -75,54 +73,6 @@ public:
     BundledSucc  = 1 << 3               // Instruction has bundled successors.
   };
 
-
-  class MINodeTypeID
-  {
-    private:
-      std::vector<uint64_t> Nodes;
-      std::vector<std::string> Names;
-      bool Valid;
-    public:
-      MINodeTypeID(std::vector<uint64_t> _nodes, 
-                  std::vector<std::string> _names, 
-                  bool _valid) : 
-                Nodes(_nodes), Names(_names), Valid(_valid) {}
-
-      std::vector<uint64_t> getNodesVector() const {return Nodes; }
-      std::vector<std::string> getNamesVector() const {return Names; }
-    
-      MINodeTypeID& operator = (const MINodeTypeID& mi_node)
-      {
-        if (this == &mi_node)
-          return *this;
-
-        this->Nodes = mi_node.Nodes;
-        this->Valid = mi_node.Valid;
-        this->Names = mi_node.Names;
-
-        return *this;
-      }
-
-      std::string dump() const
-      {
-        std::stringstream ss;
-        for (size_t i = 0; i < Nodes.size(); i++)
-        {
-          ss << std::dec << Nodes[i] << "#";
-        }
-        for (size_t i = 0; i < Names.size(); i++)
-        {
-          ss << Names[i] << "#";
-        }
-        return ss.str();
-      }
-      
-      bool isValid() const {return Valid;}
-      
-  };
-
-  typedef MINodeTypeID MINodeTypeID;
-
 private:
   const MCInstrDesc *MCID;              // Instruction descriptor.
   MachineBasicBlock *Parent;            // Pointer to the owning basic block.
@@ -155,7 +105,8 @@ private:
 
   DebugLoc debugLoc;                    // Source line information.
 
-  
+  unsigned TyCheSiteIdx;                // TyChe allocation site, or 0 (see
+                                        // MachineFunction::addTyCheSite()).
 
   MachineInstr(const MachineInstr&) = delete;
   void operator=(const MachineInstr&) = delete;
@@ -180,17 +131,12 @@ private:
   // MachineInstrs are pool-allocated and owned by MachineFunction.
   friend class MachineFunction;
 
-
-
-  MINodeTypeID MINodeTID;
-
 public:
-
-
-
-
-  MINodeTypeID getMITypeID() const {return MINodeTID;}
-  void         setMITypeID(const MINodeTypeID& mi) {MINodeTID = mi;}
+  /// Return the index of the TyChe allocation site of this instruction in the
+  /// site table of its MachineFunction, or 0.
+  unsigned getTyCheSite() const { return TyCheSiteIdx; }
+  bool hasTyCheSite() const { return TyCheSiteIdx != 0; }
+  void setTyCheSite(unsigned Idx) { TyCheSiteIdx = Idx; }
 
   const MachineBasicBlock* getParent() const { return Parent; }
   MachineBasicBlock* getParent() { return Parent; }
@@ -50,7 +50,6 @@
 #include <iterator>
 #include <string>
 #include <tuple>
-#include <sstream>
 
 namespace llvm {
 
@@ -500,7 +499,8 @@ private:
   /// Unique id per SDNode in the DAG.
   int NodeId;
 
-  
+  /// TyChe allocation site index.  Fills the padding after NodeId.
+  uint32_t TyCheSiteIdx;
 
   /// The values that are used by this operation.
   SDUse *OperandList;
@@ -537,60 +537,11 @@ public:
   /// Used for debug printing.
   uint16_t PersistentId;
 
-  class NodeTypeID
-  {
-    private:
-      std::vector<uint64_t> Nodes;
-      std::vector<std::string> Names;
-      bool Valid;
-
-    public:
-      NodeTypeID(std::vector<uint64_t> _nodes, std::vector<std::string> _names, bool _valid) : 
-      Nodes(_nodes), Names(_names) , Valid(_valid) {}
-    
-      NodeTypeID& operator = (const NodeTypeID& mi_node)
-      {
-        if (this == &mi_node)
-          return *this;
-
-        this->Nodes = mi_node.Nodes;
-        this->Valid = mi_node.Valid;
-        this->Names = mi_node.Names;
-
-        return *this;
-      }
-
-      std::string dump() const
-      {
-        std::stringstream ss;
-        for (size_t i = 0; i < Nodes.size(); i++)
-        {
-            ss << std::dec << Nodes[i] << "#";
-        }
-        for (size_t i = 0; i < Names.size(); i++)
-        {
-            ss << Names[i] << "#";
-        }
-          
-        return ss.str();
-      }
-      
-      bool isValid() const {return Valid;}
-      std::vector<uint64_t> getNodesVector() const {return Nodes;}
-      std::vector<std::string> getNamesVector() const {return Names;}
-      
-  };
-
-  typedef NodeTypeID NodeTypeID;
-
-  private:
-  NodeTypeID NodeTID;
-  
-  
-  public:
-
-  void setTypeID(NodeTypeID& tid) {NodeTID = tid;}
-  NodeTypeID getTypeID() const {return NodeTID;}
+  /// Index of the TyChe allocation site of this node in the site table of
+  /// the MachineFunction, or 0 (see MachineFunction::addTyCheSite()).
+  unsigned getTyCheSite() const { return TyCheSiteIdx; }
+  bool hasTyCheSite() const { return TyCheSiteIdx != 0; }
+  void setTyCheSite(unsigned Idx) { TyCheSiteIdx = Idx; }
 
   /// Return the SelectionDAG opcode value for this node. For
   /// pre-isel nodes (those for which isMachineOpcode returns false), these
@@ -953,12 +904,9 @@ protected:
   /// SDNodes are created without any operands, and never own the operand
   /// storage. To add operands, see SelectionDAG::createOperands.
   SDNode(unsigned Opc, unsigned Order, DebugLoc dl, SDVTList VTs)
-      : NodeType(Opc), NodeId(-1), OperandList(nullptr), ValueList(VTs.VTs),
-        UseList(nullptr), NumOperands(0), NumValues(VTs.NumVTs), IROrder(Order),
-        debugLoc(std::move(dl)), 
-        NodeTID(SDNode::NodeTypeID(std::vector<uint64_t>(), std::vector<std::string>(), false)) 
-  {
-
+      : NodeType(Opc), NodeId(-1), TyCheSiteIdx(0), OperandList(nullptr),
+        ValueList(VTs.VTs), UseList(nullptr), NumOperands(0),
+        NumValues(VTs.NumVTs), IROrder(Order), debugLoc(std::move(dl)) {
     memset(&RawSDNodeBits, 0, sizeof(RawSDNodeBits));
     assert(debugLoc.hasTrivialDestructor() && "Expected trivial destructor");
     assert(NumValues == VTs.NumVTs &&
@@ -401,6 +401,9 @@ public:
     Argument(StringRef Key, Type *T);
     Argument(StringRef Key, int N);
     Argument(StringRef Key, unsigned N);
+    Argument(StringRef Key, unsigned long N);
+    Argument(StringRef Key, unsigned long long N);
+    Argument(StringRef Key, StringRef S) : Key(Key), Val(S) {}
     Argument(StringRef Key, bool B) : Key(Key), Val(B ? "true" : "false") {}
   };
 
@@ -225,7 +225,9 @@ public:
   /// Drop all unknown metadata except for debug locations.
   /// @{
   /// Passes are required to drop metadata they don't understand. This is a
-  /// convenience method for passes to do so.
+  /// convenience method for passes to do so.  The EffectiveSan type
+  /// annotation is always kept: it describes the value, so it stays valid
+  /// when the instruction is hoisted or speculated.
   void dropUnknownNonDebugMetadata(ArrayRef<unsigned> KnownIDs);
   void dropUnknownNonDebugMetadata() {
     return dropUnknownNonDebugMetadata(None);
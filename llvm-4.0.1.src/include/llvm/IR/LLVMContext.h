@@ -78,6 +78,8 @@ public:
     MD_type = 19,                     // "type"
     MD_section_prefix = 20,           // "section_prefix"
     MD_absolute_symbol = 21,          // "absolute_symbol"
+    MD_effective_san = 22,            // "effectiveSan"
+    MD_tyche = 23,                    // "TYCHE_MD"
   };
 
   /// Known operand bundle tag IDs, which always have the same value.  All
@@ -1382,6 +1382,61 @@ public:
 /// not exist.
 DIType *getEffectiveSanType(const llvm::Value *Ptr);
 
+/// TYCHE
+/// Get the path of the TyChe sidecar file \p Name (e.g.
+/// "allocation_points.hash") for the given module.  If the EffectiveSan pass
+/// recorded an output prefix for the translation unit (see
+/// -effective-output-prefix) the file is "<prefix>.<Name>", otherwise it is
+/// \p Name in the working directory.
+std::string getTyCheSidecarPath(const Module &M, StringRef Name);
+
+/// TYCHE
+/// Returns true if the TyChe sidecar files of the given module are private to
+/// its translation unit, i.e. writers should truncate rather than append to
+/// them when first opened.
+bool hasTyCheOutputPrefix(const Module &M);
+
+/// TYCHE
+/// The integer operands of the TYCHE_MD attachment of an allocation site, in
+/// operand order.  The type name of the allocated object follows them as the
+/// last operand.
+enum TyCheMDField {
+  TyCheMDLine,
+  TyCheMDCol,
+  TyCheMDMetaID,
+  TyCheMDHash0,
+  TyCheMDHash1,
+  TyCheMDInlinedLine,
+  TyCheMDInlinedCol,
+  TyCheMDBlockID,
+  TyCheMDSiteID,
+  TyCheMDTypeID,
+  TyCheMDNumFields
+};
+
+/// TYCHE
+/// Build the TYCHE_MD attachment for an allocation site from its
+/// \c TyCheMDNumFields integer fields and the name of the allocated type.
+MDTuple *getTyCheMD(LLVMContext &C, ArrayRef<uint64_t> Fields,
+                    StringRef TypeName);
+
+/// TYCHE
+/// Get an integer field of a TYCHE_MD attachment, or 0 if the node is not one.
+uint64_t getTyCheMDField(const MDNode *MD, TyCheMDField Field);
+
+/// TYCHE
+/// Get the allocated type name of a TYCHE_MD attachment, or the empty string
+/// if the node is not one.
+StringRef getTyCheMDTypeName(const MDNode *MD);
+
+/// TYCHE
+/// Returns true if the TyChe instrumentation and code generation should
+/// report the allocation sites they handle as analysis remarks of the
+/// "tyche" pass (-tyche-remarks).  The remarks are streamed to the
+/// -pass-remarks-output file and printed for -pass-remarks-analysis=tyche.
+/// Callers must not build a remark when this returns false.
+bool areTyCheRemarksEnabled();
+
 } // end namespace llvm
 
 #endif // LLVM_IR_METADATA_H
@@ -270,7 +270,6 @@ void initializePhysicalRegisterUsageInfoPass(PassRegistry &);
 void initializePartialInlinerLegacyPassPass(PassRegistry &);
 void initializePartiallyInlineLibCallsLegacyPassPass(PassRegistry &);
 void initializePatchableFunctionPass(PassRegistry &);
-void initializeDumpTyCHEStackObjectsPass(PassRegistry &);
 void initializePeepholeOptimizerPass(PassRegistry&);
 void initializePlaceBackedgeSafepointsImplPass(PassRegistry&);
 void initializePlaceSafepointsPass(PassRegistry&);
@@ -103,6 +103,10 @@ ModulePass *createInstrProfilingLegacyPass(
 // Insert EffectiveSan instrumentation
 ModulePass *createEffectiveSanPass();
 
+// Record the EffectiveSan type annotations, so that the EffectiveSan pass can
+// report the ones dropped by the optimizer (-effective-verify-metadata).
+FunctionPass *createEffectiveSanTrackMetadataPass();
+
 // Insert AddressSanitizer (address sanity checking) instrumentation
 FunctionPass *createAddressSanitizerFunctionPass(bool CompileKernel = false,
                                                  bool Recover = false,
@@ -0,0 +1,356 @@
+//===- TyCheDB.h - TyChe allocation-point database --------------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines the binary allocation-point database emitted by the
+// EffectiveSan pass for the TyChe simulator, together with a writer and an
+// mmap-based reader.
+//
+// The file is a little-endian image made of fixed-size records:
+//
+//   DBHeader
+//   DBType[NumTypes]             one per compiled type layout
+//   DBField[NumFields]           layout entries, grouped per type
+//   DBSite[NumSites]             heap/stack/argument/return allocation sites
+//   uint32_t[TypeIndexSize]      type ID -> DBType index (open addressing)
+//   uint32_t[SiteIndexSize]      site ID -> DBSite index (open addressing)
+//   DBTypeRemap[NumTypeRemaps]   original type ID -> type ID, sorted
+//   char[StringsSize]            NUL-terminated string pool
+//
+// All sections are 8-byte aligned and addressed by offsets stored in the
+// header, so a consumer can map the file and use the records in place.
+// String fields are byte offsets into the string pool; offset 0 is the
+// empty string.
+//
+// The header also records the size of the TyChe section metadata emitted for
+// the types (see TYCHE_SPARSE_META in effective.h) next to the size the dense
+// per-offset encoding would have needed.  Merging sums them, so a database
+// merged from all modules of a program reports the totals for the binary.
+//
+// The type IDs of a per-module database lie in the module's ID range (see
+// TYCHE_TYPE_ID_LOCAL_BITS in effective.h), or are derived from the type
+// hashes under LTO, so the type index is hashed like the site index.  A
+// merged database renumbers them densely and keeps the original IDs in the
+// remap table.
+//
+// The call sites of the allocators and the stack frames of the instrumented
+// functions are not part of the database.  The code generator emits them into
+// the .tyche_callsites and .tyche_frames sections of the object file (see
+// CallSiteRecord and FrameRecord), so they follow the code through the link
+// and can be looked up by address with a CallSiteTable or a FrameTable.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_INSTRUMENTATION_TYCHEDB_H
+#define LLVM_TRANSFORMS_INSTRUMENTATION_TYCHEDB_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm {
+namespace tyche {
+
+/// "TYCHEDB\0" read as a little-endian 64-bit integer.
+const uint64_t DBMagic = 0x0042444548435954ULL;
+
+/// Bumped on every incompatible change to the record layouts below.
+const uint32_t DBVersion = 4;
+
+/// Marks an empty slot in the type and site indexes.
+const uint32_t DBNoIndex = UINT32_MAX;
+
+struct DBHeader {
+  uint64_t Magic;
+  uint32_t Version;
+  uint32_t HeaderSize;
+  uint64_t NumTypes;
+  uint64_t TypesOffset;
+  uint64_t NumFields;
+  uint64_t FieldsOffset;
+  uint64_t NumSites;
+  uint64_t SitesOffset;
+  uint64_t TypeIndexSize;     // Always a power of two (or zero).
+  uint64_t TypeIndexOffset;
+  uint64_t SiteIndexSize;     // Always a power of two (or zero).
+  uint64_t SiteIndexOffset;
+  uint64_t NumTypeRemaps;
+  uint64_t TypeRemapsOffset;
+  uint64_t StringsSize;
+  uint64_t StringsOffset;
+  uint64_t MetaBytes;         // TyChe section metadata, sparse encoding.
+  uint64_t DenseMetaBytes;    // Same, had it been emitted densely.
+};
+
+/// A compiled type layout.  Corresponds to one APSIZE block of the textual
+/// allocation_points.hash format.
+struct DBType {
+  uint64_t ID;                // TyChe type ID.
+  uint64_t Hash[2];           // buildTypeHash() value.
+  uint32_t Name;              // Human-readable type name.
+  uint32_t File;              // Source file of the defining module.
+  uint32_t FirstField;        // Index of the first DBField.
+  uint32_t NumFields;
+};
+
+enum DBFieldFlags : uint32_t {
+  DBFieldCoerced = 0x1,
+  DBFieldFAM = 0x2,
+  DBFieldVPtr = 0x4,
+};
+
+/// A (sub-)object at a given offset within a type layout.
+struct DBField {
+  uint64_t Offset;
+  int64_t LB;                 // Sub-object bounds relative to the
+  int64_t UB;                 // start of the enclosing object.
+  uint32_t Name;
+  uint32_t MetaType;          // Printed DIType of the sub-object.
+  uint32_t ParentType;        // Printed DIType of the parent, or 0.
+  uint32_t Flags;             // DBFieldFlags.
+};
+
+enum DBSiteKind : uint32_t {
+  DBSiteHeap = 0,             // malloc, new, new[]
+  DBSiteCalloc,
+  DBSiteRealloc,
+  DBSiteFree,                 // free, delete, delete[]
+  DBSiteStack,                // alloca
+  DBSiteArgument,
+  DBSiteReturn,
+};
+
+/// An allocation point.  Corresponds to one METAID line of the textual
+/// format.
+struct DBSite {
+  uint64_t ID;                // Site (instruction) ID.
+  uint64_t BlockID;           // Basic block ID.
+  uint64_t TypeID;            // TyChe type ID of the allocated object.
+  uint64_t Hash[2];           // Type hash.
+  uint32_t Kind;              // DBSiteKind.
+  uint32_t File;
+  uint32_t Allocator;         // Called allocator (or "Alloca", ...).
+  uint32_t Caller;            // Enclosing function.
+  uint32_t TypeName;
+  uint32_t Line;
+  uint32_t Col;
+  uint32_t InlinedLine;
+  uint32_t InlinedCol;
+  uint32_t _pad;
+};
+
+/// Maps a type ID of an input of "llvm-tyche merge" to the ID of the type in
+/// the merged database.
+struct DBTypeRemap {
+  uint64_t From;
+  uint64_t To;
+};
+
+static_assert(sizeof(DBHeader) == 144, "unexpected DBHeader layout");
+static_assert(sizeof(DBType) == 40, "unexpected DBType layout");
+static_assert(sizeof(DBField) == 40, "unexpected DBField layout");
+static_assert(sizeof(DBSite) == 80, "unexpected DBSite layout");
+static_assert(sizeof(DBTypeRemap) == 16, "unexpected DBTypeRemap layout");
+
+/// Name of the object-file section that holds the CallSiteRecords.
+const char CallSiteSectionName[] = ".tyche_callsites";
+
+/// An allocator call, as emitted by the code generator.  The return address
+/// is stored relative to the address of the record itself, so the section
+/// needs no dynamic relocations in position-independent binaries.  Tail calls
+/// to an allocator have no return address in the calling function and get no
+/// record.
+struct CallSiteRecord {
+  int64_t PCOffset;           // Return address - address of this record.
+  uint64_t SiteID;            // DBSite::ID of the allocation site.
+  uint64_t TypeID;            // TyChe type ID of the allocated object.
+  uint32_t Kind;              // DBSiteKind.
+  uint32_t _pad;
+};
+
+static_assert(sizeof(CallSiteRecord) == 32, "unexpected CallSiteRecord layout");
+
+/// An allocator call of a linked binary.
+struct CallSiteInfo {
+  uint64_t PC;                // Return address of the call.
+  uint64_t SiteID;
+  uint64_t TypeID;
+  uint32_t Kind;              // DBSiteKind.
+};
+
+/// The allocator calls of a binary, sorted by return address.
+class CallSiteTable {
+  std::vector<CallSiteInfo> Sites;
+
+public:
+  /// Add the records of a .tyche_callsites section whose contents
+  /// \p Contents are loaded at address \p Address.
+  Error addSection(StringRef Contents, uint64_t Address);
+
+  ArrayRef<CallSiteInfo> sites() const { return Sites; }
+
+  /// Return the call with return address \p PC, or nullptr.  O(log n).
+  const CallSiteInfo *lookup(uint64_t PC) const;
+};
+
+/// Name of the object-file section that holds the FrameRecords.
+const char FrameSectionName[] = ".tyche_frames";
+
+/// The stack frame of an instrumented function, as emitted by the code
+/// generator.  It is followed by \c NumSlots FrameSlotRecords.  As for call
+/// sites, the function address is stored relative to the record.
+struct FrameRecord {
+  int64_t FunctionOffset;     // Function symbol - address of this record.
+  uint32_t NumSlots;
+  uint32_t _pad;
+};
+
+enum FrameSlotFlags : uint32_t {
+  FrameSlotFixed = 0x1,       // Incoming argument or callee-saved area.
+  FrameSlotSpill = 0x2,
+  FrameSlotVariableSized = 0x4, // Offset is not meaningful.
+};
+
+/// A stack object of a frame.
+struct FrameSlotRecord {
+  int64_t Offset;             // Relative to the canonical frame address.
+  uint64_t Size;
+  uint64_t TypeID;            // TyChe type ID, or 0 if the object is untyped.
+  uint64_t SiteID;            // DBSite::ID of the alloca, or 0.
+  uint32_t Alignment;
+  uint32_t Flags;             // FrameSlotFlags.
+};
+
+static_assert(sizeof(FrameRecord) == 16, "unexpected FrameRecord layout");
+static_assert(sizeof(FrameSlotRecord) == 40,
+              "unexpected FrameSlotRecord layout");
+
+/// The stack frame of a function of a linked binary.
+struct FrameInfo {
+  uint64_t Function;          // Address of the function.
+  std::vector<FrameSlotRecord> Slots;
+};
+
+/// The stack frames of a binary, sorted by function address.
+class FrameTable {
+  std::vector<FrameInfo> Frames;
+
+public:
+  /// Add the records of a .tyche_frames section whose contents \p Contents
+  /// are loaded at address \p Address.
+  Error addSection(StringRef Contents, uint64_t Address);
+
+  ArrayRef<FrameInfo> frames() const { return Frames; }
+
+  /// Return the frame of the function at address \p Function, or nullptr.
+  /// O(log n).
+  const FrameInfo *lookup(uint64_t Function) const;
+};
+
+/// Builds a database in memory and serializes it.
+class DBWriter {
+  std::vector<DBType> Types;
+  std::vector<DBField> Fields;
+  std::vector<DBSite> Sites;
+  std::vector<DBTypeRemap> TypeRemaps;
+  std::string Strings;
+  StringMap<uint32_t> StringOffsets;
+  uint64_t MetaBytes = 0;
+  uint64_t DenseMetaBytes = 0;
+
+public:
+  DBWriter();
+
+  /// Intern \p S in the string pool and return its offset.
+  uint32_t addString(StringRef S);
+
+  /// Add a type with the given layout.  \c FirstField and \c NumFields of
+  /// \p T are filled in by the writer.
+  void addType(DBType T, ArrayRef<DBField> TypeFields);
+
+  void addSite(const DBSite &S);
+
+  /// Record that type \p From of an input database is type \p To of this
+  /// one.  Later remaps of the same \p From are ignored.
+  void addTypeRemap(uint64_t From, uint64_t To);
+
+  /// Account for TyChe section metadata of \p Bytes bytes that would have
+  /// taken \p DenseBytes bytes in the dense encoding.
+  void addMetaBytes(uint64_t Bytes, uint64_t DenseBytes) {
+    MetaBytes += Bytes;
+    DenseMetaBytes += DenseBytes;
+  }
+
+  size_t getNumTypes() const { return Types.size(); }
+  size_t getNumSites() const { return Sites.size(); }
+  uint64_t getMetaBytes() const { return MetaBytes; }
+  uint64_t getDenseMetaBytes() const { return DenseMetaBytes; }
+
+  /// Serialize the database to \p OS.
+  void write(raw_ostream &OS) const;
+
+  /// Serialize the database to \p Path, replacing any existing file.
+  Error writeToFile(StringRef Path) const;
+};
+
+/// Read-only view of a database.  The underlying buffer is normally a
+/// mapped file; all accessors return pointers into it.
+class DBReader {
+  std::unique_ptr<MemoryBuffer> Buffer;
+  const DBHeader *Header = nullptr;
+
+  explicit DBReader(std::unique_ptr<MemoryBuffer> Buffer)
+      : Buffer(std::move(Buffer)) {}
+  Error validate();
+
+public:
+  static Expected<std::unique_ptr<DBReader>> create(const Twine &Path);
+  static Expected<std::unique_ptr<DBReader>>
+  create(std::unique_ptr<MemoryBuffer> Buffer);
+
+  const DBHeader &getHeader() const { return *Header; }
+
+  ArrayRef<DBType> types() const;
+  ArrayRef<DBField> fields() const;
+  ArrayRef<DBField> fields(const DBType &T) const;
+  ArrayRef<DBSite> sites() const;
+  ArrayRef<DBTypeRemap> typeRemaps() const;
+
+  /// Return the type with the given ID, or nullptr.  O(1) expected.
+  const DBType *lookupType(uint64_t ID) const;
+
+  /// Return the ID in this database of the type that had ID \p ID before
+  /// merging, or \p ID itself if it was not remapped.  O(log n).
+  uint64_t remapTypeID(uint64_t ID) const;
+
+  /// Return the site with the given ID, or nullptr.  O(1) expected.
+  const DBSite *lookupSite(uint64_t ID) const;
+
+  /// Return the string at offset \p Offset in the string pool.
+  StringRef getString(uint32_t Offset) const;
+};
+
+/// Hash used for the type and site indexes.
+inline uint64_t hashID(uint64_t ID) {
+  ID ^= ID >> 33;
+  ID *= 0xff51afd7ed558ccdULL;
+  ID ^= ID >> 33;
+  return ID;
+}
+
+} // end namespace tyche
+} // end namespace llvm
+
+#endif
@@ -392,7 +392,7 @@ InsertPHITranslatedSubExpr(Value *InVal, BasicBlock *CurBB,
     New->setDebugLoc(Inst->getDebugLoc());
     auto *Ty = getEffectiveSanType(Cast);
     if (Ty)
-      New->setMetadata("effectiveSan", Ty);
+      New->setMetadata(LLVMContext::MD_effective_san, Ty);
     NewInsts.push_back(New);
     return New;
   }
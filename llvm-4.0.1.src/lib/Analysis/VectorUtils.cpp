@@ -457,7 +457,8 @@ Instruction *llvm::propagateMetadata(Instruction *Inst, ArrayRef<Value *> VL) {
   for (auto Kind :
        {LLVMContext::MD_tbaa, LLVMContext::MD_alias_scope,
         LLVMContext::MD_noalias, LLVMContext::MD_fpmath,
-        LLVMContext::MD_nontemporal, LLVMContext::MD_invariant_load}) {
+        LLVMContext::MD_nontemporal, LLVMContext::MD_invariant_load,
+        LLVMContext::MD_effective_san}) {
     MDNode *MD = I0->getMetadata(Kind);
 
     for (int J = 1, E = VL.size(); MD && J != E; ++J) {
@@ -478,6 +479,11 @@ Instruction *llvm::propagateMetadata(Instruction *Inst, ArrayRef<Value *> VL) {
       case LLVMContext::MD_invariant_load:
         MD = MDNode::intersect(MD, IMD);
         break;
+      case LLVMContext::MD_effective_san:
+        // Only keep the type annotation if all the scalars agree on it.
+        if (MD != IMD)
+          MD = nullptr;
+        break;
       default:
         llvm_unreachable("unhandled metadata");
       }
@@ -20,6 +20,7 @@
 #include "WinException.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/Analysis/OptimizationDiagnosticInfo.h"
 #include "llvm/CodeGen/Analysis.h"
 #include "llvm/CodeGen/GCMetadataPrinter.h"
 #include "llvm/CodeGen/MachineConstantPool.h"
@@ -44,6 +45,7 @@
 #include "llvm/MC/MCStreamer.h"
 #include "llvm/MC/MCSymbolELF.h"
 #include "llvm/MC/MCValue.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/Format.h"
 #include "llvm/Support/MathExtras.h"
@@ -55,6 +57,7 @@
 #include "llvm/Target/TargetLoweringObjectFile.h"
 #include "llvm/Target/TargetRegisterInfo.h"
 #include "llvm/Target/TargetSubtargetInfo.h"
+#include "llvm/Transforms/Instrumentation/TyCheDB.h"
 using namespace llvm;
 
 #define DEBUG_TYPE "asm-printer"
@@ -71,6 +74,11 @@ static const char *const CodeViewLineTablesGroupDescription =
 
 STATISTIC(EmittedInsts, "Number of machine instrs printed");
 
+static cl::opt<bool> TyCheCallSiteLabels(
+    "tyche-callsite-labels", cl::Hidden, cl::init(false),
+    cl::desc("Also label TyChe allocator calls with the legacy TYCHE_SYMS "
+             "symbols next to the .tyche_callsites records"));
+
 char AsmPrinter::ID = 0;
 
 typedef DenseMap<GCStrategy*, std::unique_ptr<GCMetadataPrinter>> gcp_map_type;
@@ -874,6 +882,21 @@ void AsmPrinter::emitFrameAlloc(const MachineInstr &MI) {
                              MCConstantExpr::create(FrameOffset, OutContext));
 }
 
+/// TYCHE: Report an allocator call recorded in .tyche_callsites as a "tyche"
+/// analysis remark.
+static void emitTyCheRemark(OptimizationRemarkEmitter &ORE,
+                            const MachineInstr &MI, const TyCheSite &Site) {
+  typedef DiagnosticInfoOptimizationBase::Argument Arg;
+  const MachineBasicBlock &MBB = *MI.getParent();
+  BasicBlock *BB = const_cast<BasicBlock *>(MBB.getBasicBlock());
+  OptimizationRemarkAnalysis R("tyche", "CallSite", MI.getDebugLoc(), BB);
+  ORE.emit(
+      R << "call to " << Arg("Allocator", StringRef(Site.Names[0]))
+        << " in machine block " << Arg("MBB", unsigned(MBB.getNumber()))
+        << " records site " << Arg("SiteID", Site.Nodes[TyCheMDSiteID])
+        << ", type ID " << Arg("TypeID", Site.Nodes[TyCheMDTypeID]));
+}
+
 /// EmitFunctionBody - This method emits the body and trailer for a
 /// function.
 void AsmPrinter::EmitFunctionBody() {
@@ -884,6 +907,13 @@ void AsmPrinter::EmitFunctionBody() {
 
   bool ShouldPrintDebugScopes = MMI->hasDebugInfo();
 
+  // TYCHE: Building an emitter may compute BFI (for hotness), so build one for
+  // the whole function rather than one per remark.
+  std::unique_ptr<OptimizationRemarkEmitter> TyCheORE;
+  if (areTyCheRemarksEnabled())
+    TyCheORE.reset(new OptimizationRemarkEmitter(
+        const_cast<Function *>(MF->getFunction())));
+
   // Print out code for the function.
   bool HasAnyRealCode = false;
   for (auto &MBB : *MF) {
@@ -892,45 +922,16 @@ void AsmPrinter::EmitFunctionBody() {
     for (auto &MI : MBB) {      
 
 
-      if (MI.getMITypeID().isValid() && MI.getDesc().isCall()) {
-
-        for (const MachineOperand &MO : MI.operands())
-        {
-            if (MO.isGlobal())
-            {
-                StringRef name = MO.getGlobal()->getName();
-                if (name == "malloc" || 
-                    name == "_Znwm" || // new
-                    name == "_Znam" ||                   // new[]
-                    name == "_ZnwmRKSt9nothrow_t" || // new (nothrow)
-                    name == "_ZnamRKSt9nothrow_t" || 
-                    name == "calloc" ||
-                    name == "realloc" ||
-                    name == "free" || 
-                    name == "_ZdlPv" || // delete
-                    name == "_ZdaPv") // delete[] (nothrow)
-                {
-
-                  std::error_code EC;
-                  llvm::raw_fd_ostream file("tyche.debug", EC, llvm::sys::fs::F_Append);
-                  
-                  file << "EmitFunctionBody::\n" ;
-                  MI.print(file); file << "\n";
-                  
-                  std::string symbol_name = "TYCHE_SYMS#" + 
-                                          getModuleIdentifier() + "#" +
-                                          MI.getMITypeID().dump();
-                  file << "Dumping Symbol Name: " << symbol_name << "\n"; 
-                  file << "---------------------------------------------------------------------------------------\n";
-                  MCSymbol *CSLabel = getTempSymbol(symbol_name);
-                  
-                  OutStreamer->EmitSymbolAttribute(CSLabel, MCSA_Internal);
-                  OutStreamer->EmitLabel(CSLabel);
-                  //outs() << "Symbol Kind: " << (uint64_t)(CSLabel->getSection().getKind()) << "\n";
-                }
-            }
-        }     
-            
+      // TYCHE: Only allocator calls carry a site (see LowerCallTo).
+      bool IsTyCheCall = MI.hasTyCheSite() && MI.getDesc().isCall();
+      if (IsTyCheCall && TyCheCallSiteLabels) {
+        std::string symbol_name = "TYCHE_SYMS#" +
+                                  getModuleIdentifier() + "#" +
+                                  MF->getTyCheSite(MI.getTyCheSite()).dump();
+        MCSymbol *CSLabel = getTempSymbol(symbol_name);
+
+        OutStreamer->EmitSymbolAttribute(CSLabel, MCSA_Internal);
+        OutStreamer->EmitLabel(CSLabel);
       }
 
       // Print the assembly for the instruction.
@@ -985,6 +986,21 @@ void AsmPrinter::EmitFunctionBody() {
         break;
       }
 
+      // TYCHE: Label the return address of the call for .tyche_callsites.  A
+      // tail call (e.g. free(p) emitted as a jmp) returns to our caller, so
+      // no runtime PC can ever match a label after it; it is not recorded.
+      if (IsTyCheCall && !MI.isReturn()) {
+        const TyCheSite &Site = MF->getTyCheSite(MI.getTyCheSite());
+        MCSymbol *ReturnAddress =
+            OutContext.createTempSymbol("tyche_ret", true);
+        OutStreamer->EmitLabel(ReturnAddress);
+        TyCheCallSites.push_back(
+            TyCheCallSite{ReturnAddress, Site.Nodes[TyCheMDSiteID],
+                          Site.Nodes[TyCheMDTypeID], Site.Kind});
+        if (TyCheORE)
+          emitTyCheRemark(*TyCheORE, MI, Site);
+      }
+
       if (ShouldPrintDebugScopes) {
         for (const HandlerInfo &HI : Handlers) {
           NamedRegionTimer T(HI.TimerName, HI.TimerDescription,
@@ -1060,6 +1076,9 @@ void AsmPrinter::EmitFunctionBody() {
     HI.Handler->endFunction(MF);
   }
 
+  emitTyCheCallSites();
+  emitTyCheFrame();
+
   OutStreamer->AddBlankLine();
 }
 
@@ -2766,6 +2785,105 @@ void AsmPrinter::recordSled(MCSymbol *Sled, const MachineInstr &MI,
     XRayFunctionEntry{ Sled, CurrentFnSym, Kind, AlwaysInstrument, Fn });
 }
 
+/// TYCHE: Get the section \p Name for the TyChe records of function \p Fn.
+/// Like the XRay table, the sections are only emitted for ELF, and join the
+/// COMDAT group of the function so that they are discarded along with it.
+static MCSection *getTyCheSection(MCContext &Ctx, const Function &Fn,
+                                  StringRef Name) {
+  if (Fn.hasComdat())
+    return Ctx.getELFSection(Name, ELF::SHT_PROGBITS,
+                             ELF::SHF_ALLOC | ELF::SHF_GROUP, 0,
+                             Fn.getComdat()->getName());
+  return Ctx.getELFSection(Name, ELF::SHT_PROGBITS, ELF::SHF_ALLOC);
+}
+
+/// TYCHE: Emit the difference between \p Sym and a new label at the current
+/// position, which keeps the TyChe sections free of dynamic relocations.
+static void emitTyCheOffset(MCStreamer &OutStreamer, MCContext &Ctx,
+                            const MCSymbol *Sym, const Twine &Name) {
+  MCSymbol *Here = Ctx.createTempSymbol(Name, true);
+  OutStreamer.EmitLabel(Here);
+  OutStreamer.EmitValue(
+      MCBinaryExpr::createSub(MCSymbolRefExpr::create(Sym, Ctx),
+                              MCSymbolRefExpr::create(Here, Ctx), Ctx),
+      8);
+}
+
+void AsmPrinter::emitTyCheCallSites() {
+  if (TyCheCallSites.empty())
+    return;
+  if (!MF->getSubtarget().getTargetTriple().isOSBinFormatELF()) {
+    TyCheCallSites.clear();
+    return;
+  }
+
+  // The records are laid out as tyche::CallSiteRecord.
+  OutStreamer->PushSection();
+  OutStreamer->SwitchSection(getTyCheSection(
+      OutContext, *MF->getFunction(), tyche::CallSiteSectionName));
+  EmitAlignment(3);
+  for (const TyCheCallSite &CS : TyCheCallSites) {
+    emitTyCheOffset(*OutStreamer, OutContext, CS.ReturnAddress,
+                    "tyche_callsite");
+    OutStreamer->EmitIntValue(CS.SiteID, 8);
+    OutStreamer->EmitIntValue(CS.TypeID, 8);
+    OutStreamer->EmitIntValue(CS.Kind, 4);
+    OutStreamer->EmitIntValue(0, 4);
+  }
+  OutStreamer->PopSection();
+  TyCheCallSites.clear();
+}
+
+void AsmPrinter::emitTyCheFrame() {
+  // Only the functions instrumented by the EffectiveSan pass, which all carry
+  // TYCHE_MD_ARGS, get a frame record.
+  const Function *Fn = MF->getFunction();
+  if (!Fn->getMetadata("TYCHE_MD_ARGS") ||
+      !MF->getSubtarget().getTargetTriple().isOSBinFormatELF())
+    return;
+
+  const MachineFrameInfo &MFI = MF->getFrameInfo();
+  uint32_t NumSlots = 0;
+  for (int i = MFI.getObjectIndexBegin(); i != MFI.getObjectIndexEnd(); i++)
+    if (!MFI.isDeadObjectIndex(i))
+      NumSlots++;
+
+  // The records are laid out as tyche::FrameRecord, followed by one
+  // tyche::FrameSlotRecord per live stack object.
+  OutStreamer->PushSection();
+  OutStreamer->SwitchSection(
+      getTyCheSection(OutContext, *Fn, tyche::FrameSectionName));
+  EmitAlignment(3);
+  emitTyCheOffset(*OutStreamer, OutContext, CurrentFnSym, "tyche_frame");
+  OutStreamer->EmitIntValue(NumSlots, 4);
+  OutStreamer->EmitIntValue(0, 4);
+  for (int i = MFI.getObjectIndexBegin(); i != MFI.getObjectIndexEnd(); i++) {
+    if (MFI.isDeadObjectIndex(i))
+      continue;
+    uint32_t Flags = 0;
+    if (MFI.isFixedObjectIndex(i))
+      Flags |= tyche::FrameSlotFixed;
+    if (MFI.isSpillSlotObjectIndex(i))
+      Flags |= tyche::FrameSlotSpill;
+    if (MFI.isVariableSizedObjectIndex(i))
+      Flags |= tyche::FrameSlotVariableSized;
+    const MDNode *MD = nullptr;
+    if (const AllocaInst *Alloca = MFI.getObjectAllocation(i))
+      MD = Alloca->getMetadata(LLVMContext::MD_tyche);
+
+    // Object offsets are relative to the stack pointer before the call, i.e.
+    // the CFA; subtracting the local area offset would make them relative to
+    // the return address slot instead.
+    OutStreamer->EmitIntValue(MFI.getObjectOffset(i), 8);
+    OutStreamer->EmitIntValue(MFI.getObjectSize(i), 8);
+    OutStreamer->EmitIntValue(getTyCheMDField(MD, TyCheMDTypeID), 8);
+    OutStreamer->EmitIntValue(getTyCheMDField(MD, TyCheMDSiteID), 8);
+    OutStreamer->EmitIntValue(MFI.getObjectAlignment(i), 4);
+    OutStreamer->EmitIntValue(Flags, 4);
+  }
+  OutStreamer->PopSection();
+}
+
 uint16_t AsmPrinter::getDwarfVersion() const {
   return OutStreamer->getContext().getDwarfVersion();
 }
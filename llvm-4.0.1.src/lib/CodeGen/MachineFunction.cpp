@@ -210,6 +210,22 @@ getOrCreateJumpTableInfo(unsigned EntryKind) {
   return JumpTableInfo;
 }
 
+const TyCheSite &MachineFunction::getTyCheSite(unsigned Idx) const {
+  static const TyCheSite NoSite;
+  assert(Idx <= TyCheSites.size() && "TyChe site index out of range");
+  return Idx ? TyCheSites[Idx - 1] : NoSite;
+}
+
+std::string TyCheSite::dump() const {
+  std::string Str;
+  raw_string_ostream OS(Str);
+  for (uint64_t Node : Nodes)
+    OS << Node << '#';
+  for (const std::string &Name : Names)
+    OS << Name << '#';
+  return OS.str();
+}
+
 /// Should we be emitting segmented stack stuff for the function
 bool MachineFunction::shouldSplitStack() const {
   return getFunction()->hasFnAttribute("split-stack");
@@ -919,142 +935,6 @@ unsigned MachineFrameInfo::estimateStackSize(const MachineFunction &MF) const {
   return (unsigned)Offset;
 }
 
-
-void MachineFrameInfo::dumpFrameInfo(const MachineFunction &MF, raw_ostream &OS) const{
-  
-  
-  const llvm::Function *F = MF.getFunction();
-  MDNode *Metadata = F->getMetadata("TYCHE_MD_ARGS");
-  
-  int numOfReturnMeta = 0;
-  for (auto &BB : *F) 
-  {
-    for (auto &I : BB) 
-    {
-        if (llvm::isa<llvm::ReturnInst>(&I))
-        {
-            auto *Return = llvm::dyn_cast<llvm::ReturnInst>(&I);
-            llvm::MDNode *Metadata = Return->getMetadata("TYCHE_MD");
-            if (Metadata != nullptr)
-            {
-              numOfReturnMeta++;
-            }
-        }
-    }
-  }
-
-  OS << "NUM " << Objects.size() << " " << 
-                  ((Metadata == nullptr) ? 0 : Metadata->getNumOperands()) << " " << 
-                  numOfReturnMeta << "\n";
-
-  if (Metadata == nullptr)
-  {
-      OS << "ARGMETA NOMETA\n";
-  }
-  else 
-  {
-      for (int idx = 0; idx < Metadata->getNumOperands(); idx++)
-      {
-          auto *MD = Metadata->getOperand(idx).get();
-          std::string meta = "ARGMETA ";
-          MDString *MDS = dyn_cast<MDString>(MD);
-          llvm::StringRef str = MDS->getString();
-          meta += std::string(str);
-          OS << meta << "\n";
-      }
-  }
-
-
-
-  
-  if (Objects.empty()) 
-  {
-    return;
-  }
-
-  const TargetFrameLowering *FI = MF.getSubtarget().getFrameLowering();
-  int ValOffset = (FI ? FI->getOffsetOfLocalArea() : 0);
-
-  for (unsigned i = 0, e = Objects.size(); i != e; ++i) {
-    const StackObject &SO = Objects[i];
-    OS << "OBJ" << " ";
-    OS << (int)(i-NumFixedObjects) << " ";
-    OS << SO.Size << " ";
-    OS << SO.isSpillSlot << " ";
-    OS << SO.Alignment << " ";
-    OS << (i < NumFixedObjects ? 1 : 0) << " "; // 1: fixed 0: not fixed
-    if (i < NumFixedObjects || SO.SPOffset != -1) {
-      int64_t Off = SO.SPOffset - ValOffset;
-      OS << Off << " ";
-    }
-    OS << "\n";
-
-    const AllocaInst * allocInst = SO.Alloca;
-    if (allocInst != NULL)
-    {
-        llvm::MDNode *Metadata = allocInst->getMetadata("TYCHE_MD");
-        if (Metadata != nullptr)
-        {
-            // const Instruction *Inst = llvm::dyn_cast<llvm::AllocaInst>(allocInst);
-            // just concatante all the operands together
-            std::string meta = "OBJECTMETA ";
-            for (size_t i = 0; i < Metadata->getNumOperands() ; i++)
-            {
-                llvm::Metadata *MD = Metadata->getOperand(i).get();
-                MDString *MDS = dyn_cast<MDString>(MD);
-                llvm::StringRef str = MDS->getString();
-                meta += std::string(str) + "#";
-            }
-
-            OS << meta << "\n";
-        }
-        else 
-        {
-            OS << "OBJECTMETA NOMETA\n";
-        }
-        
-    }
-    else 
-    {
-        OS << "OBJECTMETA NOMETA\n";
-    }
-
-  }
-
-  for (auto &BB : *F) 
-  {
-    for (auto &I : BB) 
-    {
-        if (llvm::isa<llvm::ReturnInst>(&I))
-        {
-            auto *Return = llvm::dyn_cast<llvm::ReturnInst>(&I);
-            llvm::MDNode *Metadata = Return->getMetadata("TYCHE_MD");
-            if (Metadata != nullptr)
-            {
-                // const Instruction *Inst = llvm::dyn_cast<llvm::AllocaInst>(allocInst);
-                // just concatante all the operands together
-                std::string meta = "RETMETA ";
-                for (size_t i = 0; i < Metadata->getNumOperands() ; i++)
-                {
-                    llvm::Metadata *MD = Metadata->getOperand(i).get();
-                    MDString *MDS = dyn_cast<MDString>(MD);
-                    llvm::StringRef str = MDS->getString();
-                    meta += std::string(str) + "#";
-                }
-
-                OS << meta << "\n";
-            }
-            else 
-            {
-                OS << "RETMETA NOMETA\n";
-            }
-        }
-    }
-  }
-
-
-}
-
 void MachineFrameInfo::print(const MachineFunction &MF, raw_ostream &OS) const{
   if (Objects.empty()) return;
 
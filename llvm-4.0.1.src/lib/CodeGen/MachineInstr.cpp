@@ -706,8 +706,7 @@ MachineInstr::MachineInstr(MachineFunction &MF, const MCInstrDesc &tid,
                            DebugLoc dl, bool NoImp)
     : MCID(&tid), Parent(nullptr), Operands(nullptr), NumOperands(0), Flags(0),
       AsmPrinterFlags(0), NumMemRefs(0), MemRefs(nullptr),
-      debugLoc(std::move(dl)),
-      MINodeTID(MachineInstr::MINodeTypeID(std::vector<uint64_t>(), std::vector<std::string>(), false)) {
+      debugLoc(std::move(dl)), TyCheSiteIdx(0) {
   assert(debugLoc.hasTrivialDestructor() && "Expected trivial destructor");
 
   // Reserve space for the expected number of operands.
@@ -719,8 +718,6 @@ MachineInstr::MachineInstr(MachineFunction &MF, const MCInstrDesc &tid,
 
   if (!NoImp)
     addImplicitDefUseOperands(MF);
-
-  
 }
 
 /// MachineInstr ctor - Copies MachineInstr arg exactly
@@ -728,7 +725,8 @@ MachineInstr::MachineInstr(MachineFunction &MF, const MCInstrDesc &tid,
 MachineInstr::MachineInstr(MachineFunction &MF, const MachineInstr &MI)
     : MCID(&MI.getDesc()), Parent(nullptr), Operands(nullptr), NumOperands(0),
       Flags(0), AsmPrinterFlags(0), NumMemRefs(MI.NumMemRefs),
-      MemRefs(MI.MemRefs), debugLoc(MI.getDebugLoc()), MINodeTID(MI.getMITypeID()) {
+      MemRefs(MI.MemRefs), debugLoc(MI.getDebugLoc()),
+      TyCheSiteIdx(MI.TyCheSiteIdx) {
   assert(debugLoc.hasTrivialDestructor() && "Expected trivial destructor");
 
   CapOperands = OperandCapacity::get(MI.getNumOperands());
@@ -1999,8 +1997,14 @@ void MachineInstr::print(raw_ostream &OS, ModuleSlotTracker &MST,
     debugLoc.print(OS);
   }
 
-  // if (MINodeTID.valid)
-    OS << " Node Type ID: [" << MINodeTID.dump() << "]"; 
+  if (TyCheSiteIdx) {
+    OS << " Node Type ID: [";
+    if (MF)
+      OS << MF->getTyCheSite(TyCheSiteIdx).dump();
+    else
+      OS << "site " << TyCheSiteIdx;
+    OS << "]";
+  }
 
   OS << '\n';
 }
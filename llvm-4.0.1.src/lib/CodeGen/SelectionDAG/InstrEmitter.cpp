@@ -23,6 +23,7 @@
 #include "llvm/CodeGen/StackMaps.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/Module.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/MathExtras.h"
@@ -30,7 +31,6 @@
 #include "llvm/Target/TargetLowering.h"
 #include "llvm/Target/TargetSubtargetInfo.h"
 #include "llvm/Support/CommandLine.h"
-#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MD5.h"
 #include "llvm/Support/SpecialCaseList.h"
 #include "llvm/Support/ToolOutputFile.h"
@@ -753,20 +753,6 @@ EmitMachineNode(SDNode *Node, bool IsClone, bool IsCloned,
                 DenseMap<SDValue, unsigned> &VRBaseMap) {
   unsigned Opc = Node->getMachineOpcode();
 
-
-  // Node->print(outs());
-  // outs() << "\n";
-
-  // if (const GlobalAddressSDNode *GADN = dyn_cast<GlobalAddressSDNode>(Node))
-  // {
-
-  //     outs() << "Here!\n";
-  //     if (GADN->getGlobal()->hasName())
-  //     {
-  //         outs() << GADN->getGlobal()->getName() << " CATCHED YOU BITCH!\n";
-  //     }
-  // }
-
   // Handle subreg insert/extract specially
   if (Opc == TargetOpcode::EXTRACT_SUBREG ||
       Opc == TargetOpcode::INSERT_SUBREG ||
@@ -920,49 +906,10 @@ EmitMachineNode(SDNode *Node, bool IsClone, bool IsCloned,
   if (II.hasPostISelHook())
     TLI->AdjustInstrPostInstrSelection(*MIB, Node);
 
-
-
-  if (MIB.getInstr()->getDesc().isCall()) {
-
-        for (const MachineOperand &MO : MIB.getInstr()->operands())
-        {
-            if (MO.isGlobal())
-            {
-                StringRef name = MO.getGlobal()->getName();
-                if (name == "malloc" || 
-                    name == "_Znwm" || // new
-                    name == "_Znam" ||                   // new[]
-                    name == "_ZnwmRKSt9nothrow_t" || // new (nothrow)
-                    name == "_ZnamRKSt9nothrow_t" || 
-                    name == "calloc" ||
-                    name == "realloc" ||
-                    name == "free" || 
-                    name == "_ZdlPv" || // delete
-                    name == "_ZdaPv") // delete[] (nothrow)
-                {
-                  outs() << "Instr Emitter Phase: Node OpCode: " << Node->getOpcode() << " " << Node->getTypeID().dump();
-                  Node->print(outs());
-                  auto MINode = llvm::MachineInstr::MINodeTypeID(Node->getTypeID().getNodesVector(), 
-                                                                Node->getTypeID().getNamesVector(),
-                                                                true);
-
-                  MIB.getInstr()->setMITypeID(MINode);
-                  //MIB.getInstr()->print(outs());
-                  //outs() << " Node TypeID: " << Node->getTypeID() << "\n";
-
-                  outs() <<"\n";
-
-                  std::error_code EC;
-                  llvm::raw_fd_ostream file("tyche.debug", EC, llvm::sys::fs::F_Append);
-                  file << "EmitMachineNode::\n" ;
-                  Node->print(file); file << "\n";
-                  MIB.getInstr()->print(file); file << "\n";
-                  
-                }
-            }
-        }     
-            
-  }
+  // TYCHE: Only allocator calls carry a site (see LowerCallTo).  Both index
+  // the site table of the MachineFunction.
+  if (Node->hasTyCheSite() && MIB.getInstr()->getDesc().isCall())
+    MIB.getInstr()->setTyCheSite(Node->getTyCheSite());
 }
 
 /// EmitSpecialNode - Generate machine code for a target-independent node and
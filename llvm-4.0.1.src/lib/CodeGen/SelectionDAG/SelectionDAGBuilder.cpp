@@ -21,6 +21,7 @@
 #include "llvm/Analysis/BranchProbabilityInfo.h"
 #include "llvm/Analysis/ConstantFolding.h"
 #include "llvm/Analysis/Loads.h"
+#include "llvm/Analysis/OptimizationDiagnosticInfo.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/ValueTracking.h"
 #include "llvm/Analysis/VectorUtils.h"
@@ -68,11 +69,11 @@
 #include "llvm/Target/TargetOptions.h"
 #include "llvm/Target/TargetSubtargetInfo.h"
 #include "llvm/Support/CommandLine.h"
-#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MD5.h"
 #include "llvm/Support/SpecialCaseList.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Instrumentation/TyCheDB.h"
 #include <algorithm>
 #include <utility>
 using namespace llvm;
@@ -854,6 +855,12 @@ void SelectionDAGBuilder::init(GCFunctionInfo *gfi, AliasAnalysis &aa,
   DL = &DAG.getDataLayout();
   Context = DAG.getContext();
   LPadToCallSiteMap.clear();
+  // TYCHE: Building an emitter may compute BFI (for hotness), so build one per
+  // function rather than one per remark.
+  TyCheORE.reset();
+  if (areTyCheRemarksEnabled())
+    TyCheORE.reset(new OptimizationRemarkEmitter(
+        const_cast<Function *>(DAG.getMachineFunction().getFunction())));
 }
 
 /// clear - Clear out the current SelectionDAG and the associated
@@ -5823,6 +5830,111 @@ SelectionDAGBuilder::lowerInvokable(TargetLowering::CallLoweringInfo &CLI,
   return Result;
 }
 
+/// TYCHE: Copies of the same allocation site (e.g. after tail duplication)
+/// share TYCHE_MD.  The lowered call is told apart by its position in its
+/// block (and the number of the machine block), which, unlike its address,
+/// is stable across compiles.
+static uint64_t getTyCheInstIndex(const Instruction *Inst) {
+  uint64_t Idx = 0;
+  for (const Instruction &I : *Inst->getParent()) {
+    if (&I == Inst)
+      break;
+    Idx++;
+  }
+  return Idx;
+}
+
+/// TYCHE: If \p Callee is one of the allocation or deallocation functions
+/// whose calls the EffectiveSan pass annotates with TYCHE_MD, return its name
+/// and set \p Kind to the kind of site.  Otherwise return the empty string.
+static StringRef getTyCheAllocatorName(SDValue Callee,
+                                       const TargetLibraryInfo *LibInfo,
+                                       tyche::DBSiteKind &Kind) {
+  const auto *GADN = dyn_cast<GlobalAddressSDNode>(Callee.getNode());
+  if (GADN == nullptr)
+    return StringRef();
+  const auto *F = dyn_cast<Function>(GADN->getGlobal());
+  LibFunc::Func LF;
+  if (F == nullptr || !LibInfo->getLibFunc(*F, LF))
+    return StringRef();
+  switch (LF) {
+  case LibFunc::malloc:
+  case LibFunc::Znwm:                // new
+  case LibFunc::Znam:                // new[]
+  case LibFunc::ZnwmRKSt9nothrow_t:  // new (nothrow)
+  case LibFunc::ZnamRKSt9nothrow_t:  // new[] (nothrow)
+    Kind = tyche::DBSiteHeap;
+    break;
+  case LibFunc::calloc:
+    Kind = tyche::DBSiteCalloc;
+    break;
+  case LibFunc::realloc:
+    Kind = tyche::DBSiteRealloc;
+    break;
+  case LibFunc::free:
+  case LibFunc::ZdlPv:               // delete
+  case LibFunc::ZdaPv:               // delete[]
+    Kind = tyche::DBSiteFree;
+    break;
+  default:
+    return StringRef();
+  }
+  return F->getName();
+}
+
+/// TYCHE: Build the site table entry of an allocator call from its TYCHE_MD.
+/// The nodes are the integer fields of the metadata followed by the position
+/// of the call in its block and the number of the machine block; the names
+/// are those of the allocator, of the allocated type and of the caller.
+static TyCheSite getTyCheSite(const Instruction *Inst, const MDNode *Metadata,
+                              StringRef Allocator, tyche::DBSiteKind Kind,
+                              uint64_t InstIdx, uint64_t BlockIdx) {
+  TyCheSite Site;
+  Site.Kind = Kind;
+  Site.Nodes.reserve(TyCheMDNumFields + 2);
+  for (unsigned i = 0; i < TyCheMDNumFields; i++)
+    Site.Nodes.push_back(getTyCheMDField(Metadata, TyCheMDField(i)));
+  Site.Nodes.push_back(InstIdx);
+  Site.Nodes.push_back(BlockIdx);
+  Site.Names.push_back(Allocator);
+  Site.Names.push_back(getTyCheMDTypeName(Metadata));
+  Site.Names.push_back(Inst->getFunction()->getName());
+  return Site;
+}
+
+/// TYCHE: Report the site of an allocator call as a "tyche" analysis remark,
+/// or, if \p Metadata is null, report that the call has no TYCHE_MD.
+static void emitTyCheRemark(OptimizationRemarkEmitter &ORE,
+                            const Instruction *Inst, const MDNode *Metadata,
+                            StringRef Allocator, uint64_t InstIdx,
+                            uint64_t BlockIdx) {
+  typedef DiagnosticInfoOptimizationBase::Argument Arg;
+  BasicBlock *BB = const_cast<BasicBlock *>(Inst->getParent());
+  if (Metadata == nullptr) {
+    OptimizationRemarkAnalysis R("tyche", "MissingSiteMetadata",
+                                 Inst->getDebugLoc(), BB);
+    ORE.emit(R << "call to " << Arg("Allocator", Allocator)
+               << " has no TYCHE_MD");
+    return;
+  }
+  uint64_t Line = getTyCheMDField(Metadata, TyCheMDLine);
+  uint64_t Col = getTyCheMDField(Metadata, TyCheMDCol);
+  uint64_t InlinedLine = getTyCheMDField(Metadata, TyCheMDInlinedLine);
+  uint64_t InlinedCol = getTyCheMDField(Metadata, TyCheMDInlinedCol);
+  OptimizationRemarkAnalysis R("tyche", "AllocatorCall", Inst->getDebugLoc(),
+                               BB);
+  ORE.emit(R << "call to " << Arg("Allocator", Allocator) << " allocates "
+             << Arg("Type", getTyCheMDTypeName(Metadata)) << " at "
+             << Arg("Line", Line) << ":" << Arg("Col", Col) << " inlined at "
+             << Arg("InlinedLine", InlinedLine) << ":"
+             << Arg("InlinedCol", InlinedCol) << " (site "
+             << Arg("SiteID", getTyCheMDField(Metadata, TyCheMDSiteID))
+             << ", type ID "
+             << Arg("TypeID", getTyCheMDField(Metadata, TyCheMDTypeID))
+             << ", block " << Arg("BlockID", BlockIdx) << ", instruction "
+             << Arg("InstID", InstIdx) << ")");
+}
+
 void SelectionDAGBuilder::LowerCallTo(ImmutableCallSite CS, SDValue Callee,
                                       bool isTailCall,
                                       const BasicBlock *EHPadBB) {
@@ -5896,186 +6008,33 @@ void SelectionDAGBuilder::LowerCallTo(ImmutableCallSite CS, SDValue Callee,
       .setConvergent(CS.isConvergent());
   std::pair<SDValue, SDValue> Result = lowerInvokable(CLI, EHPadBB);
 
-  std::error_code EC;
-  llvm::raw_fd_ostream file("tyche.debug", EC, llvm::sys::fs::F_Append);
-  //llvm::MDNode *TempMeta = CS.getInstruction()->getMetadata("TYCHE_MD");
-  const GlobalAddressSDNode *GADN = dyn_cast<GlobalAddressSDNode>(Callee.getNode());
-  if (GADN != nullptr)
-  {  
-      auto name = std::string(GADN->getGlobal()->getName());
-      if (name == "malloc" || 
-                    name == "_Znwm" || // new
-                    name == "_Znam" ||                   // new[]
-                    name == "_ZnwmRKSt9nothrow_t" || // new (nothrow)
-                    name == "_ZnamRKSt9nothrow_t" || 
-                    name == "calloc" ||
-                    name == "realloc" ||
-                    name == "free" || 
-                    name == "_ZdlPv" || // delete
-                    name == "_ZdaPv") // delete[] (nothrow)
-    {
-      CS.getInstruction()->print(file); 
-      file << "\n";
-      llvm::MDNode *Metadata = CS.getInstruction()->getMetadata("TYCHE_MD");
-      if (Metadata == nullptr)
-      {
-        file << "------------------------MODULE DUMP START!----------------------------------------\n";
-        CS.getInstruction()->getModule()->print(file, nullptr);
-        file << "------------------------MODULE DUMP END!----------------------------------------\n";
-      }
-      else 
-      {
-          file << "Calle Node: "; Callee.getNode()->print(file); file << "\n";
-          if (Result.first.getNode()) 
-          {
-            file << "First Node: "; Result.first.getNode()->print(file); file << "\n";
-          } 
-          if (Result.second.getNode())
-          {
-            file << "Second Node: "; Result.second.getNode()->print(file); file << "\n";
-          }
-          
-      }
+  // TYCHE: Allocator calls carry the TYCHE_MD of their allocation site.  The
+  // site goes into the site table of the function and is attached to the node
+  // defining the result, or to the chain for free and delete.
+  const Instruction *Inst = CS.getInstruction();
+  tyche::DBSiteKind Kind = tyche::DBSiteHeap;
+  StringRef Allocator = getTyCheAllocatorName(Callee, LibInfo, Kind);
+  if (!Allocator.empty()) {
+    const MDNode *Metadata = Inst->getMetadata(LLVMContext::MD_tyche);
+    SDNode *Node = Result.first.getNode() ? Result.first.getNode()
+                                          : Result.second.getNode();
+    if (Metadata != nullptr && Node != nullptr) {
+      uint64_t InstIdx = getTyCheInstIndex(Inst);
+      uint64_t BlockIdx = FuncInfo.MBB->getNumber();
+      Node->setTyCheSite(DAG.getMachineFunction().addTyCheSite(
+          getTyCheSite(Inst, Metadata, Allocator, Kind, InstIdx, BlockIdx)));
+      if (TyCheORE)
+        emitTyCheRemark(*TyCheORE, Inst, Metadata, Allocator, InstIdx,
+                        BlockIdx);
+    } else if (Metadata == nullptr && TyCheORE) {
+      emitTyCheRemark(*TyCheORE, Inst, nullptr, Allocator, 0, 0);
     }
-
   }
 
   if (Result.first.getNode()) {
-    const Instruction *Inst = CS.getInstruction();
-
-      // get Tyche Metadata and pass it to the SDNode for allocations sites
-      llvm::MDNode *Metadata = Inst->getMetadata("TYCHE_MD");
-      if (Metadata != nullptr) {
-          const GlobalAddressSDNode *GADN = dyn_cast<GlobalAddressSDNode>(Callee.getNode());
-          assert(GADN != nullptr);
-          
-          StringRef name =  GADN->getGlobal()->getName();
-          // assert (name == "malloc" || 
-          //           name == "_Znwm" || // new
-          //           name == "_Znam" ||                   // new[]
-          //           name == "_ZnwmRKSt9nothrow_t" || // new (nothrow)
-          //           name == "_ZnamRKSt9nothrow_t" || 
-          //           name == "calloc" ||
-          //           name == "realloc"  ); // delete[] (nothrow)
-
-          std::vector<uint64_t> nodes;
-          // the last two operands are string
-          for (size_t i = 0; i < Metadata->getNumOperands() - 3 ; i++)
-          {
-              llvm::Metadata *MD = Metadata->getOperand(i).get();
-              MDString *MDS = dyn_cast<MDString>(MD);
-              nodes.push_back(std::stoull(MDS->getString()));
-          }
-          nodes.push_back((uint64_t)Inst);
-          nodes.push_back((uint64_t)Inst->getParent());
-
-          std::vector<std::string> names;
-          // the last two operands are string
-          for (size_t i = Metadata->getNumOperands() - 3; i < Metadata->getNumOperands() ; i++)
-          {
-              llvm::Metadata *MD = Metadata->getOperand(i).get();
-              MDString *MDS = dyn_cast<MDString>(MD);
-              names.push_back(std::string(MDS->getString()));
-          }      
-
-          llvm::SDNode::NodeTypeID temp = llvm::SDNode::NodeTypeID(nodes, names, true);                        
-
-          Result.first.getNode()->setTypeID(temp);
-
-          Result.first.getNode()->print(file);
-          file << "\n";
-
-          const llvm::Function * caller =  Inst->getParent()->getParent();
-          const llvm::Module   * M = caller->getParent();
-          auto CallerName = (caller != nullptr) ? std::string(caller->getName()) : std::string("NULL");
-          file << "LowerCallTo::\nLLVM IR Location (Inlined): [" << M->getSourceFileName() << 
-                    "][Caller Name: " << CallerName  <<
-                    "][Allocator Name: " <<  std::string(name) << 
-                    "][Location: " << ((nodes.size() >= 5)? nodes[3] : 0) << "," << ((nodes.size() >= 5)? nodes[4] : 0) << 
-                    "][Inlined Location: " << Inst->getDebugLoc().getInlinedLocation().first << "," << Inst->getDebugLoc().getInlinedLocation().second << 
-                    "][BB ID: " << (uint64_t)Inst->getParent() << 
-                    "][Inst ID: " << (uint64_t)Inst << 
-                    "][Prev. Inst ID: " << ((nodes.size() >= 6)? nodes[5] : 0)  << 
-                    "]\n";
-
-          Inst->print(file); file << "\n";
-          
-
-      }
-
-
-
     Result.first = lowerRangeToAssertZExt(DAG, *Inst, Result.first);
     setValue(Inst, Result.first);
   }
-  else if (Result.second.getNode())
-  {
-
-    if (GADN != nullptr)
-    {  
-          auto name = std::string(GADN->getGlobal()->getName());
-          if (name == "free" || 
-              name == "_ZdlPv" || // delete
-              name == "_ZdaPv") // delete[] (nothrow)
-        {
-            llvm::MDNode *Metadata = CS.getInstruction()->getMetadata("TYCHE_MD");
-            if (Metadata != nullptr)
-            {
-                  const Instruction *Inst = CS.getInstruction();
-                  std::vector<uint64_t> nodes;
-                  // the last two operands are string
-                  for (size_t i = 0; i < Metadata->getNumOperands() - 3 ; i++)
-                  {
-                      llvm::Metadata *MD = Metadata->getOperand(i).get();
-                      MDString *MDS = dyn_cast<MDString>(MD);
-                      nodes.push_back(std::stoull(MDS->getString()));
-                  }
-                  nodes.push_back((uint64_t)Inst);
-                  nodes.push_back((uint64_t)Inst->getParent());
-
-                  std::vector<std::string> names;
-                  // the last two operands are string
-                  for (size_t i = Metadata->getNumOperands() - 3; i < Metadata->getNumOperands() ; i++)
-                  {
-                      llvm::Metadata *MD = Metadata->getOperand(i).get();
-                      MDString *MDS = dyn_cast<MDString>(MD);
-                      names.push_back(std::string(MDS->getString()));
-                  }      
-
-                  llvm::SDNode::NodeTypeID temp = llvm::SDNode::NodeTypeID(nodes, names, true);                        
-
-                  Result.second.getNode()->setTypeID(temp);
-
-                  const llvm::Function * caller =  Inst->getParent()->getParent();
-                  const llvm::Module   * M = caller->getParent();
-                  auto CallerName = (caller != nullptr) ? std::string(caller->getName()) : std::string("NULL");
-                  file << "LowerCallTo::\nLLVM IR Location (Inlined): [" << M->getSourceFileName() << 
-                            "][Caller Name: " << CallerName  <<
-                            "][Allocator Name: " <<  std::string(name) << 
-                            "][Location: " << ((nodes.size() >= 5)? nodes[3] : 0) << "," << ((nodes.size() >= 5)? nodes[4] : 0) << 
-                            "][Inlined Location: " << Inst->getDebugLoc().getInlinedLocation().first << "," << Inst->getDebugLoc().getInlinedLocation().second << 
-                            "][BB ID: " << (uint64_t)Inst->getParent() << 
-                            "][Inst ID: " << (uint64_t)Inst << 
-                            "][Prev. Inst ID: " << ((nodes.size() >= 6)? nodes[5] : 0)  << 
-                            "]\n";
-
-                  Inst->print(file); file << "\n";
-                  Result.second.getNode()->print(file); file << "\n";
-            } 
-            else 
-            {
-              file << "------------------------MODULE DUMP START!----------------------------------------\n";
-              CS.getInstruction()->getModule()->print(file, nullptr);
-              file << "------------------------MODULE DUMP END!----------------------------------------\n";
-            }
-        }
-    }
-
-  }
-
-
-
-  
 
   // The last element of CLI.InVals has the SDValue for swifterror return.
   // Here we copy it to a virtual register and update SwiftErrorMap for
@@ -18,6 +18,7 @@
 #include "llvm/ADT/APInt.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/OptimizationDiagnosticInfo.h"
 #include "llvm/CodeGen/SelectionDAG.h"
 #include "llvm/CodeGen/SelectionDAGNodes.h"
 #include "llvm/IR/CallSite.h"
@@ -571,6 +572,10 @@ public:
   AliasAnalysis *AA;
   const TargetLibraryInfo *LibInfo;
 
+  /// TYCHE: Emitter of the "tyche" remarks of the current function, or null
+  /// if -tyche-remarks is off.
+  std::unique_ptr<OptimizationRemarkEmitter> TyCheORE;
+
   /// SwitchCases - Vector of CaseBlock structures used to communicate
   /// SwitchInst code generation information.
   std::vector<CaseBlock> SwitchCases;
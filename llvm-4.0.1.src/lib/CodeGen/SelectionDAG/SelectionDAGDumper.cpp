@@ -703,7 +703,12 @@ void SDNode::print(raw_ostream &OS, const SelectionDAG *G) const {
     if (i) OS << "; "; else OS << " ";
     printOperand(OS, G, getOperand(i));
   }
-  // if (NodeTID.valid)
-  OS << " Node TypeID: [ " << NodeTID.isValid() << "#" << NodeTID.dump() << "]";
-
+  if (hasTyCheSite()) {
+    OS << " Node TypeID: [ 1#";
+    if (G)
+      OS << G->getMachineFunction().getTyCheSite(getTyCheSite()).dump();
+    else
+      OS << "site " << getTyCheSite();
+    OS << "]";
+  }
 }
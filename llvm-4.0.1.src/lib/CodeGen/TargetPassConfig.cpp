@@ -671,8 +671,6 @@ void TargetPassConfig::addMachinePasses() {
   addPass(&XRayInstrumentationID, false);
   addPass(&PatchableFunctionID, false);
 
-  addPass(&DumpTyCHEStackObjectsID, false);
-
   AddingMachinePasses = false;
 }
 
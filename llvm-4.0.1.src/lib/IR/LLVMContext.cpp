@@ -58,6 +58,8 @@ LLVMContext::LLVMContext() : pImpl(new LLVMContextImpl(*this)) {
     {MD_type, "type"},
     {MD_section_prefix, "section_prefix"},
     {MD_absolute_symbol, "absolute_symbol"},
+    {MD_effective_san, "effectiveSan"},
+    {MD_tyche, "TYCHE_MD"},
   };
 
   for (auto &MDKind : MDKinds) {
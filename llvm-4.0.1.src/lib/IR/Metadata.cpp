@@ -25,6 +25,7 @@
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/ValueHandle.h"
+#include "llvm/Support/CommandLine.h"
 
 using namespace llvm;
 
@@ -1161,12 +1162,7 @@ void Instruction::dropUnknownNonDebugMetadata(ArrayRef<unsigned> KnownIDs) {
 
   SmallSet<unsigned, 4> KnownSet;
   KnownSet.insert(KnownIDs.begin(), KnownIDs.end());
-  if (KnownSet.empty()) {
-    // Just drop our entry at the store.
-    InstructionMetadata.erase(this);
-    setHasMetadataHashEntry(false);
-    return;
-  }
+  KnownSet.insert(LLVMContext::MD_effective_san);     // EFFECTIVESAN
 
   auto &Info = InstructionMetadata[this];
   Info.remove_if([&KnownSet](const std::pair<unsigned, TrackingMDNodeRef> &I) {
@@ -1477,14 +1473,14 @@ DIType *llvm::getEffectiveSanType(const Value *Ptr) {
   if (auto *I = dyn_cast<Instruction>(Ptr)) {
     // For instructions, we use the special effectiveSan meta data
     // that is assumed to be inserted by the frontend:
-    MDNode *Metadata = I->getMetadata("effectiveSan");
+    MDNode *Metadata = I->getMetadata(LLVMContext::MD_effective_san);
     if (Metadata == nullptr)
       return nullptr;
     Ty = dyn_cast<DIType>(Metadata);
     return Ty;
   }
   else if (auto *GV = dyn_cast<GlobalVariable>(Ptr)) {
-    MDNode *Metadata = GV->getMetadata("effectiveSan");
+    MDNode *Metadata = GV->getMetadata(LLVMContext::MD_effective_san);
     if (Metadata == nullptr)
       return nullptr;
     Ty = dyn_cast<DIType>(Metadata);
@@ -1506,3 +1502,60 @@ DIType *llvm::getEffectiveSanType(const Value *Ptr) {
     return nullptr;
 }
 
+// TYCHE:
+static StringRef getTyCheOutputPrefix(const Module &M) {
+  NamedMDNode *Prefix = M.getNamedMetadata("tyche.output.prefix");
+  if (Prefix == nullptr || Prefix->getNumOperands() == 0)
+    return StringRef();
+  MDNode *Node = Prefix->getOperand(0);
+  if (Node->getNumOperands() == 0)
+    return StringRef();
+  if (auto *Str = dyn_cast_or_null<MDString>(Node->getOperand(0).get()))
+    return Str->getString();
+  return StringRef();
+}
+
+bool llvm::hasTyCheOutputPrefix(const Module &M) {
+  return !getTyCheOutputPrefix(M).empty();
+}
+
+std::string llvm::getTyCheSidecarPath(const Module &M, StringRef Name) {
+  StringRef Prefix = getTyCheOutputPrefix(M);
+  if (Prefix.empty())
+    return Name;
+  return (Prefix + "." + Name).str();
+}
+
+MDTuple *llvm::getTyCheMD(LLVMContext &C, ArrayRef<uint64_t> Fields,
+                          StringRef TypeName) {
+  assert(Fields.size() == TyCheMDNumFields && "wrong number of TyChe fields");
+  SmallVector<Metadata *, TyCheMDNumFields + 1> Ops;
+  Type *Int64Ty = Type::getInt64Ty(C);
+  for (uint64_t Field : Fields)
+    Ops.push_back(ConstantAsMetadata::get(ConstantInt::get(Int64Ty, Field)));
+  Ops.push_back(MDString::get(C, TypeName));
+  return MDTuple::get(C, Ops);
+}
+
+uint64_t llvm::getTyCheMDField(const MDNode *MD, TyCheMDField Field) {
+  if (MD == nullptr || MD->getNumOperands() != TyCheMDNumFields + 1)
+    return 0;
+  if (auto *CI = mdconst::dyn_extract<ConstantInt>(MD->getOperand(Field)))
+    return CI->getZExtValue();
+  return 0;
+}
+
+StringRef llvm::getTyCheMDTypeName(const MDNode *MD) {
+  if (MD == nullptr || MD->getNumOperands() != TyCheMDNumFields + 1)
+    return StringRef();
+  if (auto *Str = dyn_cast<MDString>(MD->getOperand(TyCheMDNumFields)))
+    return Str->getString();
+  return StringRef();
+}
+
+static cl::opt<bool>
+    TyCheRemarks("tyche-remarks", cl::Hidden, cl::init(false),
+                 cl::desc("Report TyChe allocation sites as analysis "
+                          "remarks of the \"tyche\" pass"));
+
+bool llvm::areTyCheRemarksEnabled() { return TyCheRemarks; }
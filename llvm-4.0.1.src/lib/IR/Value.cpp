@@ -374,6 +374,14 @@ void Value::doRAUW(Value *New, bool NoMetadata) {
   assert(New->getType() == getType() &&
          "replaceAllUses of value with new value of different type!");
 
+  // EFFECTIVESAN: New computes the same value, so it has the same declared
+  // type.  Carry the type annotation over unless New already has one.
+  if (auto *I = dyn_cast<Instruction>(this))
+    if (auto *NewI = dyn_cast<Instruction>(New))
+      if (MDNode *Ty = I->getMetadata(LLVMContext::MD_effective_san))
+        if (!NewI->getMetadata(LLVMContext::MD_effective_san))
+          NewI->setMetadata(LLVMContext::MD_effective_san, Ty);
+
   // Notify all ValueHandles (if present) that this value is going away.
   if (HasValueHandle)
     ValueHandleBase::ValueIsRAUWd(this, New);
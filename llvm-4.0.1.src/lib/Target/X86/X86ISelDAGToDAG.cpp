@@ -28,6 +28,7 @@
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/ErrorHandling.h"
@@ -36,7 +37,6 @@
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
 #include "llvm/Support/CommandLine.h"
-#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MD5.h"
 #include "llvm/Support/SpecialCaseList.h"
 #include "llvm/Support/ToolOutputFile.h"
@@ -1994,56 +1994,17 @@ bool X86DAGToDAGISel::tryGather(SDNode *Node, unsigned Opc) {
 }
 
 void X86DAGToDAGISel::Select(SDNode *Node) {
-
-  if (Node->getOpcode() == ISD::CopyFromReg && Node->getTypeID().isValid())
-  {
-
-
-    std::error_code EC;
-    llvm::raw_fd_ostream file("tyche.debug", EC, llvm::sys::fs::F_Append);
-    file << "X86DAGToDAGISel:: " << Node->getNumOperands() << "\n" ;
-    file << "Node: ";  Node->print(file); file << "\n";
-    for (int i = 0; i < Node->getNumOperands(); i++)
-    {
-        const SDValue n1 = Node->getOperand(i);
-        n1.getNode()->print(file);
-        file << "\n";
-    }
-    const SDValue n1 = Node->getOperand(0);
-    const SDValue n2 = n1.getNode()->getOperand(0);
-    n2.getNode()->print(file);
-    file << "\n";
-    auto temp  = Node->getTypeID();
-    n2.getNode()->setTypeID(temp);
-    n2.getNode()->print(file);
-    file << "\n";
-  }
-  else if (Node->getOpcode() == ISD::CALLSEQ_END && Node->getTypeID().isValid())
-  {
-      std::error_code EC;
-      llvm::raw_fd_ostream file("tyche.debug", EC, llvm::sys::fs::F_Append);
-      file << "X86DAGToDAGISel:: " << Node->getNumOperands() << "\n" ;
-      file << "Node: ";  Node->print(file); file << "\n";
-      for (int i = 0; i < Node->getNumOperands(); i++)
-      {
-        const SDValue n1 = Node->getOperand(i);
-        n1.getNode()->print(file);
-        file << "\n";
-      }
-      const SDValue n1 = Node->getOperand(0);
-      // const SDValue n2 = n1.getNode()->getOperand(0);
-      // n2.getNode()->print(file);
-      // file << "\n";
-      auto temp  = Node->getTypeID();
-      n1.getNode()->setTypeID(temp);
-      n1.getNode()->print(file);
-      file << "\n";
-
+  // TYCHE: Move the site of an allocator call from the node LowerCallTo
+  // attached it to (the copy of the result, or the end of the call sequence
+  // for free and delete) to the call itself, which InstrEmitter turns into
+  // the call instruction.
+  if (Node->getOpcode() == ISD::CopyFromReg && Node->hasTyCheSite()) {
+    SDNode *Call = Node->getOperand(0).getNode()->getOperand(0).getNode();
+    Call->setTyCheSite(Node->getTyCheSite());
+  } else if (Node->getOpcode() == ISD::CALLSEQ_END && Node->hasTyCheSite()) {
+    Node->getOperand(0).getNode()->setTyCheSite(Node->getTyCheSite());
   }
 
-
-
-
   MVT NVT = Node->getSimpleValueType(0);
   unsigned Opc, MOpc;
   unsigned Opcode = Node->getOpcode();
@@ -2806,14 +2767,6 @@ void X86DAGToDAGISel::Select(SDNode *Node) {
   }
 
   SelectCode(Node);
-
-  if (Node->getTypeID().isValid())
-  {
-    outs() << "End: X86DAGToDAGISel Phase! OpCode: " << Node->getOpcode() << " " << Node->getNodeId() << " ";
-    Node->print(outs());
-    outs() << "\n";
-
-  }
 }
 
 bool X86DAGToDAGISel::
@@ -39,19 +39,28 @@
 #include <ctime>
 #include <fstream>
 #include <stdlib.h> /* srand, rand */
+#include <sys/resource.h>
 #include <thread>
 
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <queue>
 #include <set>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <cxxabi.h>
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/ADT/Triple.h"
 #include "llvm/Analysis/MemoryBuiltins.h"
+#include "llvm/Analysis/OptimizationDiagnosticInfo.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DIBuilder.h"
@@ -72,14 +81,24 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Value.h"
+#include "llvm/IR/ValueHandle.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/MD5.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/SpecialCaseList.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Instrumentation/TyCheDB.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/Local.h"
 
@@ -106,6 +125,8 @@ extern "C" {
 #define EFFECTIVE_BSWAP64(x) __builtin_bswap64(x)
 #define EFFECTIVE_CLZLL(x) clzll(x)
 
+#define DEBUG_TYPE "effectivesan"
+
 #define TYPE_META_PREFIX "EFFECTIVE_TYPE_"
 #define TYPE_INFO_PREFIX "EFFECTIVE_INFO_"
 
@@ -160,6 +181,23 @@ static HashVal final(HashContext &Cxt) {
   return val;
 }
 
+/*
+ * Stable ID of a type meta-data object (in place of its address): the MD5 of
+ * the name of the EFFECTIVE_TYPE global it refers to, which is itself derived
+ * from the type hash.
+ */
+static uint64_t getTyCheMetaID(const llvm::Constant *Meta) {
+  if (Meta == nullptr)
+    return 0;
+  auto *GV = llvm::dyn_cast<llvm::GlobalValue>(Meta->stripPointerCasts());
+  if (GV == nullptr || !GV->hasName())
+    return 0;
+  llvm::StringRef name = GV->getName();
+  HashContext Cxt;
+  update(Cxt, name.data(), name.size());
+  return final(Cxt).i64[0];
+}
+
 
 
 /*
@@ -175,32 +213,22 @@ struct TyCheEntry
 };
 
 /*
-TyChe Metadata structure
-*/
-
-        // TID            // OFFSET          //SECTION
-std::map<uint64_t, std::map<uint64_t, std::map<uint64_t, std::vector<llvm::Constant *> > > > TyCheMetaCacheLinesSections;
-std::map<uint64_t, uint64_t> TypeIDNames;
-
-
-
-std::vector<std::vector<llvm::Constant*>> TyCheSectionsEntries(TYCHE_NUMBER_OF_SECTIONS);
-
-static uint64_t TypeId = 0;
-
-
-static uint64_t TYCHE_TYPE_ID = 0;
+ * TyChe metadata cache lines, by type ID, offset and section (see
+ * EffectiveContext).
+ */
+typedef std::map<uint64_t, std::map<uint64_t, std::map<uint64_t,
+            std::vector<llvm::Constant *> > > > TyCheMetaCacheLines;
 
-std::string APFileName = "allocation_points.hash";
-std::string StackAPFileName = "stack_allocation_points.hash";
+static const std::string APFileName = "allocation_points.hash";
+static const std::string StackAPFileName = "stack_allocation_points.hash";
 
 
 
-std::string ReallocMetaID = "APSIZE 1\nOFFSET 0\nCORECED N\nLB 18446744056529682432\nUB 17179869184\nFAM N\nNAME int8_t\nVPTR N\nMETATYPE NOMETA\nPARENTTYPE NOPARENT\n";
-std::string FreeMetaID =    "APSIZE 1\nOFFSET 0\nCORECED N\nLB 18446744056529682432\nUB 17179869184\nFAM N\nNAME int8_t\nVPTR N\nMETATYPE NOMETA\nPARENTTYPE NOPARENT\n";
+static const std::string ReallocMetaID = "APSIZE 1\nOFFSET 0\nCORECED N\nLB 18446744056529682432\nUB 17179869184\nFAM N\nNAME int8_t\nVPTR N\nMETATYPE NOMETA\nPARENTTYPE NOPARENT\n";
+static const std::string FreeMetaID =    "APSIZE 1\nOFFSET 0\nCORECED N\nLB 18446744056529682432\nUB 17179869184\nFAM N\nNAME int8_t\nVPTR N\nMETATYPE NOMETA\nPARENTTYPE NOPARENT\n";
 
-uint64_t    ReallocTID = UINT64_MAX;
-uint64_t    FreeTID = UINT64_MAX;
+static const uint64_t ReallocTID = UINT64_MAX;
+static const uint64_t FreeTID = UINT64_MAX;
 
 
 /*
@@ -213,10 +241,11 @@ struct TypeEntry {
   llvm::Constant *typeMeta; // Type meta-data value.
   uint64_t type_id;
 };
-typedef std::map<llvm::DIType *, TypeEntry> TypeCache;
-typedef std::map<llvm::DIType *, std::string> TypeNames;
+typedef std::unordered_map<llvm::DIType *, TypeEntry> TypeCache;
+typedef std::unordered_map<llvm::DIType *, std::string> TypeNames;
 typedef std::map<llvm::DIType *, llvm::Constant *> TypeInfos;
-typedef std::map<llvm::DIType *, HashVal> TypeHashes;
+typedef std::unordered_map<llvm::DIType *, HashVal> TypeHashes;
+typedef std::unordered_map<llvm::Constant *, llvm::DIType *> TypeMetas;
 
 typedef std::map<llvm::DIType *, TyCheEntry> TyCheDAG;
 typedef std::map<llvm::DIType *, llvm::Constant *> TyCheInfos; 
@@ -234,6 +263,31 @@ struct TypeInfo {
   TypeNames names;
   TypeInfos infos;
   TypeHashes hashes;
+  TypeMetas metas;          // Type meta-data -> owning type (reverse index).
+};
+
+/*
+ * TyChe dependency trees.  Each layout entry refers to the chain of
+ * (sub-)object types it was reached through, innermost first.  The chains
+ * are immutable and hash-consed in LayoutArena, so every entry below a given
+ * member shares the member's chain, and LayoutEntry copies (e.g., into
+ * AllocationPointsTypeInfo) copy a single pointer.
+ */
+struct TyCheDepNode {
+  llvm::DIType *type;
+  const TyCheDepNode *parent;
+};
+
+/*
+ * Storage for the dependency nodes and the interned layout entry names.
+ * Nothing is freed: the entries kept in AllocationPointsTypeInfo point
+ * into the arena.
+ */
+struct LayoutArena {
+  llvm::BumpPtrAllocator allocator;
+  llvm::DenseMap<std::pair<const TyCheDepNode *, llvm::DIType *>,
+                 const TyCheDepNode *> nodes;
+  llvm::StringSet<llvm::BumpPtrAllocator> names;
 };
 
 /*
@@ -241,6 +295,7 @@ struct TypeInfo {
  */
 struct LayoutEntry {
   size_t offset;
+  unsigned level;           // Enclosing periods (see LayoutPeriod).
   llvm::DIType *type;
   uint64_t hash;
   uint64_t finalHash;
@@ -250,21 +305,26 @@ struct LayoutEntry {
   bool deleted;
   bool coerced;
   TyCheEntry tyche_entry;
-  std::vector<llvm::DIType*> TyCheDependencyTree;
-  std::string humanName;
+  const TyCheDepNode *deps; // Enclosing (sub-)object types.
+  llvm::StringRef humanName;
 };
 typedef std::multimap<size_t, LayoutEntry> LayoutInfo;
 typedef std::map<size_t, LayoutEntry *> FlattenedLayoutInfo;
 
-std::map<uint64_t, std::multimap <uint32_t, LayoutEntry> > AllocationPointsTypeInfo;
-std::map<llvm::Constant*, std::multimap <uint32_t, LayoutEntry> > AllocationPointsDIInfo;
+/*
+ * A large inner array whose elements are all described by the entries of
+ * element 0 (see EFFECTIVE_PERIOD).  The layout keys of these entries carry
+ * their level above EFFECTIVE_PERIOD_SHIFT.
+ */
+struct LayoutPeriod {
+  size_t base;
+  size_t stride;
+  size_t count;
+};
+typedef std::vector<LayoutPeriod> LayoutPeriods;
 
-// static llvm::StructType *TyCheBaiscType = nullptr;
-// static llvm::StructType *TyCheDerivedType = nullptr;
-// static llvm::StructType *TyCheCompositeType = nullptr;
-// static llvm::StructType *TyCheSubroutineType = nullptr;
-static llvm::StructType *TyCheCacheLineEntryTy = nullptr;
-//static llvm::StructType *TyCheSectionEntryTy = nullptr;
+typedef std::map<uint64_t, std::multimap<uint32_t, LayoutEntry> >
+    AllocationPointsInfo;
 
 
 std::string CurrentDate() {
@@ -362,42 +422,908 @@ static llvm::cl::opt<std::string> option_blacklist(
 static llvm::cl::opt<bool>
     option_warnings("effective-warnings",
                     llvm::cl::desc("Enable warning messages"));
+static llvm::cl::opt<unsigned> option_threads(
+    "effective-threads",
+    llvm::cl::desc("Number of threads for the per-function analysis "
+                   "(0 = one per hardware thread)"),
+    llvm::cl::init(1));
+enum LayoutFormat {
+  LAYOUT_PROBE = EFFECTIVE_LAYOUT_PROBE,
+  LAYOUT_PERFECT = EFFECTIVE_LAYOUT_PERFECT,
+  LAYOUT_GROUPED = EFFECTIVE_LAYOUT_GROUPED
+};
+static llvm::cl::opt<LayoutFormat> option_layout_format(
+    "effective-layout",
+    llvm::cl::desc("Format of the type layout hash tables"),
+    llvm::cl::values(
+        clEnumValN(LAYOUT_PROBE, "probe", "Linear probing (default)"),
+        clEnumValN(LAYOUT_PERFECT, "perfect",
+                   "Perfect hashing: one probe per lookup"),
+        clEnumValN(LAYOUT_GROUPED, "grouped",
+                   "Groups of 16 slots probed with SIMD tag compares")),
+    llvm::cl::init(LAYOUT_PROBE));
+static llvm::cl::opt<unsigned> option_periodic_min(
+    "effective-periodic-min",
+    llvm::cl::desc("Minimum number of elements of an inner array for it to "
+                   "be described by periodic layout entries (0 = never)"),
+    llvm::cl::init(256));
 static llvm::cl::opt<unsigned> option_max_sub_objs(
     "effective-max-sub-objs",
     llvm::cl::desc("Maximum number of allowable sub-objects per type"),
     llvm::cl::init(10000));
 static llvm::cl::opt<bool> option_debug("effective-debug",
                                         llvm::cl::desc("Enable debug output"),llvm::cl::init(true));
+static llvm::cl::opt<bool> option_tyche_text(
+    "effective-tyche-text",
+    llvm::cl::desc("Also emit the textual TyChe allocation point files"));
+static llvm::cl::opt<std::string> option_tyche_db(
+    "effective-tyche-db",
+    llvm::cl::desc("TyChe allocation point database file "
+                   "(default: <module>.tychedb)"),
+    llvm::cl::init(""));
+static llvm::cl::opt<std::string> option_output_prefix(
+    "effective-output-prefix",
+    llvm::cl::desc("Write the TyChe side files of this module to "
+                   "<prefix>.<file> instead of appending to shared files in "
+                   "the working directory (set by the driver to the object "
+                   "file name)"),
+    llvm::cl::init(""));
+static llvm::cl::opt<bool> option_canonical_type_ids(
+    "effective-canonical-type-ids",
+    llvm::cl::desc("Derive TyChe type IDs from the type hash, so that a type "
+                   "has the same ID in every module (set by the driver under "
+                   "LTO)"));
+static llvm::cl::opt<std::string> option_stats_json(
+    "effective-stats-json",
+    llvm::cl::desc("Write per-phase compile times and counters of this module "
+                   "as JSON to the given file (default: "
+                   "<prefix>.effective-stats.json)"),
+    llvm::cl::ValueOptional);
+static llvm::cl::opt<std::string> option_layout_cache(
+    "effective-layout-cache",
+    llvm::cl::desc("Directory of the persistent layout cache (disabled if "
+                   "empty)"),
+    llvm::cl::init(""));
+static llvm::cl::opt<bool> option_verify_metadata(
+    "effective-verify-metadata",
+    llvm::cl::desc("Report type annotations dropped by the optimizer between "
+                   "the frontend and the EffectiveSan pass"));
+static llvm::cl::opt<unsigned> option_layout_cache_size(
+    "effective-layout-cache-size",
+    llvm::cl::desc("Maximum size of the layout cache in KiB; the least "
+                   "recently used entries are evicted first (0 = unlimited)"),
+    llvm::cl::init(65536));
 
 /*
- * Pre-defined types and objects.
+ * Compile-time instrumentation.  The phases of the pass are timed under
+ * -time-passes (in the "EffectiveSan" group) and for -effective-stats-json.
+ * Phases nest (compileType() recurses, and the rewriting phases compile
+ * types), so only the outermost region of each phase is timed and the times
+ * are inclusive.
  */
-static llvm::Type *BoundsTy = nullptr;
-static llvm::StructType *EntryTy = nullptr;
-static llvm::StructType *TypeTy = nullptr;
-static llvm::StructType *InfoTy = nullptr;
-static llvm::StructType *InfoEntryTy = nullptr;
-static llvm::StructType *ObjMetaTy = nullptr;
-static llvm::Constant *EmptyEntry = nullptr;
-static llvm::Constant *Int8TyMeta = nullptr;
-static llvm::Constant *BoundsNonFat = nullptr;
-static llvm::DIType *Int8Ty = nullptr;
-static llvm::DIType *Int16Ty = nullptr;
-static llvm::DIType *Int32Ty = nullptr;
-static llvm::DIType *Int64Ty = nullptr;
-static llvm::DIType *Int128Ty = nullptr;
-static llvm::DIType *Int8PtrTy = nullptr;
+enum EffectivePhase {
+  PHASE_ANALYZE_FUNCTIONS,
+  PHASE_COMPILE_TYPE,
+  PHASE_COMPILE_LAYOUT,
+  PHASE_REPLACE_MALLOCS,
+  PHASE_REPLACE_ALLOCAS,
+  PHASE_FUNCTION_INFO,
+  PHASE_MAX
+};
+
+static const char *const PhaseNames[PHASE_MAX][2] = {
+    {"analyze-functions", "Per-function analysis (analyzeFunctions)"},
+    {"compile-type", "Type compilation (compileType)"},
+    {"compile-layout", "Layout compilation (buildLayout/compileLayout)"},
+    {"replace-mallocs", "Heap allocation sites (replaceMallocs)"},
+    {"replace-allocas", "Stack allocation sites (replaceAllocas)"},
+    {"function-info", "Argument and return types (emitTyCHEFunctionInfo)"}};
+
+struct PhaseTimers {
+  llvm::TimerGroup group{"effectivesan", "EffectiveSan"};
+  llvm::Timer timers[PHASE_MAX];
+  unsigned depth[PHASE_MAX] = {0};
+  bool enabled = false;
+};
 
-static llvm::Module *Module = nullptr; // Used by normalizePointerType()
-                                       // (not ideal but too messy to fix).
+/*
+ * Counters.  The STATISTICs are reported by -stats (in builds with
+ * statistics enabled); the same values are always kept for
+ * -effective-stats-json.
+ */
+STATISTIC(NumTypesCompiled, "Number of types compiled");
+STATISTIC(NumLayoutRetries, "Number of layout hash table retries");
+STATISTIC(NumLayoutEntries, "Number of layout entries");
+STATISTIC(NumAllocationSites, "Number of allocation sites");
+STATISTIC(NumSidecarBytes, "Number of bytes written to sidecar files");
+STATISTIC(NumLayoutCacheHits, "Number of layout cache hits");
+STATISTIC(NumLayoutCacheMisses, "Number of layout cache misses");
+STATISTIC(NumLayoutPeriods, "Number of periodic inner arrays");
+STATISTIC(NumTyCheDepNodes, "Number of TyChe dependency tree nodes");
+STATISTIC(NumDroppedAnnotations, "Number of type annotations dropped");
+
+enum EffectiveCounter {
+  COUNTER_TYPES_COMPILED,
+  COUNTER_LAYOUT_RETRIES,
+  COUNTER_LAYOUT_ENTRIES,
+  COUNTER_ALLOCATION_SITES,
+  COUNTER_SIDECAR_BYTES,
+  COUNTER_LAYOUT_CACHE_HITS,
+  COUNTER_LAYOUT_CACHE_MISSES,
+  COUNTER_LAYOUT_PERIODS,
+  COUNTER_TYCHE_DEP_NODES,
+  COUNTER_DROPPED_ANNOTATIONS,
+  COUNTER_MAX
+};
 
-static std::unique_ptr<llvm::SpecialCaseList> Blacklist = nullptr;
+static const char *const CounterNames[COUNTER_MAX] = {
+    "types-compiled", "layout-retries", "layout-entries", "allocation-sites",
+    "sidecar-bytes", "layout-cache-hits", "layout-cache-misses",
+    "layout-periods", "tyche-dep-nodes", "dropped-annotations"};
+static llvm::Statistic *const CounterStats[COUNTER_MAX] = {
+    &NumTypesCompiled, &NumLayoutRetries, &NumLayoutEntries,
+    &NumAllocationSites, &NumSidecarBytes, &NumLayoutCacheHits,
+    &NumLayoutCacheMisses, &NumLayoutPeriods, &NumTyCheDepNodes,
+    &NumDroppedAnnotations};
 
-static std::map<size_t, llvm::StructType *> metaCache;
-static std::map<size_t, llvm::StructType *> infoCache;
+/*
+ * TyChe sidecar files.  Each sidecar is opened once per module and records
+ * are buffered in memory.  With -effective-output-prefix every translation
+ * unit gets its own set of files named after its output (and they are
+ * truncated, not appended to), so parallel builds never share a file; the
+ * per-TU databases are combined with "llvm-tyche merge".  Without a prefix
+ * the legacy shared files in the working directory are appended to.  A buffer is written out in a single append once
+ * it grows past TYCHE_SIDECAR_FLUSH_SIZE (only ever between two records, so
+ * concurrent compilers appending to the same file never tear a record), and
+ * whatever remains is written at the end of the pass.
+ */
+#define TYCHE_SIDECAR_FLUSH_SIZE  (1 << 20)
+
+enum SidecarKind {
+  SIDECAR_HEAP_AP,      // allocation_points.hash
+  SIDECAR_STACK_AP,     // stack_allocation_points.hash
+  SIDECAR_MAX
+};
+
+struct Sidecar {
+  std::string path;
+  std::unique_ptr<llvm::raw_fd_ostream> file;
+  std::string buf;
+  std::unique_ptr<llvm::raw_string_ostream> stream;
+  uint64_t records;     // Number of records emitted.
+  uint64_t bytes;       // Number of bytes written to the file.
+  uint64_t writes;      // Number of appends to the file.
+  bool enabled;
+};
+
+/*
+ * Per-module state of the pass.  Every runOnModule() call instruments its
+ * module with a fresh context, and Ctx points to the context of the module
+ * that the current thread is instrumenting.  Independent modules can thus be
+ * instrumented at the same time in one process (ThinLTO backend threads,
+ * several inputs per compiler invocation, build servers).  Only the command
+ * line options, the STATISTICs and the layout cache directory are shared.
+ */
+struct EffectiveContext {
+  llvm::Module *Module = nullptr;   // Used by normalizePointerType()
+                                    // (not ideal but too messy to fix).
+
+  // Pre-defined types and objects.
+  llvm::Type *BoundsTy = nullptr;
+  llvm::StructType *EntryTy = nullptr;
+  llvm::StructType *ColdEntryTy = nullptr;
+  llvm::StructType *PeriodTy = nullptr;
+  llvm::StructType *TypeTy = nullptr;
+  llvm::StructType *InfoTy = nullptr;
+  llvm::StructType *InfoEntryTy = nullptr;
+  llvm::StructType *ObjMetaTy = nullptr;
+  llvm::StructType *TyCheCacheLineEntryTy = nullptr;
+  llvm::StructType *TyCheSparseMetaTy = nullptr;
+  llvm::Constant *EmptyEntry = nullptr;
+  llvm::Constant *EmptyColdEntry = nullptr;
+  llvm::Constant *Int8TyMeta = nullptr;
+  llvm::Constant *BoundsNonFat = nullptr;
+  llvm::DIType *Int8Ty = nullptr;
+  llvm::DIType *Int16Ty = nullptr;
+  llvm::DIType *Int32Ty = nullptr;
+  llvm::DIType *Int64Ty = nullptr;
+  llvm::DIType *Int128Ty = nullptr;
+  llvm::DIType *Int8PtrTy = nullptr;
+
+  std::unique_ptr<llvm::SpecialCaseList> Blacklist;
+
+  std::map<std::pair<size_t, llvm::Type *>, llvm::StructType *> metaCache;
+  std::map<size_t, llvm::StructType *> infoCache;
+
+  // TyChe IDs (see getTyCheID() and nextTyCheTypeID()).
+  const llvm::Function *TyCheIDFunction = nullptr;
+  llvm::DenseMap<const llvm::Value *, uint64_t> TyCheIDOrdinals;
+  uint64_t TyCheIDNextOrdinal = 0;
+  uint64_t TyCheTypeIDBase = 0;
+  uint64_t TypeId = 0;
+  uint64_t TYCHE_TYPE_ID = 0;
+  std::unordered_map<uint64_t, std::pair<uint64_t, uint64_t>>
+      TyCheCanonicalIDs;
+
+  // Compiled TyChe layouts.
+  LayoutArena Arena;
+  TyCheMetaCacheLines TyCheMetaCacheLinesSections;
+  std::map<uint64_t, uint64_t> TypeIDNames;
+  AllocationPointsInfo AllocationPointsTypeInfo;
+  std::map<llvm::Constant *, uint64_t> AllocationPointsDIInfo;
+  std::unordered_map<size_t, std::string> TypeIDCache;
+
+  // Outputs.
+  Sidecar Sidecars[SIDECAR_MAX];
+  std::vector<std::string> TypeStrings;
+  std::map<llvm::DIType *, size_t> TypeStringIndex;
+  llvm::tyche::DBWriter APDatabase; // Primary output, see TyCheDB.h.
+  bool LayoutCacheDirty = false;
+  // "tyche" remarks of the function being rewritten (see -tyche-remarks), or
+  // null.  Building an emitter may compute BFI, so there is one per function.
+  std::unique_ptr<llvm::OptimizationRemarkEmitter> ORE;
+
+  // Instrumentation.
+  PhaseTimers Phases;
+  uint64_t Counters[COUNTER_MAX] = {0};
+};
+
+static LLVM_THREAD_LOCAL EffectiveContext *Ctx = nullptr;
+
+/*
+ * Time the enclosing scope as part of phase P.
+ */
+class PhaseRegion {
+  EffectivePhase P;
+public:
+  explicit PhaseRegion(EffectivePhase P) : P(P) {
+    if (Ctx->Phases.enabled && Ctx->Phases.depth[P]++ == 0)
+      Ctx->Phases.timers[P].startTimer();
+  }
+  ~PhaseRegion() {
+    if (Ctx->Phases.enabled && --Ctx->Phases.depth[P] == 0)
+      Ctx->Phases.timers[P].stopTimer();
+  }
+};
+
+static void initPhaseTimers(void) {
+  Ctx->Phases.enabled = (llvm::TimePassesIsEnabled ||
+                     option_stats_json.getNumOccurrences() > 0);
+  if (!Ctx->Phases.enabled)
+    return;
+  for (unsigned i = 0; i < PHASE_MAX; i++)
+    if (!Ctx->Phases.timers[i].isInitialized())
+      Ctx->Phases.timers[i].init(PhaseNames[i][0], PhaseNames[i][1],
+                             Ctx->Phases.group);
+}
+
+/*
+ * Add n to counter C.
+ */
+static void count(EffectiveCounter C, uint64_t n = 1) {
+  *CounterStats[C] += n;
+  Ctx->Counters[C] += n;
+}
+
+/*
+ * Stable TyChe IDs.  Allocation-site, basic-block and argument IDs are the
+ * MD5 of (source file, function, kind, ordinal of the value within its
+ * function).  They are thus identical across compiles of the same source
+ * (so objects are reproducible and cacheable) and, unlike the host pointers
+ * that were used before, unique across translation units.
+ *
+ * Ordinals are assigned per function in program order the first time the
+ * function is queried.  Values created later by the instrumentation get
+ * fresh ordinals past the existing ones, so IDs never change once handed
+ * out.
+ */
+enum TyCheIDKind : char {
+  TYCHE_ID_ARGUMENT = 'A',
+  TYCHE_ID_BLOCK = 'B',
+  TYCHE_ID_INSTRUCTION = 'I',
+};
+
+static void numberTyCheIDs(const llvm::Function &F) {
+  if (Ctx->TyCheIDFunction != &F) {
+    Ctx->TyCheIDFunction = &F;
+    Ctx->TyCheIDOrdinals.clear();
+    Ctx->TyCheIDNextOrdinal = 0;
+  }
+  for (const llvm::Argument &A : F.getArgumentList())
+    Ctx->TyCheIDOrdinals.insert({&A, A.getArgNo()});
+  for (const llvm::BasicBlock &BB : F) {
+    if (Ctx->TyCheIDOrdinals.insert({&BB, Ctx->TyCheIDNextOrdinal}).second)
+      Ctx->TyCheIDNextOrdinal++;
+    for (const llvm::Instruction &I : BB)
+      if (Ctx->TyCheIDOrdinals.insert({&I, Ctx->TyCheIDNextOrdinal}).second)
+        Ctx->TyCheIDNextOrdinal++;
+  }
+}
+
+static uint64_t getTyCheID(const llvm::Function &F, const llvm::Value *V,
+                           TyCheIDKind kind) {
+  auto i = Ctx->TyCheIDOrdinals.end();
+  if (Ctx->TyCheIDFunction == &F)
+    i = Ctx->TyCheIDOrdinals.find(V);
+  if (i == Ctx->TyCheIDOrdinals.end()) {
+    numberTyCheIDs(F);
+    i = Ctx->TyCheIDOrdinals.find(V);
+  }
+  uint64_t ordinal = i->second;
+
+  const llvm::Module *M = F.getParent();
+  const std::string &file = M->getSourceFileName();
+  llvm::StringRef func = F.getName();
+  HashContext Cxt;
+  update(Cxt, file.c_str(), file.size() + 1);
+  update(Cxt, func.data(), func.size());
+  update(Cxt, "", 1);
+  update(Cxt, (const char *)&kind, sizeof(kind));
+  update(Cxt, (const char *)&ordinal, sizeof(ordinal));
+  return final(Cxt).i64[0];
+}
+
+static uint64_t getTyCheSiteID(const llvm::Instruction &I) {
+  return getTyCheID(*I.getFunction(), &I, TYCHE_ID_INSTRUCTION);
+}
+
+static uint64_t getTyCheBlockID(const llvm::BasicBlock &BB) {
+  return getTyCheID(*BB.getParent(), &BB, TYCHE_ID_BLOCK);
+}
+
+static uint64_t getTyCheArgumentID(const llvm::Argument &A) {
+  return getTyCheID(*A.getParent(), &A, TYCHE_ID_ARGUMENT);
+}
+
+
+/*
+ * Write out the buffered contents of a sidecar.
+ */
+static void flushSidecar(Sidecar &S) {
+  S.stream->flush();
+  if (S.buf.empty())
+    return;
+  S.file->write(S.buf.data(), S.buf.size());
+  S.file->flush();
+  S.bytes += S.buf.size();
+  count(COUNTER_SIDECAR_BYTES, S.buf.size());
+  S.writes++;
+  S.buf.clear();
+}
+
+/*
+ * TyChe type IDs.  TypeId numbers the compiled layouts (and names their
+ * TYCHE_META_SECTION_TID_* globals), TYCHE_TYPE_ID numbers the type entries
+ * referred to by the allocation sites.  Both count up from the module's
+ * TyCheTypeIDBase (see effective.h), so IDs from different translation
+ * units never collide and there is no fixed bound on the number of types;
+ * "llvm-tyche merge" renumbers them densely and records the mapping.
+ * Under LTO both are canonical instead (see getCanonicalTyCheTypeID).
+ */
+static uint64_t nextTyCheTypeID(uint64_t &counter) {
+  if (counter - Ctx->TyCheTypeIDBase >= (1ull << TYCHE_TYPE_ID_LOCAL_BITS) - 1)
+    EFFECTIVE_FATAL_ERROR("too many TyChe types in module (max " +
+                          std::to_string((1ull << TYCHE_TYPE_ID_LOCAL_BITS) - 1) +
+                          ")");
+  return counter++;
+}
+
+/*
+ * Set the module's TyChe type ID range.  The module part of the IDs is
+ * derived from the source file name and the output prefix, so it is stable
+ * across compiles.
+ */
+static void initTyCheTypeIDs(llvm::Module &M) {
+  HashContext Cxt;
+  const std::string &file = M.getSourceFileName();
+  update(Cxt, file.c_str(), file.size() + 1);
+  update(Cxt, option_output_prefix.c_str(), option_output_prefix.size());
+  uint64_t module = final(Cxt).i64[0] &
+                    ((1ull << TYCHE_TYPE_ID_MODULE_BITS) - 1);
+  Ctx->TyCheTypeIDBase = module << TYCHE_TYPE_ID_LOCAL_BITS;
+  Ctx->TypeId = Ctx->TyCheTypeIDBase;
+  Ctx->TYCHE_TYPE_ID = Ctx->TyCheTypeIDBase;
+}
+
+/*
+ * Under (Thin)LTO the modules are linked into one program, so the driver
+ * passes -effective-canonical-type-ids: a type's IDs are then derived from
+ * its type hash (buildTypeHash) instead of the counters above.  Every module
+ * agrees on them without a whole-program step, and the TyChe globals of a
+ * type get the same name in every module, so the (LTO) linker keeps one
+ * copy.  Canonical IDs have the top bit set, module-ranged IDs never do.
+ */
+static uint64_t getCanonicalTyCheTypeID(const HashVal &hash) {
+  uint64_t id = (hash.i64[0] ^ (hash.i64[1] * 0x9E3779B97F4A7C15ull)) |
+                (1ull << 63);
+  if (id == UINT64_MAX)
+    id--;                       // Reserved for "no type".
+  auto key = std::make_pair(hash.i64[0], hash.i64[1]);
+  auto i = Ctx->TyCheCanonicalIDs.insert(std::make_pair(id, key));
+  if (i.first->second != key)
+    EFFECTIVE_FATAL_ERROR("TyChe canonical type ID collision (" +
+                          std::to_string(id) + ")");
+  return id;
+}
+
+/*
+ * Suffix for the names of the TyChe globals of a type.  Module-ranged IDs
+ * are only unique per module, canonical ones are shared on purpose.
+ */
+static std::string getTyCheGlobalSuffix(llvm::Module &M) {
+  if (option_canonical_type_ids)
+    return "";
+  return "_FILE_" + M.getSourceFileName();
+}
+
+/*
+ * Open all sidecar files for the current module.  The output prefix is also
+ * recorded as module metadata, from which every TyChe side file of the
+ * module takes its name (see llvm::getTyCheSidecarPath()).
+ */
+static void openSidecars(llvm::Module &M) {
+  if (!option_output_prefix.empty()) {
+    llvm::LLVMContext &Cxt = M.getContext();
+    llvm::NamedMDNode *Prefix =
+        M.getOrInsertNamedMetadata("tyche.output.prefix");
+    Prefix->clearOperands();
+    Prefix->addOperand(llvm::MDNode::get(Cxt,
+        llvm::MDString::get(Cxt, option_output_prefix)));
+  }
+  bool perTU = llvm::hasTyCheOutputPrefix(M);
+  const std::string paths[SIDECAR_MAX] = {
+      llvm::getTyCheSidecarPath(M, APFileName),
+      llvm::getTyCheSidecarPath(M, StackAPFileName)};
+  for (unsigned i = 0; i < SIDECAR_MAX; i++) {
+    Sidecar &S = Ctx->Sidecars[i];
+    S.path = paths[i];
+    S.records = S.bytes = S.writes = 0;
+    S.enabled = option_tyche_text;
+    if (!S.enabled)
+      continue;
+    std::error_code EC;
+    S.file.reset(new llvm::raw_fd_ostream(S.path, EC,
+        (perTU ? llvm::sys::fs::F_None : llvm::sys::fs::F_Append)));
+    if (EC)
+      EFFECTIVE_FATAL_ERROR("failed to open \"" + S.path +
+                            "\": " + EC.message());
+    S.file->SetUnbuffered();
+    S.buf.clear();
+    S.buf.reserve(TYCHE_SIDECAR_FLUSH_SIZE);
+    S.stream.reset(new llvm::raw_string_ostream(S.buf));
+  }
+}
+
+/*
+ * Start a new record in the given sidecar.  The record must be complete
+ * before the next call for the same sidecar.  Records for sidecars that are
+ * not enabled are discarded.
+ */
+static llvm::raw_ostream &sidecarRecord(SidecarKind K) {
+  Sidecar &S = Ctx->Sidecars[K];
+  if (S.file == nullptr)
+    return llvm::nulls();
+  if (S.stream->tell() >= TYCHE_SIDECAR_FLUSH_SIZE)
+    flushSidecar(S);
+  S.records++;
+  return *S.stream;
+}
+
+/*
+ * Flush and close all sidecar files.
+ */
+static void closeSidecars(void) {
+  for (unsigned i = 0; i < SIDECAR_MAX; i++) {
+    Sidecar &S = Ctx->Sidecars[i];
+    if (S.file == nullptr)
+      continue;
+    flushSidecar(S);
+    S.stream.reset();
+    S.file->close();
+    if (S.file->has_error())
+      EFFECTIVE_FATAL_ERROR("failed to write \"" + S.path + "\"");
+    S.file.reset();
+  }
+}
+
+/*
+ * Module type string table.  Each distinct DIType is printed once and the
+ * allocation-point records refer to it as "METATYPE <index>" and
+ * "PARENTTYPE <index>".
+ */
+static size_t internTypeString(llvm::DIType *Ty) {
+  auto i = Ctx->TypeStringIndex.find(Ty);
+  if (i != Ctx->TypeStringIndex.end())
+    return i->second;
+  std::string str;
+  llvm::raw_string_ostream OS(str);
+  Ty->print(OS);
+  OS.flush();
+  size_t idx = Ctx->TypeStrings.size();
+  Ctx->TypeStrings.push_back(std::move(str));
+  Ctx->TypeStringIndex.insert(std::make_pair(Ty, idx));
+  return idx;
+}
+
+/*
+ * Append the type string table to every allocation-point sidecar that
+ * received records.  The table is keyed by FILENAME (like the records) since
+ * several modules may append to the same sidecar.
+ */
+static void emitTypeStrings(llvm::Module &M) {
+  const SidecarKind kinds[] = {SIDECAR_HEAP_AP, SIDECAR_STACK_AP};
+  for (SidecarKind K : kinds) {
+    if (Ctx->Sidecars[K].records == 0)
+      continue;
+    llvm::raw_ostream &OS = sidecarRecord(K);
+    OS << "TYPESTRS " << M.getSourceFileName() << ' ' << Ctx->TypeStrings.size()
+       << '\n';
+    for (size_t i = 0; i < Ctx->TypeStrings.size(); i++)
+      OS << "TYPESTR " << i << ' ' << Ctx->TypeStrings[i] << '\n';
+  }
+  Ctx->TypeStrings.clear();
+  Ctx->TypeStringIndex.clear();
+}
+
+/*
+ * Report the sidecar I/O volume for the current module.
+ */
+static void printSidecarStats(llvm::raw_ostream &OS, llvm::Module &M) {
+  for (unsigned i = 0; i < SIDECAR_MAX; i++) {
+    const Sidecar &S = Ctx->Sidecars[i];
+    if (!S.enabled)
+      continue;
+    OS << "EffectiveSan: " << M.getSourceFileName() << ": " << S.path
+       << ": " << S.records << " records, " << S.bytes << " bytes, "
+       << S.writes << " writes\n";
+  }
+}
+
+static uint32_t clampToU32(uint64_t x) {
+  return (x > UINT32_MAX ? UINT32_MAX : (uint32_t)x);
+}
+
+static void addTyCheDBSite(llvm::Module &M, llvm::tyche::DBSiteKind kind,
+                           llvm::StringRef allocator, llvm::StringRef caller,
+                           llvm::StringRef typeName, const HashVal *hash,
+                           uint64_t tid, uint64_t line, uint64_t col,
+                           uint64_t inlinedLine, uint64_t inlinedCol,
+                           uint64_t blockID, uint64_t siteID) {
+  llvm::tyche::DBSite site;
+  memset(&site, 0, sizeof(site));
+  site.ID = siteID;
+  site.BlockID = blockID;
+  site.TypeID = tid;
+  if (hash != nullptr) {
+    site.Hash[0] = hash->i64[0];
+    site.Hash[1] = hash->i64[1];
+  }
+  site.Kind = kind;
+  site.File = Ctx->APDatabase.addString(M.getSourceFileName());
+  site.Allocator = Ctx->APDatabase.addString(allocator);
+  site.Caller = Ctx->APDatabase.addString(caller);
+  site.TypeName = Ctx->APDatabase.addString(typeName);
+  site.Line = clampToU32(line);
+  site.Col = clampToU32(col);
+  site.InlinedLine = clampToU32(inlinedLine);
+  site.InlinedCol = clampToU32(inlinedCol);
+  Ctx->APDatabase.addSite(site);
+  count(COUNTER_ALLOCATION_SITES);
+}
+
+/*
+ * Attach the TYCHE_MD of an allocation site to its instruction.  The code
+ * generator reads it back when it lowers the allocator call (or the frame
+ * object, or the return) into the TyChe site table.
+ */
+static void setTyCheMD(llvm::Instruction &I, llvm::StringRef typeName,
+                       const HashVal *hash, uint64_t metaID, uint64_t tid,
+                       uint64_t line, uint64_t col) {
+  uint64_t fields[llvm::TyCheMDNumFields];
+  fields[llvm::TyCheMDLine] = line;
+  fields[llvm::TyCheMDCol] = col;
+  fields[llvm::TyCheMDMetaID] = metaID;
+  fields[llvm::TyCheMDHash0] = (hash != nullptr ? hash->i64[0] : 0);
+  fields[llvm::TyCheMDHash1] = (hash != nullptr ? hash->i64[1] : 0);
+  fields[llvm::TyCheMDInlinedLine] = I.getDebugLoc().getInlinedLocation().first;
+  fields[llvm::TyCheMDInlinedCol] = I.getDebugLoc().getInlinedLocation().second;
+  fields[llvm::TyCheMDBlockID] = getTyCheBlockID(*I.getParent());
+  fields[llvm::TyCheMDSiteID] = getTyCheSiteID(I);
+  fields[llvm::TyCheMDTypeID] = tid;
+  I.setMetadata(llvm::LLVMContext::MD_tyche,
+                llvm::getTyCheMD(I.getContext(), fields, typeName));
+}
+
+/*
+ * Report an allocation site as an analysis remark of the "tyche" pass (see
+ * -tyche-remarks) through the emitter of F.  I is the site, or null for an
+ * argument of F.
+ */
+static void emitTyCheRemark(llvm::Function &F, llvm::Instruction *I,
+                            llvm::StringRef allocator, llvm::StringRef typeName,
+                            uint64_t tid, uint64_t line, uint64_t col,
+                            uint64_t siteID) {
+  assert(Ctx->ORE != nullptr);
+  typedef llvm::DiagnosticInfoOptimizationBase::Argument Arg;
+  llvm::DebugLoc DL = (I != nullptr ? I->getDebugLoc() : llvm::DebugLoc());
+  llvm::BasicBlock *BB = (I != nullptr ? I->getParent() : &F.getEntryBlock());
+  llvm::OptimizationRemarkAnalysis R("tyche", "AllocationSite", DL, BB);
+  R << Arg("Allocator", allocator) << " site " << Arg("SiteID", siteID)
+    << " allocates " << Arg("Type", typeName) << " (type ID "
+    << Arg("TypeID", tid) << ") at " << Arg("Line", line) << ":"
+    << Arg("Col", col);
+  Ctx->ORE->emit(R);
+}
+
+static void writeTyCheDB(llvm::Module &M) {
+  std::string path(option_tyche_db);
+  if (path.empty() && llvm::hasTyCheOutputPrefix(M))
+    path = llvm::getTyCheSidecarPath(M, "tychedb");
+  else if (path.empty()) {
+    path = M.getName();
+    path += ".tychedb";
+  }
+  if (llvm::Error E = Ctx->APDatabase.writeToFile(path))
+    EFFECTIVE_FATAL_ERROR(llvm::toString(std::move(E)));
+  if (option_debug)
+    fprintf(stderr, "EffectiveSan: %s: %s: %zu types, %zu sites, "
+            "%zu bytes of TyChe metadata (%zu dense)\n",
+            M.getSourceFileName().c_str(), path.c_str(),
+            Ctx->APDatabase.getNumTypes(), Ctx->APDatabase.getNumSites(),
+            (size_t)Ctx->APDatabase.getMetaBytes(),
+            (size_t)Ctx->APDatabase.getDenseMetaBytes());
+}
+
+static void writeJSONString(llvm::raw_ostream &OS, llvm::StringRef str) {
+  OS << '"';
+  for (unsigned char c : str) {
+    if (c == '"' || c == '\\')
+      OS << '\\' << c;
+    else if (c < 0x20)
+      OS << llvm::format("\\u%04x", c);
+    else
+      OS << c;
+  }
+  OS << '"';
+}
+
+/*
+ * Peak resident set size of the compiler process so far, in KB.
+ */
+static uint64_t getPeakRSS() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+  return (uint64_t)usage.ru_maxrss;
+}
+
+/*
+ * Write the per-phase times and counters of this module for
+ * -effective-stats-json.  Times are in seconds.
+ */
+static void writeStatsJSON(llvm::Module &M) {
+  std::string path(option_stats_json);
+  if (path.empty())
+    path = llvm::getTyCheSidecarPath(M, "effective-stats.json");
+  std::error_code EC;
+  llvm::raw_fd_ostream OS(path, EC, llvm::sys::fs::F_Text);
+  if (EC)
+    EFFECTIVE_FATAL_ERROR("failed to open \"" + path + "\": " + EC.message());
+  OS << "{\n  \"file\": ";
+  writeJSONString(OS, M.getSourceFileName());
+  OS << ",\n  \"phases\": {";
+  for (unsigned i = 0; i < PHASE_MAX; i++) {
+    llvm::TimeRecord T = Ctx->Phases.timers[i].getTotalTime();
+    OS << (i == 0 ? "\n" : ",\n") << "    \"" << PhaseNames[i][0]
+       << "\": {\"wall\": " << llvm::format("%.6f", T.getWallTime())
+       << ", \"user\": " << llvm::format("%.6f", T.getUserTime())
+       << ", \"system\": " << llvm::format("%.6f", T.getSystemTime()) << "}";
+  }
+  OS << "\n  },\n  \"counters\": {";
+  for (unsigned i = 0; i < COUNTER_MAX; i++)
+    OS << (i == 0 ? "\n" : ",\n") << "    \"" << CounterNames[i]
+       << "\": " << Ctx->Counters[i];
+  OS << ",\n    \"tyche-types\": " << Ctx->APDatabase.getNumTypes()
+     << ",\n    \"tyche-sites\": " << Ctx->APDatabase.getNumSites()
+     << ",\n    \"tyche-meta-bytes\": " << Ctx->APDatabase.getMetaBytes()
+     << ",\n    \"tyche-dense-meta-bytes\": "
+     << Ctx->APDatabase.getDenseMetaBytes()
+     << ",\n    \"layout-arena-bytes\": "
+     << Ctx->Arena.allocator.getBytesAllocated()
+     << "\n  },\n  \"peak-rss-kb\": " << getPeakRSS() << "\n}\n";
+  OS.close();
+  if (OS.has_error())
+    EFFECTIVE_FATAL_ERROR("failed to write \"" + path + "\"");
+
+  // Only report the timers under -time-passes.
+  if (!llvm::TimePassesIsEnabled)
+    for (unsigned i = 0; i < PHASE_MAX; i++)
+      Ctx->Phases.timers[i].clear();
+}
+
+/*
+ * Persistent layout cache (-effective-layout-cache=<dir>).  Building a layout
+ * hash table may take many attempts with different hash seeds (see
+ * compileType()), and the same library types are compiled again in every
+ * module.  The cache remembers the seed that worked for a layout, so later
+ * compilations try it first and skip the search.
+ *
+ * Entries are keyed by the type hash and the layout length, and also record a
+ * fingerprint of the layout entries that the seed was found for.  A cached
+ * seed is only used if the fingerprint matches and compileLayout() accepts
+ * it.  The search is deterministic, so the output is the same with or without
+ * the cache.
+ *
+ * Each entry is its own file, written to a unique temporary and renamed into
+ * place, so concurrent compilations never see a partial entry.  A hit
+ * refreshes the modification time of the entry, and once the directory grows
+ * past -effective-layout-cache-size the least recently used entries are
+ * evicted.
+ */
+#define LAYOUT_CACHE_MAGIC      0x54554F59414C5954ull   // "TYLAYOUT"
+#define LAYOUT_CACHE_VERSION    1   // Bump on any change to the layouts.
+#define LAYOUT_CACHE_EXT        ".layout"
+
+struct LayoutCacheRecord {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t retries;               // Failed seeds before this one.
+  uint64_t hash[2];               // Type hash.
+  uint64_t hval;                  // Initial seed.
+  uint64_t layoutLen;
+  uint64_t fingerprint[2];        // See getLayoutFingerprint().
+  uint64_t seed;                  // The seed to use.
+};
+
+/*
+ * Hash everything about a layout that the placement of its entries depends
+ * on, including the layout format.
+ */
+static HashVal getLayoutFingerprint(const LayoutInfo &layout) {
+  HashContext cxt;
+  uint64_t format = option_layout_format;
+  update(cxt, (const char *)&format, sizeof(format));
+  for (auto &entries : layout) {
+    const LayoutEntry &lEntry = entries.second;
+    uint64_t vals[] = {entries.first, lEntry.hash,
+                       (uint64_t)lEntry.priority | (lEntry.deleted ? 2 : 0)};
+    update(cxt, (const char *)vals, sizeof(vals));
+  }
+  return final(cxt);
+}
+
+static std::string getLayoutCachePath(const HashVal &hash, size_t layoutLen) {
+  char name[64];
+  snprintf(name, sizeof(name), "%.16lx%.16lx-%zx" LAYOUT_CACHE_EXT,
+           hash.i64[1], hash.i64[0], layoutLen);
+  llvm::SmallString<128> path(option_layout_cache);
+  llvm::sys::path::append(path, name);
+  return path.str();
+}
+
+static bool lookupLayoutCache(const HashVal &hash, uint64_t hval,
+                              size_t layoutLen, const LayoutInfo &layout,
+                              uint64_t &seed) {
+  if (option_layout_cache.empty())
+    return false;
+  std::string path = getLayoutCachePath(hash, layoutLen);
+  int FD;
+  if (llvm::sys::fs::openFileForRead(path, FD)) {
+    count(COUNTER_LAYOUT_CACHE_MISSES);
+    return false;
+  }
+  auto Buf = llvm::MemoryBuffer::getOpenFile(FD, path, -1);
+  LayoutCacheRecord R;
+  bool hit = false;
+  if (Buf && (*Buf)->getBufferSize() == sizeof(R)) {
+    memcpy(&R, (*Buf)->getBufferStart(), sizeof(R));
+    HashVal fp = getLayoutFingerprint(layout);
+    hit = (R.magic == LAYOUT_CACHE_MAGIC &&
+           R.version == LAYOUT_CACHE_VERSION &&
+           R.hash[0] == hash.i64[0] && R.hash[1] == hash.i64[1] &&
+           R.hval == hval && R.layoutLen == layoutLen &&
+           R.fingerprint[0] == fp.i64[0] && R.fingerprint[1] == fp.i64[1]);
+  }
+  if (hit) {
+    seed = R.seed;
+    llvm::sys::fs::setLastModificationAndAccessTime(
+        FD, llvm::sys::toTimePoint(std::time(nullptr)));
+  }
+  llvm::sys::Process::SafelyCloseFileDescriptor(FD);
+  count(hit ? COUNTER_LAYOUT_CACHE_HITS : COUNTER_LAYOUT_CACHE_MISSES);
+  return hit;
+}
 
+/*
+ * Failures are not fatal; the layout is simply not cached.
+ */
+static void storeLayoutCache(const HashVal &hash, uint64_t hval,
+                             size_t layoutLen, const LayoutInfo &layout,
+                             uint64_t seed, unsigned retries) {
+  if (option_layout_cache.empty())
+    return;
+  LayoutCacheRecord R;
+  memset(&R, 0, sizeof(R));
+  R.magic = LAYOUT_CACHE_MAGIC;
+  R.version = LAYOUT_CACHE_VERSION;
+  R.retries = retries;
+  R.hash[0] = hash.i64[0];
+  R.hash[1] = hash.i64[1];
+  R.hval = hval;
+  R.layoutLen = layoutLen;
+  HashVal fp = getLayoutFingerprint(layout);
+  R.fingerprint[0] = fp.i64[0];
+  R.fingerprint[1] = fp.i64[1];
+  R.seed = seed;
+
+  std::string path = getLayoutCachePath(hash, layoutLen);
+  llvm::SmallString<128> tmpPath;
+  int FD;
+  if (llvm::sys::fs::create_directories(option_layout_cache) ||
+      llvm::sys::fs::createUniqueFile(option_layout_cache +
+                                      "/layout-%%%%%%%%.tmp", FD, tmpPath)) {
+    if (option_debug)
+      fprintf(stderr, "EffectiveSan: failed to write layout cache \"%s\"\n",
+              option_layout_cache.c_str());
+    return;
+  }
+  llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+  OS.write((const char *)&R, sizeof(R));
+  OS.close();
+  if (OS.has_error()) {
+    OS.clear_error();
+    llvm::sys::fs::remove(tmpPath);
+    return;
+  }
+  if (llvm::sys::fs::rename(tmpPath, path)) {
+    llvm::sys::fs::remove(tmpPath);
+    return;
+  }
+  Ctx->LayoutCacheDirty = true;
+}
 
-static std::map<size_t, std::string>  TypeIDCache;
+/*
+ * Evict the least recently used entries until the cache fits in
+ * -effective-layout-cache-size.  Only done by compilations that added
+ * entries.  Entries removed concurrently by another compilation are
+ * ignored.
+ */
+static void pruneLayoutCache(void) {
+  if (!Ctx->LayoutCacheDirty || option_layout_cache_size == 0)
+    return;
+  struct CacheFile {
+    llvm::sys::TimePoint<> time;
+    uint64_t size;
+    std::string path;
+  };
+  std::vector<CacheFile> files;
+  uint64_t total = 0;
+  std::error_code EC;
+  for (llvm::sys::fs::directory_iterator i(option_layout_cache, EC), e;
+       i != e && !EC; i.increment(EC)) {
+    if (llvm::sys::path::extension(i->path()) != LAYOUT_CACHE_EXT)
+      continue;
+    llvm::sys::fs::file_status status;
+    if (i->status(status))
+      continue;
+    files.push_back({status.getLastModificationTime(), status.getSize(),
+                     i->path()});
+    total += status.getSize();
+  }
+  uint64_t limit = (uint64_t)option_layout_cache_size * 1024;
+  if (total <= limit)
+    return;
+  std::sort(files.begin(), files.end(),
+            [](const CacheFile &a, const CacheFile &b) {
+              return a.time < b.time;
+            });
+  for (auto &file : files) {
+    if (total <= limit)
+      break;
+    llvm::sys::fs::remove(file.path);
+    total -= file.size;
+  }
+}
 
 
 /*
@@ -408,7 +1334,8 @@ static void buildMemberLayout(llvm::DIType *Ty, size_t offset, const FAM &fam,
                               intptr_t lb, intptr_t ub, bool priority,
                               bool inherited, TypeInfo &tInfo,
                               LayoutInfo &layout, TyCheEntry prevTyCheEntry,
-                              std::vector<llvm::DIType *>& TyCheDependencyTree);
+                              const TyCheDepNode *deps,
+                              LayoutPeriods &periods);
 
 static void buildTypeHumanName(llvm::DIType *Ty, std::string &humanName,
                                TypeInfo &tInfo);
@@ -424,9 +1351,9 @@ static bool canInstrumentGlobal(llvm::GlobalVariable &GV);
  * Test if something is blacklisted or not.
  */
 static bool isBlacklisted(const char *section, llvm::StringRef Name) {
-  if (Blacklist == nullptr)
+  if (Ctx->Blacklist == nullptr)
     return false;
-  if (Blacklist->inSection(section, Name))
+  if (Ctx->Blacklist->inSection(section, Name))
     return true;
   return false;
 }
@@ -501,27 +1428,27 @@ static bool isAnonymousType(llvm::DIType *Ty) {
  */
 static llvm::DIType *normalizeIntegerType(llvm::DIType *Ty) {
   if (Ty == nullptr)
-    return Int8Ty;
+    return Ctx->Int8Ty;
   if (auto *BasicTy = llvm::dyn_cast<llvm::DIBasicType>(Ty)) {
     switch (BasicTy->getEncoding()) {
     case llvm::dwarf::DW_ATE_signed_char:
     case llvm::dwarf::DW_ATE_unsigned_char:
     case llvm::dwarf::DW_ATE_boolean:
-      return Int8Ty;
+      return Ctx->Int8Ty;
     case llvm::dwarf::DW_ATE_signed:
     case llvm::dwarf::DW_ATE_unsigned:
     case llvm::dwarf::DW_ATE_UTF:
       switch (BasicTy->getSizeInBits()) {
       case 8:
-        return Int8Ty;
+        return Ctx->Int8Ty;
       case 16:
-        return Int16Ty;
+        return Ctx->Int16Ty;
       case 32:
-        return Int32Ty;
+        return Ctx->Int32Ty;
       case 64:
-        return Int64Ty;
+        return Ctx->Int64Ty;
       case 128:
-        return Int128Ty;
+        return Ctx->Int128Ty;
       default:
         return Ty;
       }
@@ -530,7 +1457,7 @@ static llvm::DIType *normalizeIntegerType(llvm::DIType *Ty) {
     }
   } else if (auto *CompositeTy = llvm::dyn_cast<llvm::DICompositeType>(Ty)) {
     if (CompositeTy->getTag() == llvm::dwarf::DW_TAG_enumeration_type)
-      return Int32Ty;
+      return Ctx->Int32Ty;
     else
       return Ty;
   } else
@@ -542,23 +1469,23 @@ static llvm::DIType *normalizeIntegerType(llvm::DIType *Ty) {
  */
 static llvm::DIType *normalizePointerType(llvm::DIType *Ty) {
   if (Ty == nullptr)
-    return Int8PtrTy;
+    return Ctx->Int8PtrTy;
   auto DerivedTy = llvm::dyn_cast<llvm::DIDerivedType>(Ty);
   if (DerivedTy == nullptr)
-    return Int8PtrTy;
+    return Ctx->Int8PtrTy;
   switch (DerivedTy->getTag()) {
   case llvm::dwarf::DW_TAG_pointer_type:
   case llvm::dwarf::DW_TAG_reference_type:
   case llvm::dwarf::DW_TAG_rvalue_reference_type:
     break;
   default:
-    return Int8PtrTy;
+    return Ctx->Int8PtrTy;
   }
   Ty = DerivedTy->getBaseType().resolve();
   if (Ty == nullptr)
-    return Int8PtrTy;
+    return Ctx->Int8PtrTy;
   Ty = normalizeType(Ty);
-  llvm::DIBuilder builder(*Module);
+  llvm::DIBuilder builder(*Ctx->Module);
   Ty = builder.createPointerType(Ty, sizeof(void *) * CHAR_BIT);
   return Ty;
 }
@@ -570,14 +1497,14 @@ static llvm::DIType *normalizeType(llvm::DIType *Ty) {
 
   while (Ty != nullptr) {
     if (isVPtrType(Ty))
-      return Int8PtrTy;
+      return Ctx->Int8PtrTy;
     else if (llvm::isa<llvm::DIBasicType>(Ty))
       return normalizeIntegerType(Ty);
     else if (auto *DerivedTy = llvm::dyn_cast<llvm::DIDerivedType>(Ty)) {
       switch (DerivedTy->getTag()) {
       case llvm::dwarf::DW_TAG_ptr_to_member_type: {
         // C++ pointers-to-member types are treated as size_t.
-        return Int64Ty;
+        return Ctx->Int64Ty;
       }
       case llvm::dwarf::DW_TAG_typedef:
       case llvm::dwarf::DW_TAG_member:
@@ -598,7 +1525,7 @@ static llvm::DIType *normalizeType(llvm::DIType *Ty) {
     } else if (auto *CompositeTy = llvm::dyn_cast<llvm::DICompositeType>(Ty)) {
       switch (CompositeTy->getTag()) {
       case llvm::dwarf::DW_TAG_enumeration_type:
-        return Int32Ty;
+        return Ctx->Int32Ty;
       case llvm::dwarf::DW_TAG_array_type:
         Ty = CompositeTy->getBaseType().resolve();
         break;
@@ -608,7 +1535,7 @@ static llvm::DIType *normalizeType(llvm::DIType *Ty) {
     } else
       return Ty;
   }
-  return Int8Ty; // Give up
+  return Ctx->Int8Ty; // Give up
 }
 
 /*
@@ -809,11 +1736,11 @@ static void warning(llvm::Module &M, const std::string &msg) {
  * speed, whereas the "INFO" version is designed for error messages.
  */
 
-static llvm::StructType *makeTypeMetaType(llvm::Module &M, size_t len, llvm::ArrayType * tyche_cl_type) {
+static llvm::StructType *makeTypeMetaType(llvm::Module &M, size_t len,
+                                          llvm::Type *TailTy = nullptr) {
 
-  assert(tyche_cl_type != nullptr);
-  auto i = metaCache.find(len);
-  if (i != metaCache.end())
+  auto i = Ctx->metaCache.find(std::make_pair(len, TailTy));
+  if (i != Ctx->metaCache.end())
     return i->second;
 
   llvm::LLVMContext &Cxt = M.getContext();
@@ -822,11 +1749,15 @@ static llvm::StructType *makeTypeMetaType(llvm::Module &M, size_t len, llvm::Arr
     name += '_';
     name += std::to_string(len);
   }
+  if (TailTy != nullptr) {
+    name += '_';
+    name += std::to_string(TailTy->getArrayNumElements());
+  }
   llvm::StructType *Ty = llvm::StructType::create(Cxt, name);
   if (len == 0)
-    TypeTy = Ty;
+    Ctx->TypeTy = Ty;
   std::vector<llvm::Type *> Fields;
-  Fields.push_back(tyche_cl_type->getPointerTo());
+  Fields.push_back(Ctx->TyCheSparseMetaTy->getPointerTo()); /* tyche_meta */
   Fields.push_back(llvm::Type::getInt64Ty(Cxt)); /* hash */
   Fields.push_back(llvm::Type::getInt64Ty(Cxt)); /* hash2 */
   Fields.push_back(llvm::Type::getInt32Ty(Cxt)); /* size */
@@ -835,18 +1766,89 @@ static llvm::StructType *makeTypeMetaType(llvm::Module &M, size_t len, llvm::Arr
   Fields.push_back(llvm::Type::getInt32Ty(Cxt)); /* sanity */
   Fields.push_back(llvm::Type::getInt64Ty(Cxt)); /* magic */
   Fields.push_back(llvm::Type::getInt64Ty(Cxt)); /* mask */
-  Fields.push_back(InfoTy->getPointerTo());      /* info */
+  Fields.push_back(Ctx->InfoTy->getPointerTo());      /* info */
   Fields.push_back(llvm::Type::getInt64Ty(Cxt)); /* next */
+  Fields.push_back(Ctx->ColdEntryTy->getPointerTo()); /* cold */
+  Fields.push_back(Ctx->PeriodTy->getPointerTo());    /* periods */
   Fields.push_back(llvm::Type::getInt32Ty(Cxt)); /* length */
-  llvm::ArrayType *LayoutTy = llvm::ArrayType::get(EntryTy, len);
+  Fields.push_back(llvm::Type::getInt32Ty(Cxt)); /* format */
+  llvm::ArrayType *LayoutTy = llvm::ArrayType::get(Ctx->EntryTy, len);
   Fields.push_back(LayoutTy); /* layout */
+  if (TailTy != nullptr)                         /* displacements/tags */
+    Fields.push_back(TailTy);
   Ty->setBody(Fields);
 
-  metaCache.insert(std::make_pair(len, Ty));
+  Ctx->metaCache.insert(std::make_pair(std::make_pair(len, TailTy), Ty));
 
   return Ty;
 }
 
+/*
+ * Returns true if all uses of `V' are (through constants) in the
+ * initializers of the globals in `group'.
+ */
+static bool isOnlyUsedByGroup(const llvm::Value *V,
+                              const llvm::SmallPtrSetImpl<llvm::GlobalVariable *> &group) {
+  for (const llvm::User *U : V->users()) {
+    if (auto *GV = llvm::dyn_cast<llvm::GlobalVariable>(U)) {
+      if (group.count(const_cast<llvm::GlobalVariable *>(GV)) == 0)
+        return false;
+    } else if (llvm::isa<llvm::Constant>(U)) {
+      if (!isOnlyUsedByGroup(U, group))
+        return false;
+    } else
+      return false;
+  }
+  return true;
+}
+
+/*
+ * Put the type meta-data global `Key' (an EFFECTIVE_TYPE_* or
+ * EFFECTIVE_INFO_* global) into a COMDAT group of its own name, together
+ * with the globals that only it refers to: name strings, layout entry names,
+ * and the TyChe cachelines and index.  Every module that mentions the type
+ * emits the same group, so the linker keeps one and discards the others
+ * whole instead of resolving each weak symbol on its own.  Globals that are
+ * shared between types (or already grouped) stay outside.
+ */
+static void setTypeMetaComdat(llvm::Module &M, llvm::GlobalVariable *Key) {
+  if (!llvm::Triple(M.getTargetTriple()).supportsCOMDAT())
+    return;
+  llvm::Comdat *C = M.getOrInsertComdat(Key->getName());
+  llvm::SmallPtrSet<llvm::GlobalVariable *, 16> group;
+  llvm::SmallPtrSet<llvm::Constant *, 32> seen;
+  std::vector<llvm::GlobalVariable *> worklist;
+  worklist.push_back(Key);
+  while (!worklist.empty()) {
+    llvm::GlobalVariable *GV = worklist.back();
+    worklist.pop_back();
+    GV->setComdat(C);
+    group.insert(GV);
+    std::vector<llvm::Constant *> consts;
+    if (GV->hasInitializer())
+      consts.push_back(GV->getInitializer());
+    while (!consts.empty()) {
+      llvm::Constant *Cst = consts.back();
+      consts.pop_back();
+      if (!seen.insert(Cst).second)
+        continue;
+      if (auto *Member = llvm::dyn_cast<llvm::GlobalVariable>(Cst)) {
+        llvm::StringRef name = Member->getName();
+        if (!Member->hasComdat() && group.count(Member) == 0 &&
+            !name.startswith(TYPE_META_PREFIX) &&
+            !name.startswith(TYPE_INFO_PREFIX) &&
+            isOnlyUsedByGroup(Member, group))
+          worklist.push_back(Member);
+        continue;
+      }
+      if (llvm::isa<llvm::GlobalValue>(Cst))
+        continue;
+      for (llvm::Value *Op : Cst->operands())
+        consts.push_back(llvm::cast<llvm::Constant>(Op));
+    }
+  }
+}
+
 static llvm::DIType *getPointeeType(llvm::DIType *Ty) {
   while (true) {
     auto *DerivedTy = llvm::dyn_cast<llvm::DIDerivedType>(Ty);
@@ -867,8 +1869,8 @@ static llvm::DIType *getPointeeType(llvm::DIType *Ty) {
 }
 
 static llvm::StructType *makeTypeInfoType(llvm::Module &M, size_t len) {
-  auto i = infoCache.find(len);
-  if (i != infoCache.end())
+  auto i = Ctx->infoCache.find(len);
+  if (i != Ctx->infoCache.end())
     return i->second;
 
   llvm::LLVMContext &Cxt = M.getContext();
@@ -879,18 +1881,18 @@ static llvm::StructType *makeTypeInfoType(llvm::Module &M, size_t len) {
   }
   llvm::StructType *Ty = llvm::StructType::create(Cxt, name);
   if (len == 0)
-    InfoTy = Ty;
+    Ctx->InfoTy = Ty;
   std::vector<llvm::Type *> Fields;
   Fields.push_back(llvm::Type::getInt8PtrTy(Cxt)); /* name */
   Fields.push_back(llvm::Type::getInt32Ty(Cxt));   /* size */
   Fields.push_back(llvm::Type::getInt32Ty(Cxt));   /* num_entries */
   Fields.push_back(llvm::Type::getInt32Ty(Cxt));   /* flags */
-  Fields.push_back(InfoTy->getPointerTo());        /* next */
-  llvm::ArrayType *EntriesTy = llvm::ArrayType::get(InfoEntryTy, len);
+  Fields.push_back(Ctx->InfoTy->getPointerTo());        /* next */
+  llvm::ArrayType *EntriesTy = llvm::ArrayType::get(Ctx->InfoEntryTy, len);
   Fields.push_back(EntriesTy); /* entries */
   Ty->setBody(Fields);
 
-  infoCache.insert(std::make_pair(len, Ty));
+  Ctx->infoCache.insert(std::make_pair(len, Ty));
 
   return Ty;
 }
@@ -908,7 +1910,7 @@ static llvm::StructType *makeTyCheCacheLineType(llvm::Module &M, int64_t tid, si
   llvm::StructType *Ty = llvm::StructType::create(Cxt, name);
 
   if (tid == -1)
-    TyCheCacheLineEntryTy = Ty;
+    Ctx->TyCheCacheLineEntryTy = Ty;
 
 
   std::vector<llvm::Type *> Fields;
@@ -916,7 +1918,7 @@ static llvm::StructType *makeTyCheCacheLineType(llvm::Module &M, int64_t tid, si
   {
     Fields.push_back(llvm::Type::getInt32Ty(Cxt)); /* Meta #n */
   }      
-  Fields.push_back(TyCheCacheLineEntryTy->getPointerTo());        /* next cacheline */
+  Fields.push_back(Ctx->TyCheCacheLineEntryTy->getPointerTo());        /* next cacheline */
   Ty->setBody(Fields, true);
   
   return Ty;
@@ -926,16 +1928,52 @@ static llvm::StructType *makeTyCheCacheLineType(llvm::Module &M, int64_t tid, si
 static TypeEntry &addTypeEntry(TypeInfo &tInfo, llvm::DIType *Ty,
                                std::string &name, HashVal hash,
                                llvm::Constant *Meta, bool isInt8 = false) {
-  TYCHE_TYPE_ID++; 
-  TypeEntry entry = {isInt8, name, hash, Meta, TYCHE_TYPE_ID};
+  uint64_t type_id;
+  if (option_canonical_type_ids)
+    type_id = getCanonicalTyCheTypeID(hash);
+  else {
+    nextTyCheTypeID(Ctx->TYCHE_TYPE_ID);
+    type_id = Ctx->TYCHE_TYPE_ID;
+  }
+  TypeEntry entry = {isInt8, name, hash, Meta, type_id};
   auto i = tInfo.cache.insert(std::make_pair(Ty, entry));
   return i.first->second;
 }
 
+/*
+ * Find the type that owns the type meta-data `Meta' (i.e., the first type
+ * compiled to it) and its TyChe type ID.  Returns nullptr if there is none.
+ */
+static llvm::DIType *lookupTypeMeta(const TypeInfo &tInfo,
+                                    llvm::Constant *Meta, uint64_t &tid) {
+  auto i = tInfo.metas.find(Meta);
+  if (i == tInfo.metas.end())
+    return nullptr;
+  auto j = tInfo.cache.find(i->second);
+  if (j == tInfo.cache.end())
+    return nullptr;
+  tid = j->second.type_id;
+  return i->second;
+}
+
+/*
+ * Get the textual layout dump of the type meta-data `Meta'.  The dump is
+ * cached under the layout ID the meta-data was compiled to, which differs
+ * from the TyChe type ID of the type entry.
+ */
+static const std::string &getTyCheLayoutDump(llvm::Constant *Meta) {
+  auto i = Ctx->AllocationPointsDIInfo.find(Meta);
+  assert(i != Ctx->AllocationPointsDIInfo.end() &&
+         "type meta-data has no compiled layout");
+  auto j = Ctx->TypeIDCache.find(i->second);
+  assert(j != Ctx->TypeIDCache.end() && "layout was not dumped");
+  return j->second;
+}
+
 static uint64_t getTypeHash(llvm::DIType *Ty, HashVal hash) {
-  if (Ty == nullptr || Ty == Int8Ty)
+  if (Ty == nullptr || Ty == Ctx->Int8Ty)
     return EFFECTIVE_TYPE_INT8_HASH;
-  if (Ty == Int8PtrTy)
+  if (Ty == Ctx->Int8PtrTy)
     return EFFECTIVE_TYPE_INT8_PTR_HASH;
   return EFFECTIVE_BSWAP64(hash.i64[0]);
 }
@@ -960,12 +1998,37 @@ static uint64_t getCoercedTypeHash(llvm::DIType *Ty) {
 }
 
 /*
- * Add an entry to the layout.
+ * Get the dependency node for `Ty' nested in `parent'.
+ */
+static const TyCheDepNode *getTyCheDepNode(const TyCheDepNode *parent,
+                                           llvm::DIType *Ty) {
+  auto i = Ctx->Arena.nodes.find(std::make_pair(parent, Ty));
+  if (i != Ctx->Arena.nodes.end())
+    return i->second;
+  TyCheDepNode *node = new (Ctx->Arena.allocator.Allocate<TyCheDepNode>())
+      TyCheDepNode{Ty, parent};
+  Ctx->Arena.nodes.insert(std::make_pair(std::make_pair(parent, Ty), node));
+  count(COUNTER_TYCHE_DEP_NODES);
+  return node;
+}
+
+/*
+ * Get the human name of `Ty' as a NUL-terminated string owned by the arena.
+ */
+static llvm::StringRef internLayoutName(llvm::DIType *Ty, TypeInfo &tInfo) {
+  std::string name;
+  buildTypeHumanName(Ty, name, tInfo);
+  return Ctx->Arena.names.insert(name).first->getKey();
+}
+
+/*
+ * Add an entry to the layout.  The `offset' is the layout key, i.e., it
+ * carries the level of entries within periodic arrays.
  */
 static void addLayoutEntry(LayoutInfo &layout, TypeInfo &tInfo, size_t offset,
                            llvm::DIType *Ty, intptr_t lb, intptr_t ub,
                            bool priority, TyCheEntry tyche_entry, 
-                           std::vector<llvm::DIType*>& TyCheDependencyTree) {
+                           const TyCheDepNode *deps) {
   Ty = normalizeType(Ty);
   // Ty->dump();
   HashVal hash = buildTypeHash(Ty, tInfo);
@@ -988,17 +2051,16 @@ static void addLayoutEntry(LayoutInfo &layout, TypeInfo &tInfo, size_t offset,
     return;
 
     // No existing entry, so create one:
-  std::string name;
-  buildTypeHumanName(Ty, name, tInfo);
+  llvm::StringRef name = internLayoutName(Ty, tInfo);
 #ifdef EFFECTIVE_LAYOUT_DEBUG
   // std::string name;
   // buildTypeHumanName(Ty, name, tInfo);
-  fprintf(stderr, "\t%s [%+zd] (%zd..%zd) <%.16lX> {%zd} ", name.c_str(),
+  fprintf(stderr, "\t%s [%+zd] (%zd..%zd) <%.16lX> {%zd} ", name.data(),
           offset, lb, ub, hval, (intptr_t)hval);
   Ty->dump();
   if (tyche_entry.Parent != nullptr) tyche_entry.Parent->dump();
 #endif
-  LayoutEntry entry = {offset, Ty, hval, 0, lb, ub, /*priority*/ false, false, false, tyche_entry, TyCheDependencyTree, name};
+  LayoutEntry entry = {EFFECTIVE_PERIOD_OFFSET(offset), (unsigned)EFFECTIVE_PERIOD_LEVEL(offset), Ty, hval, 0, lb, ub, /*priority*/ false, false, false, tyche_entry, deps, name};
   layout.insert(std::make_pair(offset, entry));
 
   // Add entry for any type coercion:
@@ -1020,7 +2082,7 @@ static void addLayoutEntry(LayoutInfo &layout, TypeInfo &tInfo, size_t offset,
   fprintf(stderr, "\t+coerced <%.16lX> {%zd}\n", hval, (intptr_t)hval);
 #endif
 
-  LayoutEntry coercedEntry = {offset, Ty, hval, 0, lb, ub, /*priority*/ false, false, true, tyche_entry, TyCheDependencyTree, "coerced"};
+  LayoutEntry coercedEntry = {EFFECTIVE_PERIOD_OFFSET(offset), (unsigned)EFFECTIVE_PERIOD_LEVEL(offset), Ty, hval, 0, lb, ub, /*priority*/ false, false, true, tyche_entry, deps, "coerced"};
   layout.insert(std::make_pair(offset, coercedEntry));
 }
 
@@ -1034,7 +2096,7 @@ static llvm::DIType *getMemberType(llvm::DIType *Ty, size_t &offset,
                                    bool &isInheritance, bool &isVirtual) {
   while (true) {
     if (isVPtrType(Ty)) {
-      Ty = Int8PtrTy;
+      Ty = Ctx->Int8PtrTy;
       break;
     }
     auto DerivedTy = llvm::dyn_cast<llvm::DIDerivedType>(Ty);
@@ -1079,7 +2141,7 @@ static llvm::DIType *getMemberType(llvm::DIType *Ty, size_t &offset,
       Ty = DerivedTy->getBaseType().resolve();
       break;
     case llvm::dwarf::DW_TAG_ptr_to_member_type:
-      Ty = Int64Ty;
+      Ty = Ctx->Int64Ty;
       break;
     case llvm::dwarf::DW_TAG_pointer_type:
     case llvm::dwarf::DW_TAG_reference_type:
@@ -1102,7 +2164,8 @@ static llvm::DIType *getMemberType(llvm::DIType *Ty, size_t &offset,
  */
 static void buildLayout(llvm::DICompositeType *CompositeTy, size_t offsetBase,
                         const FAM &fam, TypeInfo &tInfo, LayoutInfo &layout,
-                        std::vector<llvm::DIType*>& TyCheDependencyTree,
+                        const TyCheDepNode *deps,
+                        LayoutPeriods &periods,
                         bool priority = false, bool inherited = false) {
   llvm::DINodeArray Elements = CompositeTy->getElements();
   for (auto Element : Elements) {
@@ -1148,11 +2211,10 @@ static void buildLayout(llvm::DICompositeType *CompositeTy, size_t offsetBase,
     offset = offset / CHAR_BIT;
     intptr_t lb = 0, ub = size;
 
-    TyCheDependencyTree.push_back(llvm::dyn_cast<llvm::DIType>(Element));
     buildMemberLayout(Ty, offset, fam, lb, ub, priority,
-                      (inherited || isInheritance), tInfo, layout, tyCheEntry, TyCheDependencyTree);
-    
-    TyCheDependencyTree.pop_back();
+                      (inherited || isInheritance), tInfo, layout, tyCheEntry,
+                      getTyCheDepNode(deps, llvm::cast<llvm::DIType>(Element)),
+                      periods);
   }
 }
 
@@ -1165,7 +2227,8 @@ static void buildMemberLayout(llvm::DIType *Ty, size_t offset, const FAM &fam,
                               intptr_t lb, intptr_t ub, bool priority,
                               bool inherited, TypeInfo &tInfo,
                               LayoutInfo &layout, TyCheEntry prevTyCheEntry, 
-                              std::vector<llvm::DIType*>& TyCheDependencyTree) {
+                              const TyCheDepNode *deps,
+                              LayoutPeriods &periods) {
 
   if (offset == fam.offset && Ty == fam.type) {
     //fam.type->dump();
@@ -1179,14 +2242,13 @@ static void buildMemberLayout(llvm::DIType *Ty, size_t offset, const FAM &fam,
 
     Ty = normalizeType(Ty);
     intptr_t lb = -EFFECTIVE_DELTA, ub = EFFECTIVE_DELTA;
-    addLayoutEntry(layout, tInfo, offset, Ty, lb, ub, /*priority*/ false, famTyCheEntry, TyCheDependencyTree);
+    addLayoutEntry(layout, tInfo, offset, Ty, lb, ub, /*priority*/ false, famTyCheEntry, deps);
     auto *CompositeTy = getStructType(Ty);
     if (CompositeTy != nullptr)
     {
-      TyCheDependencyTree.push_back(CompositeTy);
-      buildLayout(CompositeTy, offset, fam, tInfo, layout, TyCheDependencyTree,
+      buildLayout(CompositeTy, offset, fam, tInfo, layout,
+                  getTyCheDepNode(deps, CompositeTy), periods,
                   /*priority=*/false, /*inherited=*/false);
-      TyCheDependencyTree.pop_back();
     }
 
       
@@ -1202,14 +2264,13 @@ static void buildMemberLayout(llvm::DIType *Ty, size_t offset, const FAM &fam,
     auto *CompositeTy = getStructType(Ty);
 
     addLayoutEntry(layout, tInfo, offset, Ty, lb, ub,
-                   (/*priority*/false || CompositeTy != nullptr), prevTyCheEntry, TyCheDependencyTree);
+                   (/*priority*/false || CompositeTy != nullptr), prevTyCheEntry, deps);
 
     // If `Ty' is a struct type, then recursively build the layout:
     if (CompositeTy != nullptr) {
-      TyCheDependencyTree.push_back(CompositeTy);
-      buildLayout(CompositeTy, offset, fam, tInfo, layout, TyCheDependencyTree,
+      buildLayout(CompositeTy, offset, fam, tInfo, layout,
+                  getTyCheDepNode(deps, CompositeTy), periods,
                   /*priority=*/false, inherited);
-      TyCheDependencyTree.pop_back();
     }
   } else {
     // This is an array member of type ElemTy[N]; so we must add an
@@ -1246,16 +2307,40 @@ static void buildMemberLayout(llvm::DIType *Ty, size_t offset, const FAM &fam,
 
 
     intptr_t lb = 0, ub = arraySpan * elemSize;
+    const TyCheDepNode *elemDeps = getTyCheDepNode(deps, Ty);
+
+    // Large arrays are described by the entries of element 0 only.  Each
+    // T[A*B*...*Y] "row" is an outer period, and each T[Z] an inner one,
+    // matching the simplification above.  The entries for the elements
+    // themselves get unlimited bounds: the type check narrows them to the
+    // array.
+    size_t level = EFFECTIVE_PERIOD_LEVEL(offset);
+    size_t depth = (arraySize > (size_t)ub ? 2 : 1);
+    if (option_periodic_min != 0 &&
+        arraySize / elemSize >= option_periodic_min &&
+        level + depth <= EFFECTIVE_MAX_PERIOD_DEPTH) {
+      size_t base = EFFECTIVE_PERIOD_OFFSET(offset);
+      if (depth > 1)
+        periods.push_back({base, (size_t)ub, arraySize / ub});
+      periods.push_back({base, elemSize, arraySpan});
+      count(COUNTER_LAYOUT_PERIODS, depth);
+      level += depth;
+      buildMemberLayout(ElemTy, base | (level << EFFECTIVE_PERIOD_SHIFT), fam,
+                        -EFFECTIVE_DELTA, EFFECTIVE_DELTA, /*priority=*/false,
+                        /*inherited=*/false, tInfo, layout, tyCheEntry,
+                        elemDeps, periods);
+      return;
+    }
+
     for (size_t i = 0; i < arraySize; i += ub) {
       for (size_t j = 0; j < arraySpan; j++) {
         size_t elemOffset = j * elemSize;
         size_t subArrayOffset = i + j * elemSize;
         bool newPriority = (i == 0 && j == 0);
-        TyCheDependencyTree.push_back(Ty);
         buildMemberLayout(ElemTy, offset + subArrayOffset, fam, lb - elemOffset,
                           ub - elemOffset, /*newPriority*/ false,
-                          /*inherited=*/false, tInfo, layout, tyCheEntry, TyCheDependencyTree);
-        TyCheDependencyTree.pop_back();
+                          /*inherited=*/false, tInfo, layout, tyCheEntry,
+                          elemDeps, periods);
       }
     }
   }
@@ -1272,7 +2357,7 @@ static bool shrinkLayoutToFit(LayoutInfo &layout, size_t max) {
   // STEP #1: Delete non-priority char[] entries:
   for (auto &entry : layout) {
     LayoutEntry &lEntry = entry.second;
-    if (!lEntry.priority && lEntry.type == Int8Ty) {
+    if (!lEntry.priority && lEntry.type == Ctx->Int8Ty) {
       lEntry.deleted = true;
       size--;
       if (size <= max)
@@ -1377,7 +2462,7 @@ static bool placeFlattenedLayoutEntry(FlattenedLayoutInfo &flattenedLayout,
               "ADD(0x%.16lX, 0x%.16lX, %zu) = "
               "0x%.16lX {%zd} [%zd..%zd] index=%zu name: %s\n",
               hval1, hval2, offset, hval, (ssize_t)hval, offset + lEntry.lb,
-              offset + lEntry.ub, eidx, lEntry.humanName.c_str());
+              offset + lEntry.ub, eidx, lEntry.humanName.data());
 #endif
       flattenedLayout.insert(std::make_pair(eidx, &lEntry));
       break;
@@ -1387,7 +2472,9 @@ static bool placeFlattenedLayoutEntry(FlattenedLayoutInfo &flattenedLayout,
       LayoutEntry *oldEntry = j->second;
       flattenedLayout.erase(eidx);
       flattenedLayout.insert(std::make_pair(eidx, &lEntry));
-      return placeFlattenedLayoutEntry(flattenedLayout, hval1, oldEntry->offset,
+      size_t oldKey = oldEntry->offset |
+                      ((size_t)oldEntry->level << EFFECTIVE_PERIOD_SHIFT);
+      return placeFlattenedLayoutEntry(flattenedLayout, hval1, oldKey,
                                        mask, *oldEntry);
     }
     if (&lEntry == j->second) {
@@ -1420,9 +2507,41 @@ static bool placeFlattenedLayoutEntry(FlattenedLayoutInfo &flattenedLayout,
 
 
 
+/*
+ * Returns true if the layout entry is (part of) a virtual function table
+ * pointer.
+ */
+static bool isVirtualTableEntry(const LayoutEntry &lEntry) {
+  bool isVirutalTableType = false;
+  for (const TyCheDepNode *dep = lEntry.deps; dep != nullptr;
+       dep = dep->parent)
+  {
+    llvm::DIType *par = dep->type;
+    if (isVPtrType(par))
+    {
+        isVirutalTableType = true;
+        llvm::DIDerivedType * type = llvm::dyn_cast<llvm::DIDerivedType>(par);
+
+        llvm::DITypeRef VptrDerivedTy = type->getBaseType();
+        llvm::DIType *VptrTy = VptrDerivedTy.resolve();
+        llvm::DIType *VptrTableTy = getPointeeType(VptrTy);
+        VptrTy = getPointeeType(VptrTableTy);
+
+        auto *VptrSubroutine = llvm::dyn_cast<llvm::DISubroutineType>(VptrTy);
+        if (VptrSubroutine == nullptr) llvm_unreachable("Null FuncTy is found!\n");
+
+    }
+  }
+  return isVirutalTableType;
+}
+
 static int64_t compileLayoutToFlattenLayoutForTyChe(llvm::Module &M,
                                                 FlattenedLayoutInfo flattenedLayout,
-                                                std::string humanName) {
+                                                std::string humanName,
+                                                const HashVal &hash) {
+
+  uint64_t LayoutId = (option_canonical_type_ids ?
+                       getCanonicalTyCheTypeID(hash) : Ctx->TypeId);
 
 
 
@@ -1442,17 +2561,18 @@ static int64_t compileLayoutToFlattenLayoutForTyChe(llvm::Module &M,
       assert(entries.first == lEntry->offset);
 
         std::string typeHierarchy = "";
-        for (auto &par : lEntry->TyCheDependencyTree)
+        for (const TyCheDepNode *dep = lEntry->deps; dep != nullptr;
+             dep = dep->parent)
         {
             fprintf(stderr, "\t");
-            par->dump();
+            dep->type->dump();
         }
         lEntry->type->dump();
 
         fprintf(stderr, "TYCHE[%zu](%p)(Coerced: %zu)(FAM: %zu) = [%zd..%zd] =  Filename: %s Type Hierarchy: %s\n", 
                 entries.first, lEntry->type, lEntry->coerced, lEntry->tyche_entry.FAM, lEntry->offset + lEntry->lb, lEntry->offset + lEntry->ub, M.getSourceFileName().c_str(), typeHierarchy.c_str());
         
-        // for (auto &par : lEntry->TyCheDependencyTree)
+        // for (auto *dep = lEntry->deps; dep != nullptr; dep = dep->parent)
         // {
         //   fprintf(stderr, "\t");
         //   par->dump();
@@ -1498,64 +2618,43 @@ static int64_t compileLayoutToFlattenLayoutForTyChe(llvm::Module &M,
       total_offset += entries.first;
       total_name += entries.second->humanName;
 
-      if (TyCheMetaCacheLinesSections[TypeId][meta_offset][section_number].size() < NUMBER_OF_ENTRIES_IN_EACH_CACHELINE)
+      if (Ctx->TyCheMetaCacheLinesSections[LayoutId][meta_offset][section_number].size() < NUMBER_OF_ENTRIES_IN_EACH_CACHELINE)
       {
-          TyCheMetaCacheLinesSections[TypeId][meta_offset][section_number].push_back(Entry);
+          Ctx->TyCheMetaCacheLinesSections[LayoutId][meta_offset][section_number].push_back(Entry);
       }
       else 
       {
-          assert(TyCheMetaCacheLinesSections[TypeId][meta_offset][section_number].size() == NUMBER_OF_ENTRIES_IN_EACH_CACHELINE);
+          assert(Ctx->TyCheMetaCacheLinesSections[LayoutId][meta_offset][section_number].size() == NUMBER_OF_ENTRIES_IN_EACH_CACHELINE);
           section_number++;
           assert(section_number < TYCHE_NUMBER_OF_SECTIONS);
-          TyCheMetaCacheLinesSections[TypeId][meta_offset][section_number].push_back(Entry);
+          Ctx->TyCheMetaCacheLinesSections[LayoutId][meta_offset][section_number].push_back(Entry);
       }
           
 
   }
 
-  TypeIDNames[TypeId] = total_offset;
+  Ctx->TypeIDNames[LayoutId] = total_offset;
 
 
   for (auto &entries : flattenedLayout) {
-    AllocationPointsTypeInfo[TypeId].insert(std::make_pair((uint32_t)entries.second->offset, *(entries.second)));
+    Ctx->AllocationPointsTypeInfo[LayoutId].insert(std::make_pair((uint32_t)entries.second->offset, *(entries.second)));
   }
   
 
   std::stringstream dump;
 
   dump << "FILENAME " <<  M.getSourceFileName() << "\n";
-  dump << "APSIZE " << std::to_string(AllocationPointsTypeInfo[TypeId].size()) << "\n";
+  dump << "APSIZE " << std::to_string(Ctx->AllocationPointsTypeInfo[LayoutId].size()) << "\n";
 
-  auto di_itr = AllocationPointsTypeInfo.find(TypeId);
+  auto di_itr = Ctx->AllocationPointsTypeInfo.find(LayoutId);
   for (auto &entries : di_itr->second) {
 
-    LayoutEntry lEntry = entries.second;
+    const LayoutEntry &lEntry = entries.second;
     assert(!lEntry.deleted);
     assert(entries.first == lEntry.offset);
             
 
-    bool isVirutalTableType = false;
-    llvm::DITypeRef  VptrDerivedTy;
-    llvm::DIType *VptrTy = nullptr;
-    llvm::DIType *VptrTableTy = nullptr;
-    llvm::DISubroutineType *VptrSubroutine = nullptr;
-    for (auto &par : lEntry.TyCheDependencyTree)
-    {
-      if (isVPtrType(par))
-      {
-          isVirutalTableType = true;
-          llvm::DIDerivedType * type = llvm::dyn_cast<llvm::DIDerivedType>(par);
-
-          VptrDerivedTy = type->getBaseType();
-          VptrTy = VptrDerivedTy.resolve();
-          VptrTableTy = getPointeeType(VptrTy);
-          VptrTy = getPointeeType(VptrTableTy);
-
-          VptrSubroutine = llvm::dyn_cast<llvm::DISubroutineType>(VptrTy);
-          if (VptrSubroutine == nullptr) llvm_unreachable("Null FuncTy is found!\n");
-
-      }
-    }
+    bool isVirutalTableType = isVirtualTableEntry(lEntry);
 
 
     dump << "OFFSET " << lEntry.offset << "\n" << 
@@ -1563,34 +2662,18 @@ static int64_t compileLayoutToFlattenLayoutForTyChe(llvm::Module &M,
             "LB " << lEntry.offset + lEntry.lb << "\n" << 
             "UB " << lEntry.offset + lEntry.ub << "\n" << 
             "FAM " << (lEntry.tyche_entry.FAM ? "Y" : "N") << "\n" <<
-            "NAME " << lEntry.humanName << "\n" <<
+            "NAME " << lEntry.humanName.data() << "\n" <<
             "VPTR " << (isVirutalTableType ? "Y" : "N") << "\n";
 
               
     if (lEntry.type == nullptr) llvm_unreachable("null DIType found!\n");
     
-    // a simple workaround for now!
-    {
-      std::error_code EC;
-      llvm::raw_fd_ostream file ("temp.txt", EC, llvm::sys::fs::OpenFlags::F_RW);
-      lEntry.type->print(file);
-      file.close();
-      std::ifstream t("temp.txt");
-      std::stringstream buffer;
-      buffer << t.rdbuf();
-      dump << "METATYPE " << buffer.str() << "\n" ;
-    }
-    
+    dump << "METATYPE " << internTypeString(lEntry.type) << "\n";
+
     if (lEntry.tyche_entry.Parent != nullptr) 
     {
-      std::error_code EC;
-      llvm::raw_fd_ostream file ("temp.txt", EC, llvm::sys::fs::OpenFlags::F_RW);
-      lEntry.tyche_entry.Parent->print(file);
-      file.close();
-      std::ifstream t("temp.txt");
-      std::stringstream buffer;
-      buffer << t.rdbuf();
-      dump << "PARENTTYPE " << buffer.str() << "\n" ;
+      dump << "PARENTTYPE " << internTypeString(lEntry.tyche_entry.Parent)
+           << "\n";
     }
     else 
     {
@@ -1603,319 +2686,400 @@ static int64_t compileLayoutToFlattenLayoutForTyChe(llvm::Module &M,
   
 
   
-  TypeIDCache.insert(std::make_pair(TypeId, dump.str()));
-
-  TypeId++;
-  assert(TypeId < TYCHE_NUMBER_OF_TYPES);
+  Ctx->TypeIDCache.insert(std::make_pair(LayoutId, dump.str()));
 
-  return int64_t(TypeId-1);
+  if (!option_canonical_type_ids)
+    nextTyCheTypeID(Ctx->TypeId);
+  return int64_t(LayoutId);
   
 
 }
 
 
-static llvm::Constant* getTyCheMeta(llvm::Module &M, uint64_t tid, llvm::ArrayType* &tyche_cl_meta_type)
+/*
+ * Add a compiled type layout to the allocation point database.  The type is
+ * keyed by its TypeEntry::type_id, which is the ID the allocation sites
+ * refer to.
+ */
+static void addTyCheDBType(llvm::Module &M, uint64_t tid, int64_t layoutID,
+                           const HashVal &hash, const std::string &humanName) {
+  std::vector<llvm::tyche::DBField> fields;
+  for (auto &entries : Ctx->AllocationPointsTypeInfo[layoutID]) {
+    const LayoutEntry &lEntry = entries.second;
+    llvm::tyche::DBField field;
+    memset(&field, 0, sizeof(field));
+    field.Offset = lEntry.offset;
+    field.LB = lEntry.offset + lEntry.lb;
+    field.UB = lEntry.offset + lEntry.ub;
+    field.Name = Ctx->APDatabase.addString(lEntry.humanName);
+    field.MetaType =
+        Ctx->APDatabase.addString(Ctx->TypeStrings[internTypeString(lEntry.type)]);
+    if (lEntry.tyche_entry.Parent != nullptr)
+      field.ParentType = Ctx->APDatabase.addString(
+          Ctx->TypeStrings[internTypeString(lEntry.tyche_entry.Parent)]);
+    field.Flags = 0;
+    if (lEntry.coerced)
+      field.Flags |= llvm::tyche::DBFieldCoerced;
+    if (lEntry.tyche_entry.FAM)
+      field.Flags |= llvm::tyche::DBFieldFAM;
+    if (isVirtualTableEntry(lEntry))
+      field.Flags |= llvm::tyche::DBFieldVPtr;
+    fields.push_back(field);
+  }
+
+  llvm::tyche::DBType type;
+  memset(&type, 0, sizeof(type));
+  type.ID = tid;
+  type.Hash[0] = hash.i64[0];
+  type.Hash[1] = hash.i64[1];
+  type.Name = Ctx->APDatabase.addString(humanName);
+  type.File = Ctx->APDatabase.addString(M.getSourceFileName());
+  Ctx->APDatabase.addType(type, fields);
+}
+
+
+/*
+ * Emit the TyChe meta-data of the compiled layout `tid' in the sparse format
+ * (see TYCHE_SPARSE_META in effective.h).  Only the populated cachelines are
+ * emitted: those of section `sec' go into tyche_symbols_section_<sec>, and
+ * each one points to the next section's cacheline of the same offset bucket.
+ * The bucket index goes into tyche_symbols_index.  Returns a pointer to the
+ * index.
+ */
+static llvm::Constant *getTyCheMeta(llvm::Module &M, uint64_t tid)
 {
       llvm::LLVMContext &Cxt = M.getContext();
-      
-      
+
       // Step 1: Sanity Check
+      auto i = Ctx->TyCheMetaCacheLinesSections.find(tid);
+      assert(i != Ctx->TyCheMetaCacheLinesSections.end());
+      auto &Buckets = i->second;
+      assert(!Buckets.empty());
       double avg_num_req_sections = 0;
       uint64_t num_of_elements = 0;
-      assert(TyCheMetaCacheLinesSections.find(tid) != TyCheMetaCacheLinesSections.end());
       #ifdef TYCHE_LAYOUT_DEBUG
         fprintf(stderr, "TID(%zu)= ", tid);
       #endif
-      for (size_t offset = 0; offset < TyCheMetaCacheLinesSections[tid].size(); offset++)
+      for (auto &bucket : Buckets)
       {
-          
-          assert(TyCheMetaCacheLinesSections[tid].find(offset) != TyCheMetaCacheLinesSections[tid].end());
-          avg_num_req_sections +=  TyCheMetaCacheLinesSections[tid][offset].size();
+          avg_num_req_sections += bucket.second.size();
           #ifdef TYCHE_LAYOUT_DEBUG
-            fprintf(stderr, "%zu", offset * TYCHE_OFFSETS_DEVIDER);
-            fprintf(stderr, "[%zu]", TyCheMetaCacheLinesSections[tid][offset].size());
+            fprintf(stderr, "%zu", bucket.first * TYCHE_OFFSETS_DEVIDER);
+            fprintf(stderr, "[%zu]", bucket.second.size());
           #endif
-          for (size_t section = 0; section < TyCheMetaCacheLinesSections[tid][offset].size(); section++)
+          for (size_t section = 0; section < bucket.second.size(); section++)
           {
-            assert(TyCheMetaCacheLinesSections[tid][offset].find(section) != TyCheMetaCacheLinesSections[tid][offset].end());
-            assert(TyCheMetaCacheLinesSections[tid][offset][section].size() <= NUMBER_OF_ENTRIES_IN_EACH_CACHELINE);
-            num_of_elements += TyCheMetaCacheLinesSections[tid][offset][section].size();
+            assert(bucket.second.find(section) != bucket.second.end());
+            assert(bucket.second[section].size() <= NUMBER_OF_ENTRIES_IN_EACH_CACHELINE);
+            num_of_elements += bucket.second[section].size();
             #ifdef TYCHE_LAYOUT_DEBUG
-              fprintf(stderr, "{%zu}", TyCheMetaCacheLinesSections[tid][offset][section].size());
+              fprintf(stderr, "{%zu}", bucket.second[section].size());
             #endif
           }
           #ifdef TYCHE_LAYOUT_DEBUG
             fprintf(stderr, "\t");
           #endif
       }
-      avg_num_req_sections /= TyCheMetaCacheLinesSections[tid].size();
-      size_t obj_size = TyCheMetaCacheLinesSections[tid].rbegin()->first;
-      //#ifdef TYCHE_LAYOUT_DEBUG
-        fprintf(stderr, "%f %zu %zu %zu\n", avg_num_req_sections, obj_size, TypeIDNames[tid], num_of_elements);
-      //#endif
-        
-      
-
-  
-      // Step 2: Creat a linked list of cachelines for the same offsets and store them into Sections
-      std::vector<std::vector<std::vector<llvm::Constant *>>> SectionEntries(TYCHE_NUMBER_OF_SECTIONS);
-      std::vector<std::vector<bool>> SectionStates(TYCHE_NUMBER_OF_SECTIONS);
-
-
-      assert(TyCheMetaCacheLinesSections.find(tid) != TyCheMetaCacheLinesSections.end());
+      avg_num_req_sections /= Buckets.size();
+      size_t num_buckets = Buckets.rbegin()->first + 1;
+      assert(num_buckets <= TYCHE_NUMBER_OF_OFFSETS());
+      #ifdef TYCHE_LAYOUT_DEBUG
+        fprintf(stderr, "%f %zu %zu %zu\n", avg_num_req_sections, num_buckets - 1, Ctx->TypeIDNames[tid], num_of_elements);
+      #endif
 
-      for (size_t offset = 0; offset < TyCheMetaCacheLinesSections[tid].size(); offset++)
+      // Step 2: Pad the populated cachelines and give each one its position
+      // within its section.
+      std::vector<std::vector<uint64_t>> SectionBuckets(TYCHE_NUMBER_OF_SECTIONS);
+      std::map<uint64_t, std::vector<uint64_t>> Positions;
+      for (auto &bucket : Buckets)
       {
-
-        assert(TyCheMetaCacheLinesSections[tid].find(offset) != TyCheMetaCacheLinesSections[tid].end());
-  
-        //llvm::Constant * PrevSectionTyCheCacheLineGV = nullptr;
-        assert(TyCheMetaCacheLinesSections[tid][offset].size() > 0);
-        for (int section = (int)TyCheMetaCacheLinesSections[tid][offset].size() - 1; section >= 0 ; section--)
-        {
-          assert(TyCheMetaCacheLinesSections[tid][offset].find(section) != TyCheMetaCacheLinesSections[tid][offset].end());
-          assert(TyCheMetaCacheLinesSections[tid][offset][section].size() <= NUMBER_OF_ENTRIES_IN_EACH_CACHELINE);
-          assert(TyCheMetaCacheLinesSections[tid][offset][section].size() > 0);
-          #ifdef TYCHE_LAYOUT_DEBUG
-            fprintf(stderr, "SECTION[%zu] OFFSET[%zu] = TID(%zu) Size(%zu) <== Filled (%d)\n", section, offset, tid, TyCheMetaCacheLinesSections[tid][offset][section].size(), SectionStates[section][offset]);
-          #endif
-          // fill the remaning blocks with null entries
-          while (TyCheMetaCacheLinesSections[tid][offset][section].size() < NUMBER_OF_ENTRIES_IN_EACH_CACHELINE)
-          {
-            llvm::Constant *Entry =  llvm::ConstantInt::get(llvm::Type::getInt32Ty(Cxt), -1);
-            TyCheMetaCacheLinesSections[tid][offset][section].push_back(Entry);
-          }
-
-          assert(TyCheMetaCacheLinesSections[tid][offset][section].size() == NUMBER_OF_ENTRIES_IN_EACH_CACHELINE);
-          SectionEntries[section].push_back(TyCheMetaCacheLinesSections[tid][offset][section]);
-          
-          // // if this is the last section, add a nullptr to it struct
-          if (section == (int)TyCheMetaCacheLinesSections[tid][offset].size() - 1)
-          {
-              SectionStates[section].push_back(false);
-          }
-          else 
-          {
-              SectionStates[section].push_back(true);
-          }
-
-          // assert(TyCheMetaCacheLinesSections[tid][offset][section].size() == (NUMBER_OF_ENTRIES_IN_EACH_CACHELINE + 1));
-
-          
-
-        }
-
-        // fill empty sections with nullptr in order to keep cachelines in the same Meta Cache set
-        for (size_t section = TyCheMetaCacheLinesSections[tid][offset].size(); section < TYCHE_NUMBER_OF_SECTIONS; section++)
-        {
-
-          assert(TyCheMetaCacheLinesSections[tid][offset].find(section) == TyCheMetaCacheLinesSections[tid][offset].end());
-          std::vector<llvm::Constant*> cacheline;
-          #ifdef TYCHE_LAYOUT_DEBUG
-            fprintf(stderr, "SECTION[%zu] OFFSET[%zu] = TID(%zu) Size(%zu) <== Empty (%d)\n", section, offset, tid, cacheline.size(), SectionStates[section][offset] );
-          #endif
-
-          while (cacheline.size() < NUMBER_OF_ENTRIES_IN_EACH_CACHELINE)
+          for (size_t section = 0; section < bucket.second.size(); section++)
           {
-            llvm::Constant *Entry =  llvm::ConstantInt::get(llvm::Type::getInt32Ty(Cxt), -1);
-            cacheline.push_back(Entry);
+            auto &cacheline = bucket.second[section];
+            assert(cacheline.size() > 0);
+            while (cacheline.size() < NUMBER_OF_ENTRIES_IN_EACH_CACHELINE)
+            {
+              llvm::Constant *Entry =  llvm::ConstantInt::get(llvm::Type::getInt32Ty(Cxt), -1);
+              cacheline.push_back(Entry);
+            }
+            Positions[bucket.first].push_back(SectionBuckets[section].size());
+            SectionBuckets[section].push_back(bucket.first);
           }
+      }
 
-          assert(cacheline.size() == NUMBER_OF_ENTRIES_IN_EACH_CACHELINE);
-          SectionEntries[section].push_back(cacheline);
-          SectionStates[section].push_back(false);
-
-        }        
-
-      } // end of offset
-
-      
-      #ifdef TYCHE_LAYOUT_DEBUG
-        fprintf(stderr, "------------------------------------------------------------------------------------------\n" );
-      #endif    
-
-
-      // Final Step: Emit array of cachelines for this TID into their respective sessions
-      assert(SectionEntries.size() == TYCHE_NUMBER_OF_SECTIONS);
-      llvm::Constant *TyCheSection_0 = nullptr;
-      llvm::GlobalVariable * PrevSectionTyCheCacheLineGV = nullptr;
-      llvm::ArrayType * PrevSectionTyCheCacheLineType = nullptr;
-      for (int sec = (int)SectionEntries.size() -1; sec >= 0; sec--)
+      // Step 3: Emit the cachelines of each section, last section first so
+      // that the next pointers can refer to the following section.
+      size_t num_lines = 0;
+      llvm::GlobalVariable *NextSectionGV = nullptr;
+      llvm::ArrayType *NextSectionTy = nullptr;
+      for (int sec = TYCHE_NUMBER_OF_SECTIONS - 1; sec >= 0; sec--)
       {
-          assert(SectionEntries[sec].size() <= TYCHE_NUMBER_OF_OFFSETS());
-          // last section
-          if (sec ==  SectionEntries.size() -1)
-          {
-              
-              // for the last section all the pointers are always null 
-              std::vector<llvm::Constant*> SectionConstants;
-              for (size_t off = 0; off < SectionEntries[sec].size(); off++)
-              {
-                  #ifdef TYCHE_LAYOUT_DEBUG
-                    fprintf(stderr, "SectionState[%zu][%zu]: %d (False)\n", sec, off, SectionStates[sec][off]);
-                  #endif
-                  assert(SectionEntries[sec][off].size() == NUMBER_OF_ENTRIES_IN_EACH_CACHELINE);
-                  llvm::StructType * TyCheTy =  makeTyCheCacheLineType(M, int64_t(tid), off, sec);
-                  llvm::Constant *Entry =  llvm::ConstantPointerNull::get(TyCheTy->getPointerTo());
-                  SectionEntries[sec][off].push_back(Entry);
-
-                  llvm::Constant *TyCheCacheLineInit = llvm::ConstantStruct::get(TyCheTy, SectionEntries[sec][off]);
-                  SectionConstants.push_back(TyCheCacheLineInit);
-              }
-              
-
-              // now make the section array and Global Variable
-              #ifdef TYCHE_LAYOUT_DEBUG
-                fprintf(stderr, "SectionEntries Size: %zu\n", SectionConstants.size());
-              #endif
-              llvm::ArrayType *TyCheSectionLayoutTy = llvm::ArrayType::get(TyCheCacheLineEntryTy, SectionConstants.size());
-              llvm::Constant *SectionArrayEntry = llvm::ConstantArray::get(TyCheSectionLayoutTy, SectionConstants);
-              // now we have an array of all cachelines in a section, creat the global variable and insert it into the module
-              std::string meta_gv_name = "TYCHE_META_SECTION_TID_" + std::to_string(tid) /*+ "_" + std::to_string(sec)*/;
-              std::string meta_section_name = "tyche_symbols_section_" + std::to_string(sec);
-              llvm::GlobalVariable *TyCheSectionMetaGV = new llvm::GlobalVariable(M, TyCheSectionLayoutTy, true, llvm::GlobalValue::WeakAnyLinkage, 0, meta_gv_name);
-              TyCheSectionMetaGV->setInitializer(SectionArrayEntry);
-              TyCheSectionMetaGV->setSection(meta_section_name);
-              TyCheSectionMetaGV->setAlignment(64);
-              PrevSectionTyCheCacheLineGV = TyCheSectionMetaGV;
-              PrevSectionTyCheCacheLineType = TyCheSectionLayoutTy;
-
-          }
-          else 
+          if (SectionBuckets[sec].empty())
+            continue;
+          std::vector<llvm::Constant*> SectionConstants;
+          for (uint64_t bucket : SectionBuckets[sec])
           {
-              assert(PrevSectionTyCheCacheLineGV != nullptr);
-              std::vector<llvm::Constant*> SectionConstants;
-              for (size_t off = 0; off < SectionEntries[sec].size(); off++)
+              std::vector<llvm::Constant*> Elems(Buckets[bucket][sec]);
+              assert(Elems.size() == NUMBER_OF_ENTRIES_IN_EACH_CACHELINE);
+              if (Positions[bucket].size() > (size_t)sec + 1)
               {
-                  
-                  if (SectionStates[sec][off])
-                  {
-                    #ifdef TYCHE_LAYOUT_DEBUG
-                      fprintf(stderr, "SectionState[%zu][%zu]: %d (True)\n", sec, off, SectionStates[sec][off]);
-                    #endif
-                      assert(SectionEntries[sec][off].size() == NUMBER_OF_ENTRIES_IN_EACH_CACHELINE);
-                      llvm::StructType * TyCheTy =  makeTyCheCacheLineType(M, int64_t(tid), off, sec);
-                      llvm::Constant * Entry = llvm::ConstantExpr::getBitCast(PrevSectionTyCheCacheLineGV, PrevSectionTyCheCacheLineType->getPointerTo());
-                      SectionEntries[sec][off].push_back(Entry);
-
-                      llvm::Constant *TyCheCacheLineInit = llvm::ConstantStruct::get(TyCheTy, SectionEntries[sec][off]);
-                      SectionConstants.push_back(TyCheCacheLineInit);       
-                  }
-                  else 
-                  {
-                    #ifdef TYCHE_LAYOUT_DEBUG
-                      fprintf(stderr, "SectionState[%zu][%zu]: %d (False)\n", sec, off, SectionStates[sec][off]);
-                    #endif
-                      assert(SectionEntries[sec][off].size() == NUMBER_OF_ENTRIES_IN_EACH_CACHELINE);
-                      llvm::StructType * TyCheTy =  makeTyCheCacheLineType(M, int64_t(tid), off, sec);
-                      llvm::Constant *Entry =  llvm::ConstantPointerNull::get(TyCheTy->getPointerTo());
-                      SectionEntries[sec][off].push_back(Entry);
-
-                      llvm::Constant *TyCheCacheLineInit = llvm::ConstantStruct::get(TyCheTy, SectionEntries[sec][off]);
-                      SectionConstants.push_back(TyCheCacheLineInit);                    
-                  }
+                  llvm::Constant *Idxs[] = {
+                      llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt), 0),
+                      llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt),
+                                             Positions[bucket][sec + 1])};
+                  Elems.push_back(llvm::ConstantExpr::getInBoundsGetElementPtr(
+                      NextSectionTy, NextSectionGV, Idxs));
               }
+              else
+                  Elems.push_back(llvm::ConstantPointerNull::get(Ctx->TyCheCacheLineEntryTy->getPointerTo()));
+              SectionConstants.push_back(llvm::ConstantStruct::get(Ctx->TyCheCacheLineEntryTy, Elems));
+          }
+          num_lines += SectionConstants.size();
 
-              // now make the section array and Global Variable
-              #ifdef TYCHE_LAYOUT_DEBUG
-                fprintf(stderr, "SectionEntries Size: %zu\n", SectionConstants.size());
-              #endif
-              llvm::ArrayType *TyCheSectionLayoutTy = llvm::ArrayType::get(TyCheCacheLineEntryTy, SectionConstants.size());
-              llvm::Constant *SectionArrayEntry = llvm::ConstantArray::get(TyCheSectionLayoutTy, SectionConstants);
-              // now we have an array of all cachelines in a section, creat the global variable and insert it into the module
-              std::string meta_gv_name = "TYCHE_META_SECTION_TID_" + std::to_string(tid) + "_SEC_" + std::to_string(sec) + "_FILE_" + M.getSourceFileName();
-              #ifdef TYCHE_LAYOUT_DEBUG
-                fprintf(stderr, "Global Variable Name: %s\n", meta_gv_name.c_str());
-              #endif
-              std::string meta_section_name = "tyche_symbols_section_" + std::to_string(sec);
-              llvm::GlobalVariable *TyCheSectionMetaGV = new llvm::GlobalVariable(M, TyCheSectionLayoutTy, true, llvm::GlobalValue::WeakAnyLinkage, 0, meta_gv_name);
-              TyCheSectionMetaGV->setInitializer(SectionArrayEntry);
-              TyCheSectionMetaGV->setSection(meta_section_name);
-              TyCheSectionMetaGV->setAlignment(64);
-
-              PrevSectionTyCheCacheLineGV = TyCheSectionMetaGV;
-              PrevSectionTyCheCacheLineType = TyCheSectionLayoutTy;
-
-              if (sec == 0) {
-                #ifdef TYCHE_LAYOUT_DEBUG
-                  fprintf(stderr, "Returning Section %zu!\n", sec);
-                #endif
-                tyche_cl_meta_type = TyCheSectionLayoutTy; // a pointer to array?
-                TyCheSection_0 = llvm::ConstantExpr::getBitCast(TyCheSectionMetaGV, TyCheSectionLayoutTy->getPointerTo());
-              }
-          }
-
-
-      }
-
-
-      // return the section 0 ptr
-      assert(tyche_cl_meta_type != nullptr);
-      return  TyCheSection_0;
-
-}
-
-static void emitTyCheMetadata(llvm::Module &M)
-{
-
-      llvm::LLVMContext &Cxt = M.getContext();
-
-      //sanity check
-      // all sections should have the same size and entries shouldn't be nullptr
-      assert(TyCheSectionsEntries[0].size() != 0);
-      for (int sec = 0; sec < TYCHE_NUMBER_OF_SECTIONS; sec++)
-      {
-        assert(TyCheSectionsEntries[sec].size() == TyCheSectionsEntries[0].size());
-        for (int i = 0; i < TyCheSectionsEntries[sec].size(); i++)
-        {
-          assert(TyCheSectionsEntries[sec][i] != nullptr);
-        }
-      }
-
-
-      // Final Step: Emit array of cachelines into their respective sessions
-      assert(TyCheSectionsEntries.size() == TYCHE_NUMBER_OF_SECTIONS);
-      for (size_t sec = 0; sec < TyCheSectionsEntries.size(); sec++)
-      {
-          assert(TyCheSectionsEntries[sec].size() <= TYCHE_NUMBER_OF_OFFSETS());
+          llvm::ArrayType *TyCheSectionLayoutTy = llvm::ArrayType::get(Ctx->TyCheCacheLineEntryTy, SectionConstants.size());
+          llvm::Constant *SectionArrayEntry = llvm::ConstantArray::get(TyCheSectionLayoutTy, SectionConstants);
+          std::string meta_gv_name = "TYCHE_META_SECTION_TID_" + std::to_string(tid) + "_SEC_" + std::to_string(sec) + getTyCheGlobalSuffix(M);
           #ifdef TYCHE_LAYOUT_DEBUG
-            fprintf(stderr, "TyCheSectionsEntries Size: %zu\n", TyCheSectionsEntries[sec].size());
+            fprintf(stderr, "Global Variable Name: %s (%zu cachelines)\n", meta_gv_name.c_str(), SectionConstants.size());
           #endif
-          llvm::ArrayType *TyCheSectionLayoutTy = llvm::ArrayType::get(TyCheCacheLineEntryTy, TyCheSectionsEntries[sec].size());
-          llvm::Constant *SectionArrayEntry = llvm::ConstantArray::get(TyCheSectionLayoutTy, TyCheSectionsEntries[sec]);
-          // now we have an array of all cachelines in a section, creat the global variable and insert it into the module
-          std::string meta_gv_name = "TYCHE_META_SECTION_" + std::to_string(sec);
           std::string meta_section_name = "tyche_symbols_section_" + std::to_string(sec);
           llvm::GlobalVariable *TyCheSectionMetaGV = new llvm::GlobalVariable(M, TyCheSectionLayoutTy, true, llvm::GlobalValue::WeakAnyLinkage, 0, meta_gv_name);
           TyCheSectionMetaGV->setInitializer(SectionArrayEntry);
           TyCheSectionMetaGV->setSection(meta_section_name);
           TyCheSectionMetaGV->setAlignment(64);
+          NextSectionGV = TyCheSectionMetaGV;
+          NextSectionTy = TyCheSectionLayoutTy;
+      }
+
+      // Final Step: Emit the bucket index, pointing at the section 0 array.
+      assert(NextSectionGV != nullptr && SectionBuckets[0].size() == Buckets.size());
+      std::vector<llvm::Constant*> BucketIndex(num_buckets,
+          llvm::ConstantInt::get(llvm::Type::getInt16Ty(Cxt), TYCHE_EMPTY_BUCKET));
+      for (auto &bucket : Positions)
+        BucketIndex[bucket.first] = llvm::ConstantInt::get(llvm::Type::getInt16Ty(Cxt), bucket.second[0]);
+      llvm::ArrayType *BucketIndexTy = llvm::ArrayType::get(llvm::Type::getInt16Ty(Cxt), num_buckets);
+      llvm::StructType *TyCheIndexTy = llvm::StructType::get(
+          Ctx->TyCheCacheLineEntryTy->getPointerTo(), llvm::Type::getInt32Ty(Cxt),
+          BucketIndexTy, nullptr);
+      llvm::Constant *Lines = llvm::ConstantExpr::getBitCast(NextSectionGV, Ctx->TyCheCacheLineEntryTy->getPointerTo());
+      llvm::Constant *IndexInit = llvm::ConstantStruct::get(TyCheIndexTy,
+          Lines, llvm::ConstantInt::get(llvm::Type::getInt32Ty(Cxt), num_buckets),
+          llvm::ConstantArray::get(BucketIndexTy, BucketIndex), nullptr);
+      std::string index_gv_name = "TYCHE_META_INDEX_TID_" + std::to_string(tid) + getTyCheGlobalSuffix(M);
+      llvm::GlobalVariable *TyCheIndexGV = new llvm::GlobalVariable(M, TyCheIndexTy, true, llvm::GlobalValue::WeakAnyLinkage, IndexInit, index_gv_name);
+      TyCheIndexGV->setSection("tyche_symbols_index");
+      TyCheIndexGV->setAlignment(64);
+
+      // Account for the space saved over the dense encoding, which had one
+      // cacheline per bucket up to the last populated one in every section.
+      // Every global is 64-byte aligned, so round the index up.
+      uint64_t index_bytes = llvm::alignTo(
+          M.getDataLayout().getTypeAllocSize(TyCheIndexTy), 64);
+      Ctx->APDatabase.addMetaBytes(num_lines * 64 + index_bytes,
+                              num_buckets * TYCHE_NUMBER_OF_SECTIONS * 64);
+
+      return llvm::ConstantExpr::getBitCast(TyCheIndexGV, Ctx->TyCheSparseMetaTy->getPointerTo());
+}
+
+/*
+ * Compute the final hashes of the layout entries under `hval'.  Entries with
+ * the same hash are the same (type, offset) query, so only one of them
+ * (preferably a "priority" one) can be found by a lookup and the others are
+ * left out.
+ */
+static void collectLayoutEntries(std::map<uint64_t, LayoutEntry *> &entries,
+                                 uint64_t hval, LayoutInfo &layout) {
+  for (auto &layoutEntry : layout) {
+    LayoutEntry &lEntry = layoutEntry.second;
+    if (lEntry.deleted)
+      continue;
+    lEntry.finalHash = EFFECTIVE_HASH(hval, lEntry.hash, layoutEntry.first);
+    auto i = entries.insert(std::make_pair(lEntry.finalHash, &lEntry));
+    if (!i.second && lEntry.priority && !i.first->second->priority)
+      i.first->second = &lEntry;
+  }
+}
+
+/*
+ * Build an EFFECTIVE_LAYOUT_PERFECT layout (see effective.h) by
+ * hash-and-displace: the entries are grouped by displacement, and the groups
+ * are placed largest first, each with the first displacement that puts all of
+ * its entries into free slots.  Fails if some group cannot be placed, in
+ * which case the caller tries another hash value like for collisions in
+ * placeFlattenedLayoutEntry().
+ */
+static bool buildPerfectLayout(FlattenedLayoutInfo &flattenedLayout,
+                               std::vector<uint16_t> &disp, uint64_t hval,
+                               size_t layoutLen, LayoutInfo &layout) {
+  uint64_t mask = layoutLen - 1;
+  size_t dispMask = mask >> EFFECTIVE_PERFECT_DISP_SHIFT;
+  std::map<uint64_t, LayoutEntry *> entries;
+  collectLayoutEntries(entries, hval, layout);
+
+  std::vector<std::vector<LayoutEntry *>> groups(dispMask + 1);
+  for (auto &entry : entries)
+    groups[(entry.first >> 32) & dispMask].push_back(entry.second);
+  std::vector<size_t> order(groups.size());
+  for (size_t i = 0; i < order.size(); i++)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&groups](size_t a, size_t b) {
+    return groups[a].size() > groups[b].size();
+  });
+
+  disp.assign(groups.size(), 0);
+  std::vector<bool> used(layoutLen, false);
+  std::vector<size_t> slots;
+  for (size_t g : order) {
+    auto &group = groups[g];
+    if (group.empty())
+      break;
+    bool placed = false;
+    for (size_t d = 0; !placed && d <= UINT16_MAX; d++) {
+      slots.clear();
+      placed = true;
+      for (LayoutEntry *lEntry : group) {
+        size_t slot = EFFECTIVE_PERFECT_SLOT(lEntry->finalHash, d, mask);
+        if (used[slot] ||
+            std::find(slots.begin(), slots.end(), slot) != slots.end()) {
+          placed = false;
+          break;
+        }
+        slots.push_back(slot);
       }
+      if (placed)
+        disp[g] = (uint16_t)d;
+    }
+    if (!placed)
+      return false;
+    for (size_t i = 0; i < group.size(); i++) {
+      used[slots[i]] = true;
+      flattenedLayout.insert(std::make_pair(slots[i], group[i]));
+    }
+  }
+  return true;
+}
+
+/*
+ * Build an EFFECTIVE_LAYOUT_GROUPED layout (see effective.h).  Each entry
+ * takes the first free slot of its home group, or of the next group with a
+ * free slot.  "Priority" entries are placed first so that they stay in their
+ * home group.  Fails if an entry would be more than EFFECTIVE_MAX_PROBE
+ * groups from home, or if a lookup could scan more than EFFECTIVE_MAX_PROBE
+ * full groups, in which case the caller tries another hash value.
+ */
+static bool buildGroupedLayout(FlattenedLayoutInfo &flattenedLayout,
+                               std::vector<uint8_t> &tags, uint64_t hval,
+                               size_t layoutLen, LayoutInfo &layout) {
+  uint64_t mask = layoutLen - 1;
+  size_t numGroups = layoutLen / EFFECTIVE_GROUP_SIZE;
+  std::map<uint64_t, LayoutEntry *> entries;
+  collectLayoutEntries(entries, hval, layout);
+
+  std::vector<LayoutEntry *> order;
+  for (auto &entry : entries)
+    order.push_back(entry.second);
+  std::stable_sort(order.begin(), order.end(),
+                   [](const LayoutEntry *a, const LayoutEntry *b) {
+                     return a->priority && !b->priority;
+                   });
+
+  tags.assign(layoutLen, EFFECTIVE_GROUP_EMPTY);
+  std::vector<size_t> used(numGroups, 0);
+  for (LayoutEntry *lEntry : order) {
+    size_t g = EFFECTIVE_GROUP_HOME(lEntry->finalHash, mask);
+    size_t i;
+    for (i = 0; i < EFFECTIVE_MAX_PROBE && used[g] == EFFECTIVE_GROUP_SIZE;
+         i++)
+      g = (g + 1) % numGroups;
+    if (i >= EFFECTIVE_MAX_PROBE || used[g] == EFFECTIVE_GROUP_SIZE)
+      return false;
+    size_t slot = g * EFFECTIVE_GROUP_SIZE + used[g]++;
+    tags[slot] = EFFECTIVE_GROUP_TAG(lEntry->finalHash);
+    flattenedLayout.insert(std::make_pair(slot, lEntry));
+  }
+
+  size_t run = 0;
+  for (size_t i = 0; i < 2 * numGroups; i++) {
+    run = (used[i % numGroups] == EFFECTIVE_GROUP_SIZE ? run + 1 : 0);
+    if (run >= EFFECTIVE_MAX_PROBE)
+      return false;
+  }
+  return true;
+}
+
+/*
+ * Build the EFFECTIVE_ENTRY of a layout entry.
+ */
+static llvm::Constant *buildLayoutEntry(llvm::Module &M,
+                                        const LayoutEntry &lEntry) {
+  llvm::LLVMContext &Cxt = M.getContext();
+  std::vector<llvm::Constant *> Elems;
+  Elems.push_back(llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt), lEntry.finalHash));
+  Elems.push_back(llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt), 0));
+  Elems.push_back(llvm::ConstantVector::get(
+      {llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt), lEntry.lb),
+       llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt), lEntry.ub)}));
+  return llvm::ConstantStruct::get(Ctx->EntryTy, Elems);
+}
 
+/*
+ * Build the EFFECTIVE_ENTRY_COLD of a layout entry.
+ */
+static llvm::Constant *buildLayoutColdEntry(llvm::Module &M,
+                                            const LayoutEntry &lEntry) {
+  llvm::LLVMContext &Cxt = M.getContext();
+  std::vector<llvm::Constant *> Elems;
 
+  llvm::Constant *TypeEntryNameInit = llvm::ConstantDataArray::getString(Cxt, lEntry.humanName);
+  std::string type_entry_gv_name = "TYCHE_TYPE_ENTRY_" + lEntry.humanName.str() + "_" + std::to_string(lEntry.finalHash) + "_FILE_" + M.getSourceFileName();
+
+  // assert(M.getGlobalVariable(type_entry_gv_name) == nullptr);
+  llvm::GlobalVariable *TypeEntryNameGV = new llvm::GlobalVariable(
+    M, TypeEntryNameInit->getType(), true, llvm::GlobalValue::PrivateLinkage, TypeEntryNameInit, type_entry_gv_name);
+  TypeEntryNameGV->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+  llvm::Constant *TypeEntryName = llvm::ConstantExpr::getPointerCast(TypeEntryNameGV, llvm::Type::getInt8PtrTy(Cxt));
+  Elems.push_back(TypeEntryName);
+  Elems.push_back(llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt), lEntry.offset));
+  return llvm::ConstantStruct::get(Ctx->ColdEntryTy, Elems);
 }
 
 /*
  * Compile the given layout to the low-level LLVM representation.  Note that
  * this process may fail if there are too many collisions, in which case we
- * tweak the parameters and try, try again.
+ * tweak the parameters and try, try again.  `Tail' is set to the array that
+ * follows the table: the displacements of EFFECTIVE_LAYOUT_PERFECT layouts,
+ * the tags of EFFECTIVE_LAYOUT_GROUPED layouts, and nullptr otherwise.
+ * `Cold' is set to a pointer to the EFFECTIVE_ENTRY_COLD array.
  */
 static std::pair<llvm::Constant *, size_t> compileLayout(llvm::Module &M,
                                                          uint64_t hval,
                                                          size_t layoutLen,
                                                          LayoutInfo &layout,
-                                                         int64_t &tid_number) {
+                                                         const HashVal &hash,
+                                                         int64_t &tid_number,
+                                                         llvm::Constant *&Tail,
+                                                         llvm::Constant *&Cold) {
   // Step (1): Flatten the layout:
   FlattenedLayoutInfo flattenedLayout;
+  std::vector<uint16_t> disp;
+  std::vector<uint8_t> tags;
   uint64_t mask = layoutLen - 1;
-  for (auto &entries : layout) {
-    size_t offset = entries.first;
-    LayoutEntry &lEntry = entries.second;
-    if (!placeFlattenedLayoutEntry(flattenedLayout, hval, offset, mask,
-                                   lEntry)) {
-      // We have failed to build a suitable layout (too many
-      // collisions), so try again:
+  if (option_layout_format == LAYOUT_PERFECT) {
+    if (!buildPerfectLayout(flattenedLayout, disp, hval, layoutLen, layout))
       return std::make_pair(nullptr, 0);
+  } else if (option_layout_format == LAYOUT_GROUPED) {
+    if (!buildGroupedLayout(flattenedLayout, tags, hval, layoutLen, layout))
+      return std::make_pair(nullptr, 0);
+  } else {
+    for (auto &entries : layout) {
+      size_t offset = entries.first;
+      LayoutEntry &lEntry = entries.second;
+      if (!placeFlattenedLayoutEntry(flattenedLayout, hval, offset, mask,
+                                     lEntry)) {
+        // We have failed to build a suitable layout (too many
+        // collisions), so try again:
+        return std::make_pair(nullptr, 0);
+      }
     }
   }
 
@@ -1923,7 +3087,35 @@ static std::pair<llvm::Constant *, size_t> compileLayout(llvm::Module &M,
 
 #ifdef EFFECTIVE_LAYOUT_DEBUG
   // Step (2): Verify the layout:
+  for (auto &entries : flattenedLayout) {
+    if (option_layout_format != LAYOUT_PERFECT)
+      break;
+    uint64_t hash = entries.second->finalHash;
+    uint64_t d = disp[(hash >> 32) & (mask >> EFFECTIVE_PERFECT_DISP_SHIFT)];
+    size_t idx = EFFECTIVE_PERFECT_SLOT(hash, d, mask);
+    if (idx != entries.first) {
+      fprintf(stderr,
+              "\33[31mMISPLACED ENTRY\33[0m (hash=%.16lX, idx=%zu, at=%zu)\n",
+              hash, idx, entries.first);
+      entries.second->type->dump();
+      abort();
+    }
+  }
+  for (auto &entries : flattenedLayout) {
+    if (option_layout_format != LAYOUT_GROUPED)
+      break;
+    uint64_t hash = entries.second->finalHash;
+    if (tags[entries.first] != EFFECTIVE_GROUP_TAG(hash)) {
+      fprintf(stderr,
+              "\33[31mBAD TAG\33[0m (hash=%.16lX, at=%zu)\n",
+              hash, entries.first);
+      entries.second->type->dump();
+      abort();
+    }
+  }
   for (auto &entries : layout) {
+    if (option_layout_format != LAYOUT_PROBE)
+      break;
     size_t offset = entries.first;
     LayoutEntry &lEntry = entries.second;
     uint64_t hval2 = lEntry.hash;
@@ -1944,44 +3136,50 @@ static std::pair<llvm::Constant *, size_t> compileLayout(llvm::Module &M,
   }
 #endif
 
-  tid_number = compileLayoutToFlattenLayoutForTyChe(M, flattenedLayout, "humanName");
+  tid_number = compileLayoutToFlattenLayoutForTyChe(M, flattenedLayout, "humanName", hash);
 
   // Step (3): build the LLVM representation of the array:
   llvm::LLVMContext &Cxt = M.getContext();
-  std::vector<llvm::Constant *> Entries;
-
-
-
-  for (auto entries: flattenedLayout ) {
-    const LayoutEntry &lEntry = *(entries.second);
-    #ifdef TYCHE_LAYOUT_DEBUG
-      fprintf(stderr,"ADD_TYCHE: [%zu][%s]\n",lEntry.offset, lEntry.humanName.c_str());
-    #endif
-    std::vector<llvm::Constant *> Elems;
-  
-    llvm::Constant *TypeEntryNameInit = llvm::ConstantDataArray::getString(Cxt, lEntry.humanName);
-    std::string type_entry_gv_name = "TYCHE_TYPE_ENTRY_" + lEntry.humanName + "_" + std::to_string(lEntry.finalHash) + "_FILE_" + M.getSourceFileName();
-
-    // assert(M.getGlobalVariable(type_entry_gv_name) == nullptr);
-    llvm::GlobalVariable *TypeEntryNameGV = new llvm::GlobalVariable(
-      M, TypeEntryNameInit->getType(), true, llvm::GlobalValue::PrivateLinkage, TypeEntryNameInit, type_entry_gv_name);
-    TypeEntryNameGV->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
-    llvm::Constant *TypeEntryName = llvm::ConstantExpr::getPointerCast(TypeEntryNameGV, llvm::Type::getInt8PtrTy(Cxt));
-    Elems.push_back(TypeEntryName);
-    Elems.push_back(llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt), lEntry.offset));
-    Elems.push_back(llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt), lEntry.finalHash));
-    Elems.push_back(llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt), 0));
-    Elems.push_back(llvm::ConstantVector::get(
-        {llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt), lEntry.lb),
-         llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt), lEntry.ub)}));
-    llvm::Constant *Entry = llvm::ConstantStruct::get(EntryTy, Elems);
+  std::vector<llvm::Constant *> Entries, ColdEntries;
+
+  if (option_layout_format != LAYOUT_PROBE) {
+    // Every slot is addressed directly, so the table is emitted in full and
+    // needs no terminating empty entry.
+    Entries.assign(layoutLen, Ctx->EmptyEntry);
+    ColdEntries.assign(layoutLen, Ctx->EmptyColdEntry);
+    for (auto &entries : flattenedLayout) {
+      Entries[entries.first] = buildLayoutEntry(M, *entries.second);
+      ColdEntries[entries.first] = buildLayoutColdEntry(M, *entries.second);
+    }
+    if (option_layout_format == LAYOUT_PERFECT)
+      Tail = llvm::ConstantDataArray::get(Cxt, llvm::ArrayRef<uint16_t>(disp));
+    else
+      Tail = llvm::ConstantDataArray::get(Cxt, llvm::ArrayRef<uint8_t>(tags));
+  } else {
+    for (auto entries: flattenedLayout ) {
+      const LayoutEntry &lEntry = *(entries.second);
+      #ifdef TYCHE_LAYOUT_DEBUG
+        fprintf(stderr,"ADD_TYCHE: [%zu][%s]\n",lEntry.offset, lEntry.humanName.data());
+      #endif
+      Entries.push_back(buildLayoutEntry(M, lEntry));
+      ColdEntries.push_back(buildLayoutColdEntry(M, lEntry));
+    }
 
-    Entries.push_back(Entry);
+    Entries.push_back(Ctx->EmptyEntry);
+    ColdEntries.push_back(Ctx->EmptyColdEntry);
+    Tail = nullptr;
   }
 
-  Entries.push_back(EmptyEntry);
+  llvm::ArrayType *ColdTy =
+      llvm::ArrayType::get(Ctx->ColdEntryTy, ColdEntries.size());
+  llvm::GlobalVariable *ColdGV = new llvm::GlobalVariable(
+      M, ColdTy, true, llvm::GlobalValue::PrivateLinkage,
+      llvm::ConstantArray::get(ColdTy, ColdEntries), "EFFECTIVE_LAYOUT_COLD");
+  Cold = llvm::ConstantExpr::getBitCast(ColdGV,
+                                        Ctx->ColdEntryTy->getPointerTo());
 
-  llvm::ArrayType *LayoutTy = llvm::ArrayType::get(EntryTy, Entries.size());
+  llvm::ArrayType *LayoutTy =
+      llvm::ArrayType::get(Ctx->EntryTy, Entries.size());
   llvm::Constant *Layout = llvm::ConstantArray::get(LayoutTy, Entries);
   #ifdef TYCHE_LAYOUT_DEBUG
     fprintf(stderr,"FINAL LENGTH: %zu\n", Entries.size());
@@ -1989,6 +3187,33 @@ static std::pair<llvm::Constant *, size_t> compileLayout(llvm::Module &M,
   return std::make_pair(Layout, Entries.size());
 }
 
+/*
+ * Compile the periodic inner arrays of a type to its EFFECTIVE_PERIOD list,
+ * or to null if there are none.
+ */
+static llvm::Constant *compilePeriods(llvm::Module &M,
+                                      const LayoutPeriods &periods) {
+  if (periods.empty())
+    return llvm::ConstantPointerNull::get(Ctx->PeriodTy->getPointerTo());
+  llvm::Type *Int64Ty = llvm::Type::getInt64Ty(M.getContext());
+  std::vector<llvm::Constant *> Entries;
+  for (const LayoutPeriod &period : periods)
+    Entries.push_back(llvm::ConstantStruct::get(
+        Ctx->PeriodTy,
+        {llvm::ConstantInt::get(Int64Ty, period.base),
+         llvm::ConstantInt::get(Int64Ty, period.stride * period.count),
+         llvm::ConstantInt::get(Int64Ty, period.stride),
+         llvm::ConstantInt::get(Int64Ty, EFFECTIVE_MAGIC(period.stride))}));
+  Entries.push_back(llvm::Constant::getNullValue(Ctx->PeriodTy));
+  llvm::ArrayType *PeriodsTy =
+      llvm::ArrayType::get(Ctx->PeriodTy, Entries.size());
+  llvm::GlobalVariable *PeriodsGV = new llvm::GlobalVariable(
+      M, PeriodsTy, true, llvm::GlobalValue::PrivateLinkage,
+      llvm::ConstantArray::get(PeriodsTy, Entries), "EFFECTIVE_PERIODS");
+  return llvm::ConstantExpr::getBitCast(PeriodsGV,
+                                        Ctx->PeriodTy->getPointerTo());
+}
+
 /*
  * Build a suitable name for a "composite" type, e.g., structs, classes, etc.
  * Normally, this is just the struct "tag" (i.e., the name).  This function
@@ -2230,7 +3455,7 @@ static llvm::Constant *buildTypeInfo(llvm::Module &M, llvm::DIType *Ty,
     return i->second;
 
   if (Ty == nullptr) {
-    llvm::Constant *Info  = llvm::ConstantPointerNull::get(InfoTy->getPointerTo());
+    llvm::Constant *Info  = llvm::ConstantPointerNull::get(Ctx->InfoTy->getPointerTo());
     tInfo.infos.insert(std::make_pair(Ty, Info));
     return Info;
   } else if (auto *BasicTy = llvm::dyn_cast<llvm::DIBasicType>(Ty)) {
@@ -2257,7 +3482,7 @@ static llvm::Constant *buildTypeInfo(llvm::Module &M, llvm::DIType *Ty,
       break;
     }
     if (ok) {
-      llvm::Constant *Info  = llvm::ConstantPointerNull::get(InfoTy->getPointerTo());
+      llvm::Constant *Info  = llvm::ConstantPointerNull::get(Ctx->InfoTy->getPointerTo());
       //llvm::Constant *Info = M.getOrInsertGlobal(name, InfoTy);
       tInfo.infos.insert(std::make_pair(Ty, Info));
       return Info;
@@ -2280,7 +3505,7 @@ static llvm::Constant *buildTypeInfo(llvm::Module &M, llvm::DIType *Ty,
   infoName << std::hex << hash.i64[1] << hash.i64[0];
   if (auto *InfoGV = M.getGlobalVariable(infoName.str())) {
     llvm::Constant *Info =
-        llvm::ConstantExpr::getBitCast(InfoGV, InfoTy->getPointerTo());
+        llvm::ConstantExpr::getBitCast(InfoGV, Ctx->InfoTy->getPointerTo());
     tInfo.infos.insert(std::make_pair(Ty, Info));
     return Info;
   }
@@ -2346,7 +3571,7 @@ static llvm::Constant *buildTypeInfo(llvm::Module &M, llvm::DIType *Ty,
       llvm::Constant *UB =
           llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt), ub);
       llvm::Constant *Entry =
-          llvm::ConstantStruct::get(InfoEntryTy, {Next, Flags, LB, UB});
+          llvm::ConstantStruct::get(Ctx->InfoEntryTy, {Next, Flags, LB, UB});
       Entries.push_back(Entry);
     }
   }
@@ -2363,7 +3588,7 @@ static llvm::Constant *buildTypeInfo(llvm::Module &M, llvm::DIType *Ty,
       llvm::ConstantInt::get(llvm::Type::getInt32Ty(Cxt), flags);
   llvm::Constant *Next = nullptr;
   if (fam.type == nullptr)
-    Next = llvm::ConstantPointerNull::get(InfoTy->getPointerTo());
+    Next = llvm::ConstantPointerNull::get(Ctx->InfoTy->getPointerTo());
   else {
     auto *Ty = fam.type;
     size_t size = Ty->getSizeInBits() / CHAR_BIT;
@@ -2371,13 +3596,14 @@ static llvm::Constant *buildTypeInfo(llvm::Module &M, llvm::DIType *Ty,
     Next = buildTypeInfo(M, Ty, size, NONE, false, tInfo);
   }
   llvm::ArrayType *EntriesTy =
-      llvm::ArrayType::get(InfoEntryTy, Entries.size());
+      llvm::ArrayType::get(Ctx->InfoEntryTy, Entries.size());
   llvm::Constant *Entries1 = llvm::ConstantArray::get(EntriesTy, Entries);
   llvm::Constant *InfoInit = llvm::ConstantStruct::get(
       InfoTy1, {Name, Size, NumEntries, Flags, Next, Entries1});
   InfoGV->setInitializer(InfoInit);
+  setTypeMetaComdat(M, InfoGV);
   llvm::Constant *Info =
-      llvm::ConstantExpr::getBitCast(InfoGV, InfoTy->getPointerTo());
+      llvm::ConstantExpr::getBitCast(InfoGV, Ctx->InfoTy->getPointerTo());
 
   tInfo.infos.insert(std::make_pair(Ty, Info));
 
@@ -2544,6 +3770,14 @@ static void initializeTyCheCapabilityTypes(llvm::Module &M)
 
     makeTyCheCacheLineType(M, -1, 0, 0);
 
+    // TYCHE_SPARSE_META; the per-type index globals are cast to it.
+    Ctx->TyCheSparseMetaTy = llvm::StructType::create(Cxt, "TYCHE_SPARSE_META");
+    std::vector<llvm::Type *> Fields;
+    Fields.push_back(Ctx->TyCheCacheLineEntryTy->getPointerTo());    /* lines */
+    Fields.push_back(llvm::Type::getInt32Ty(Cxt));              /* num_buckets */
+    Fields.push_back(llvm::ArrayType::get(llvm::Type::getInt16Ty(Cxt), 0)); /* bucket */
+    Ctx->TyCheSparseMetaTy->setBody(Fields);
+
 
 }
 
@@ -2555,6 +3789,7 @@ static void initializeTyCheCapabilityTypes(llvm::Module &M)
 static  TypeEntry &compileType(llvm::Module &M, llvm::DIType *Ty,
                                     TypeInfo &tInfo, unsigned multiplier = 1) {
   
+  PhaseRegion Timer(PHASE_COMPILE_TYPE);
   Ty = normalizeType(Ty);
 
   auto i = tInfo.cache.find(Ty);
@@ -2578,6 +3813,7 @@ static  TypeEntry &compileType(llvm::Module &M, llvm::DIType *Ty,
 
   HashVal hash = buildTypeHash(Ty, tInfo);
   LayoutInfo layout;
+  LayoutPeriods periods;
   size_t layoutLen = 2;
   bool incomplete = false;
   FAM fam = {nullptr, SIZE_MAX};
@@ -2615,8 +3851,9 @@ static  TypeEntry &compileType(llvm::Module &M, llvm::DIType *Ty,
     // This can happen when the same type has multiple DI entries,
     // e.g. anonymous types defined multiple times at different locations.
     llvm::Constant *Meta =
-        llvm::ConstantExpr::getBitCast(MetaGV, TypeTy->getPointerTo());
+        llvm::ConstantExpr::getBitCast(MetaGV, Ctx->TypeTy->getPointerTo());
     entry.typeMeta = Meta;
+    tInfo.metas.insert(std::make_pair(Meta, Ty));
     return entry;
   }
 
@@ -2639,18 +3876,16 @@ static  TypeEntry &compileType(llvm::Module &M, llvm::DIType *Ty,
   tyCheEntry.FAM = false;
   tyCheEntry.Type = llvm::dwarf::DW_TAG_null;
   tyCheEntry.Parent = nullptr;
-  std::vector<llvm::DIType*> type_dependency; 
-  type_dependency.push_back(Ty);
-  addLayoutEntry(layout, tInfo, 0, Ty, -EFFECTIVE_DELTA, EFFECTIVE_DELTA, true, tyCheEntry, type_dependency);
-  type_dependency.pop_back();
+  addLayoutEntry(layout, tInfo, 0, Ty, -EFFECTIVE_DELTA, EFFECTIVE_DELTA, true,
+                 tyCheEntry, getTyCheDepNode(nullptr, Ty));
 
   if (isVPtrType(Ty)) {
     // Virtual Function Table pointer.  Can be coerced into (void *):
-    TypeEntry &voidPtrEntry = compileType(M, Int8PtrTy, tInfo);
+    TypeEntry &voidPtrEntry = compileType(M, Ctx->Int8PtrTy, tInfo);
     tInfo.cache.erase(Ty);
     tInfo.cache.insert(std::make_pair(Ty, voidPtrEntry));
     return voidPtrEntry;
-  } else if (Ty == Int8PtrTy) {
+  } else if (Ty == Ctx->Int8PtrTy) {
     Next = llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt),
                                   EFFECTIVE_COERCED_INT8_PTR_HASH);
   } else if (DerivedTy != nullptr &&
@@ -2666,7 +3901,7 @@ static  TypeEntry &compileType(llvm::Module &M, llvm::DIType *Ty,
     // Enum type.
     // All enums can be coerced to (int):
     //CompositeTy->dump();
-    TypeEntry &intEntry = compileType(M, Int32Ty, tInfo);
+    TypeEntry &intEntry = compileType(M, Ctx->Int32Ty, tInfo);
     tInfo.cache.erase(Ty);
     tInfo.cache.insert(std::make_pair(Ty, intEntry));
     return intEntry;
@@ -2682,9 +3917,11 @@ static  TypeEntry &compileType(llvm::Module &M, llvm::DIType *Ty,
 #ifdef EFFECTIVE_LAYOUT_DEBUG
     fprintf(stderr, "%s:\n", humanName.c_str());
 #endif
-    std::vector<llvm::DIType*> type_dependency;
-    type_dependency.push_back(CompositeTy);
-    buildLayout(CompositeTy, 0, fam, tInfo, layout, type_dependency);
+    {
+      PhaseRegion Timer(PHASE_COMPILE_LAYOUT);
+      buildLayout(CompositeTy, 0, fam, tInfo, layout,
+                  getTyCheDepNode(nullptr, CompositeTy), periods);
+    }
 #ifdef EFFECTIVE_LAYOUT_DEBUG
     fprintf(stderr, "\n");
 #endif
@@ -2724,6 +3961,8 @@ static  TypeEntry &compileType(llvm::Module &M, llvm::DIType *Ty,
     // NOP
   } else
     EFFECTIVE_FATAL_ERROR("unknown type");
+  if (option_layout_format == LAYOUT_GROUPED)
+    layoutLen = std::max<size_t>(layoutLen, EFFECTIVE_GROUP_SIZE);
 
   size_t size = 0, size_fam = 0, offset_fam = 0;
   if (fam.type != nullptr) {
@@ -2741,25 +3980,42 @@ static  TypeEntry &compileType(llvm::Module &M, llvm::DIType *Ty,
   size_t hval = getTypeHash(Ty, entry.hash);
   uint64_t mask = layoutLen - 1;
   llvm::Constant *Info = buildTypeInfo(M, Ty, size, fam, incomplete, tInfo);
-  llvm::Constant *Layout = nullptr;
+  llvm::Constant *Layout = nullptr, *Tail = nullptr, *Cold = nullptr;
   uint64_t hval2 = hval;
   size_t finalLen;
 
-  // Build the layout hash table.
+  // Build the layout hash table.  Try the seed found by an earlier
+  // compilation first (see lookupLayoutCache()).
   int64_t tid_number = -1;
-
-  for (unsigned i = 0;; i++) {
-    
-    auto Result = compileLayout(M, hval2, layoutLen, layout, tid_number);
+  uint64_t cachedSeed;
+  if (lookupLayoutCache(hash, hval, layoutLen, layout, cachedSeed)) {
+    PhaseRegion Timer(PHASE_COMPILE_LAYOUT);
+    auto Result = compileLayout(M, cachedSeed, layoutLen, layout, entry.hash,
+                                tid_number, Tail, Cold);
     Layout = Result.first;
     finalLen = Result.second;
+    if (Layout != nullptr)
+      hval2 = cachedSeed;
+  }
+
+  for (unsigned i = 0; Layout == nullptr; i++) {
+    
+    {
+      PhaseRegion Timer(PHASE_COMPILE_LAYOUT);
+      auto Result = compileLayout(M, hval2, layoutLen, layout, entry.hash,
+                                  tid_number, Tail, Cold);
+      Layout = Result.first;
+      finalLen = Result.second;
+    }
     
     if (Layout != nullptr)
     {
       assert(tid_number != -1);
+      storeLayoutCache(hash, hval, layoutLen, layout, hval2, i);
       break;
     
     }
+    count(COUNTER_LAYOUT_RETRIES);
     
     if (i >= 64) {
       // We have attempted to build the layout many times, but there
@@ -2783,14 +4039,16 @@ static  TypeEntry &compileType(llvm::Module &M, llvm::DIType *Ty,
 
 
    // TODO:: Initilize all the basic types too
-  llvm::ArrayType* tyche_cl_meta_type = nullptr;
-  llvm::Constant* TyCheMeta = getTyCheMeta(M, tid_number, tyche_cl_meta_type);
-  llvm::StructType *MetaTy = makeTypeMetaType(M, finalLen, tyche_cl_meta_type);
+  count(COUNTER_LAYOUT_ENTRIES, layout.size());
+  llvm::Constant* TyCheMeta = getTyCheMeta(M, tid_number);
+  llvm::StructType *MetaTy = makeTypeMetaType(M, finalLen,
+      Tail == nullptr ? nullptr : Tail->getType());
   llvm::GlobalVariable *MetaGV = new llvm::GlobalVariable(
       M, MetaTy, true, llvm::GlobalValue::WeakAnyLinkage, 0, metaName.str());
   llvm::Constant *Meta =
-      llvm::ConstantExpr::getBitCast(MetaGV, TypeTy->getPointerTo());
+      llvm::ConstantExpr::getBitCast(MetaGV, Ctx->TypeTy->getPointerTo());
   entry.typeMeta = Meta;
+  tInfo.metas.insert(std::make_pair(Meta, Ty));
 
   std::vector<llvm::Constant *> Elems;
   Elems.push_back(TyCheMeta);
@@ -2807,13 +4065,21 @@ static  TypeEntry &compileType(llvm::Module &M, llvm::DIType *Ty,
   Elems.push_back(llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt), mask));
   Elems.push_back(Info);
   Elems.push_back(Next);
+  Elems.push_back(Cold);
+  Elems.push_back(compilePeriods(M, periods));
   Elems.push_back(llvm::ConstantInt::get(llvm::Type::getInt32Ty(Cxt), finalLen));
+  Elems.push_back(llvm::ConstantInt::get(llvm::Type::getInt32Ty(Cxt),
+                                         option_layout_format));
   Elems.push_back(Layout);
+  if (Tail != nullptr)
+    Elems.push_back(Tail);
   llvm::Constant *MetaInit = llvm::ConstantStruct::get(MetaTy, Elems);
   MetaGV->setInitializer(MetaInit);
+  setTypeMetaComdat(M, MetaGV);
+  count(COUNTER_TYPES_COMPILED);
 
   if (Meta == nullptr) {llvm_unreachable("Meta is null!\n");}
-  if (AllocationPointsDIInfo.find(Meta) != AllocationPointsDIInfo.end()) 
+  if (Ctx->AllocationPointsDIInfo.find(Meta) != Ctx->AllocationPointsDIInfo.end()) 
   {
     llvm_unreachable("Inserting a Meta with the same index!\n");
   }
@@ -2821,14 +4087,14 @@ static  TypeEntry &compileType(llvm::Module &M, llvm::DIType *Ty,
 
   if (tid_number == -1) 
       llvm_unreachable("Cannot assign a valid tid number!\n");
-  if (AllocationPointsTypeInfo.find(tid_number) == AllocationPointsTypeInfo.end()) 
+  if (Ctx->AllocationPointsTypeInfo.find(tid_number) == Ctx->AllocationPointsTypeInfo.end()) 
       llvm_unreachable("Cannot find a valid entry for the tid_number in AllocationPointsTypeInfo!\n");
 
 
-  for (auto &entries : AllocationPointsTypeInfo[tid_number])
-  {
-      AllocationPointsDIInfo[Meta].insert(std::make_pair(entries.first, entries.second));
-  }
+  Ctx->AllocationPointsDIInfo.insert(
+      std::make_pair(Meta, (uint64_t)tid_number));
+
+  addTyCheDBType(M, entry.type_id, tid_number, entry.hash, humanName);
 
   
   // std::ofstream file(APFileName, std::ios::app);
@@ -2930,21 +4196,21 @@ static llvm::DIType *getDeclaredTypeAnnotation(llvm::Value *Ptr, bool *_isPointe
     if (auto *PTy = llvm::dyn_cast<llvm::PointerType>(Ty))
       Ty = PTy->getElementType();
     if (Ty->isIntegerTy(8))
-      return Int8Ty;
+      return Ctx->Int8Ty;
     if (Ty->isIntegerTy(16))
-      return Int16Ty;
+      return Ctx->Int16Ty;
     if (Ty->isIntegerTy(32))
-      return Int32Ty;
+      return Ctx->Int32Ty;
     if (Ty->isIntegerTy(64))
-      return Int64Ty;
+      return Ctx->Int64Ty;
     if (Ty->isIntegerTy(128))
-      return Int128Ty;
+      return Ctx->Int128Ty;
     return nullptr;
   }
 
   Ty = getPointeeType(Ty);
   if (Ty == nullptr)
-    return Int8Ty;
+    return Ctx->Int8Ty;
   
   if (_isPointer) *_isPointer = true;
   return Ty;
@@ -3231,12 +4497,12 @@ static llvm::Value *instrumentTypeCheck(llvm::Module &M, llvm::Function &F,
     // If Meta==nullptr then the type is (char []).  Since this matches
     // any possible type, we simply get the object (allocation) bounds:
     llvm::Constant *BoundsGet = M.getOrInsertFunction(
-        "effective_get_bounds", BoundsTy, builder.getInt8PtrTy(), nullptr);
+        "effective_get_bounds", Ctx->BoundsTy, builder.getInt8PtrTy(), nullptr);
     Bounds = builder.CreateCall(BoundsGet, {Ptr1});
   } else {
     llvm::Constant *TypeCheck = M.getOrInsertFunction(
-        "effective_type_check", BoundsTy, builder.getInt8PtrTy(),
-        TypeTy->getPointerTo(), nullptr);
+        "effective_type_check", Ctx->BoundsTy, builder.getInt8PtrTy(),
+        Ctx->TypeTy->getPointerTo(), nullptr);
     Bounds = builder.CreateCall(TypeCheck, {Ptr1, Meta});
   }
   CheckEntry Entry = {Bounds, nullptr, 0};
@@ -3373,14 +4639,15 @@ static llvm::Value *narrowBounds(llvm::Module &M, const InsertPoint &IP,
     UB = builder.getInt64(INTPTR_MAX);
   else
     UB = builder.CreateAdd(IPtr, builder.getInt64(Entry.ub));
-  llvm::Value *SubBounds = llvm::UndefValue::get(BoundsTy);
+  llvm::Value *SubBounds = llvm::UndefValue::get(Ctx->BoundsTy);
   SubBounds = builder.CreateInsertElement(SubBounds, LB, builder.getInt32(0));
   SubBounds = builder.CreateInsertElement(SubBounds, UB, builder.getInt32(1));
-  if (Entry.bounds == BoundsNonFat)
+  if (Entry.bounds == Ctx->BoundsNonFat)
     return SubBounds;
   else {
     llvm::Constant *Narrow = M.getOrInsertFunction(
-        "effective_bounds_narrow", BoundsTy, BoundsTy, BoundsTy, nullptr);
+        "effective_bounds_narrow", Ctx->BoundsTy, Ctx->BoundsTy,
+        Ctx->BoundsTy, nullptr);
     llvm::Value *Bounds = builder.CreateCall(Narrow, {Entry.bounds, SubBounds});
     return Bounds;
   }
@@ -3514,7 +4781,7 @@ static const BoundsEntry &calculateBounds(llvm::Module &M, llvm::Function &F,
     return k.first->second;
   }
 
-  llvm::Value *Bounds = BoundsNonFat;
+  llvm::Value *Bounds = Ctx->BoundsNonFat;
   ssize_t lb = INTPTR_MIN;
   ssize_t ub = INTPTR_MAX;
   if ((option_no_globals && llvm::isa<llvm::Constant>(Ptr)) ||
@@ -3658,7 +4925,7 @@ static const BoundsEntry &calculateBounds(llvm::Module &M, llvm::Function &F,
   } else if (auto *PHI = llvm::dyn_cast<llvm::PHINode>(Ptr)) {
     unsigned numValues = PHI->getNumIncomingValues();
     llvm::IRBuilder<> builder(PHI);
-    llvm::PHINode *BoundsPHI = builder.CreatePHI(BoundsTy, numValues);
+    llvm::PHINode *BoundsPHI = builder.CreatePHI(Ctx->BoundsTy, numValues);
     BoundsEntry EntryPHI0 = {BoundsPHI, INTPTR_MIN, INTPTR_MAX};
     auto k = bInfo.insert(std::make_pair(Ptr, EntryPHI0));
     BoundsEntry &EntryPHI = k.first->second;
@@ -3905,7 +5172,7 @@ instrumentBoundsCheck(llvm::Module &M, llvm::Function &F,
   // Calculate the bounds:
   BoundsEntry Entry = calculateBounds(M, F, Check.widePtr, tInfo, cInfo,
                                       bInfo); // copy.
-  if (Entry.bounds == BoundsNonFat) {
+  if (Entry.bounds == Ctx->BoundsNonFat) {
     // This is a non-fat pointer, so no need to do a bounds check.
     return;
   }
@@ -3924,7 +5191,7 @@ instrumentBoundsCheck(llvm::Module &M, llvm::Function &F,
   // Emit the bounds check.
   llvm::IRBuilder<> builder(I);
   llvm::Constant *BoundsCheck = M.getOrInsertFunction(
-      "effective_bounds_check", builder.getVoidTy(), BoundsTy,
+      "effective_bounds_check", builder.getVoidTy(), Ctx->BoundsTy,
       builder.getInt8PtrTy(), builder.getInt64Ty(), builder.getInt64Ty(),
       nullptr);
   Ptr = builder.CreateBitCast(Ptr, builder.getInt8PtrTy());
@@ -4054,28 +5321,103 @@ static void optimizeBoundsChecks(llvm::Module &M, llvm::Function &F,
 /* TYPED MEMORY ALLOCATION                                                   */
 /*****************************************************************************/
 
+/*
+ * The instrumentation of a module is split in two.  First, each function is
+ * analyzed on its own (possibly in parallel, see -effective-threads).  The
+ * analysis only reads the IR of the function, so it must not create types,
+ * constants or metadata, nor touch the pass's global state.  Second, the
+ * functions are rewritten serially in module order, which compiles the types
+ * and emits all output.  The output is thus the same for any number of
+ * threads.
+ */
+struct FunctionAnalysis {
+  std::vector<llvm::Instruction *> Calls;     // Calls to named functions.
+  std::vector<llvm::Instruction *> Allocas;
+  llvm::DenseMap<llvm::Instruction *, llvm::BitCastInst *> Casts;
+};
+
 /*
  * malloc()'s return type is (void *).  The typical C idiom is to immediately
  * cast the return value to the desired type.  This function uses a simple
- * heuristic to try and determine what that type is.
+ * heuristic to try and determine what that cast is.  The dominator tree is
+ * only built if the heuristic needs it.
  */
-static llvm::Constant *inferMallocType(TypeEntry &entry,
-                                       llvm::Module &M, llvm::Function &F,
-                                       llvm::Instruction *I, TypeInfo &tInfo,
-                                       llvm::DIType **TyPtr = nullptr) {
-  const llvm::DominatorTree DT(F);
+static llvm::BitCastInst *
+inferMallocCast(llvm::Instruction *I, llvm::Function &F,
+                std::unique_ptr<llvm::DominatorTree> &DT) {
   llvm::BitCastInst *Cast = nullptr;
   for (llvm::User *U : I->users()) {
     if (auto *Next = llvm::dyn_cast<llvm::BitCastInst>(U)) {
-      if (Cast == nullptr)
+      if (Cast == nullptr) {
         Cast = Next;
-      else if (DT.dominates(Next, Cast))
+        continue;
+      }
+      if (!DT)
+        DT.reset(new llvm::DominatorTree(F));
+      if (DT->dominates(Next, Cast))
         Cast = Next;
-      else if (!DT.dominates(Cast, Next) &&
+      else if (!DT->dominates(Cast, Next) &&
                Cast->getDestTy() != Next->getDestTy())
         return nullptr; // Conflicting casts; give up
     }
   }
+  return Cast;
+}
+
+static void analyzeFunction(llvm::Function &F, FunctionAnalysis &FA) {
+  std::unique_ptr<llvm::DominatorTree> DT;
+  for (auto &BB : F) {
+    for (auto &I : BB) {
+      if (llvm::isa<llvm::AllocaInst>(&I))
+        FA.Allocas.push_back(&I);
+      else {
+        llvm::CallSite Call(&I);
+        if (!Call.isCall() && !Call.isInvoke())
+          continue;
+        llvm::Function *CalledFn = Call.getCalledFunction();
+        if (CalledFn == nullptr || !CalledFn->hasName())
+          continue;
+        FA.Calls.push_back(&I);
+      }
+      llvm::BitCastInst *Cast = inferMallocCast(&I, F, DT);
+      if (Cast != nullptr)
+        FA.Casts[&I] = Cast;
+    }
+  }
+}
+
+/*
+ * Analyze the given functions, on a thread pool if -effective-threads is not
+ * 1.  Each task only writes to its own FunctionAnalysis.
+ */
+static void analyzeFunctions(const std::vector<llvm::Function *> &Fs,
+                             std::vector<FunctionAnalysis> &FAs) {
+  PhaseRegion Timer(PHASE_ANALYZE_FUNCTIONS);
+  FAs.resize(Fs.size());
+  unsigned threads = option_threads;
+  if (threads == 0)
+    threads = llvm::heavyweight_hardware_concurrency();
+  if (threads <= 1 || Fs.size() <= 1) {
+    for (size_t i = 0; i < Fs.size(); i++)
+      analyzeFunction(*Fs[i], FAs[i]);
+    return;
+  }
+  llvm::ThreadPool Pool(std::min<size_t>(threads, Fs.size()));
+  for (size_t i = 0; i < Fs.size(); i++)
+    Pool.async([&Fs, &FAs, i] { analyzeFunction(*Fs[i], FAs[i]); });
+  Pool.wait();
+}
+
+/*
+ * Get the type of an allocation from the cast found by inferMallocCast().
+ */
+static llvm::Constant *inferMallocType(TypeEntry &entry,
+                                       llvm::Module &M,
+                                       const FunctionAnalysis &FA,
+                                       llvm::Instruction *I, TypeInfo &tInfo,
+                                       llvm::DIType **TyPtr = nullptr) {
+  auto i = FA.Casts.find(I);
+  llvm::BitCastInst *Cast = (i == FA.Casts.end() ? nullptr : i->second);
 
   llvm::Constant * retConstant = nullptr;
   if (Cast != nullptr)
@@ -4100,9 +5442,6 @@ static void emitTyCHEFunctionInfo(llvm::Module &M, llvm::Function &FuncTy, TypeI
 {
 
     
-    std::ofstream StackAPfile(StackAPFileName, std::ios::app);
-    std::error_code EC;
-    llvm::raw_fd_ostream file("tyche.debug", EC, llvm::sys::fs::F_Append);
     std::vector<llvm::Metadata *> ArgMetas;
     llvm::LLVMContext& C = FuncTy.getContext();
     for (auto itr = FuncTy.getArgumentList().begin(); 
@@ -4113,25 +5452,14 @@ static void emitTyCHEFunctionInfo(llvm::Module &M, llvm::Function &FuncTy, TypeI
         llvm::DIType *ArgTy = nullptr;
         TypeEntry entry;
         llvm::Constant *Meta = getDeclaredType(entry, M, ArgValue, tInfo, &ArgTy, true);
-        Meta = (Meta == nullptr ? Int8TyMeta : Meta);
+        Meta = (Meta == nullptr ? Ctx->Int8TyMeta : Meta);
 
         llvm::Argument *Arg = llvm::dyn_cast<llvm::Argument>(ArgValue);
         unsigned idx = Arg->getArgNo();
         
 
-        llvm::DIType* type_meta = nullptr;
-        bool found = false;
         uint64_t tid = 0;
-        for (auto &elem : tInfo.cache)
-        {
-          if (elem.second.typeMeta == Meta)
-          {
-              type_meta = elem.first;
-              tid = elem.second.type_id;     
-              found = true;
-          }
-
-        }
+        llvm::DIType* type_meta = lookupTypeMeta(tInfo, Meta, tid);
 
         std::string loc = "";
         uint64_t line;
@@ -4144,53 +5472,44 @@ static void emitTyCHEFunctionInfo(llvm::Module &M, llvm::Function &FuncTy, TypeI
         loc += std::to_string(line) + "#" + std::to_string(col);
 
         auto CallerName = std::string(FuncTy.getName());
-        file << "EffectiveSan::\nLLVM IR Location (Inlined): [" << M.getSourceFileName() << 
-                  "][Caller Name: " << CallerName  <<
-                  "][Allocator Name: " <<  "Argument" << 
-                  "][Location: " << line << "," << col << 
-                  "][Inlined Location: " << 0 << "," << 0 << 
-                  "][BB ID: " << (uint64_t)ArgValue << 
-                  "][Inst ID: " << (uint64_t)(ArgValue) <<
-                  "]\n";
-
-        // I.print(file); file << "\n";
+        if (Ctx->ORE != nullptr)
+          emitTyCheRemark(FuncTy, nullptr, "Argument",
+                          tInfo.names.find(type_meta)->second, tid, line, col,
+                          getTyCheArgumentID(*Arg));
         
-        StackAPfile << TypeIDCache[tid-1];
-        StackAPfile << std::dec << "METAID " << 
+        llvm::raw_ostream &StackAPfile = sidecarRecord(SIDECAR_STACK_AP);
+        StackAPfile << getTyCheLayoutDump(Meta);
+        StackAPfile << "METAID " << 
             M.getSourceFileName()  <<
             "#" << loc << 
             "#" << tInfo.names.find(type_meta)->second << 
-            "#" << std::to_string((uint64_t)(Meta)) <<
+            "#" << std::to_string(getTyCheMetaID(Meta)) <<
             "#" << tInfo.hashes.find(type_meta)->second.i64[0] <<
             "#" << tInfo.hashes.find(type_meta)->second.i64[1] << 
             "#" << "Argument" <<
             "#" << CallerName <<
             "#" << 0 << 
             "#" << 0 << 
-            "#" << (uint64_t)ArgValue << 
-            "#" << (uint64_t)ArgValue <<
+            "#" << getTyCheArgumentID(*Arg) << 
+            "#" << getTyCheArgumentID(*Arg) <<
             "#" << tid <<  
             "\n" ;
+        addTyCheDBSite(M, llvm::tyche::DBSiteArgument, "Argument", CallerName,
+                       tInfo.names.find(type_meta)->second,
+                       &tInfo.hashes.find(type_meta)->second, tid,
+                       line, col, 0, 0,
+                       getTyCheArgumentID(*Arg), getTyCheArgumentID(*Arg));
 
         
 
         
-        std::string metaString = M.getSourceFileName() + "#" +  
-                                std::to_string(line) + "#" + 
-                                std::to_string(col) + "#" + 
-                                tInfo.names.find(type_meta)->second +  "#" + 
-                                std::to_string((uint64_t)(Meta)) +  "#" + 
-                                std::to_string(tInfo.hashes.find(type_meta)->second.i64[0]) +  "#" + 
-                                std::to_string(tInfo.hashes.find(type_meta)->second.i64[1]) +  "#" + 
-                                "Argument" +  "#" + 
-                                CallerName +  "#" + 
-                                std::to_string(0) +  "#" + 
-                                std::to_string(0) +  "#" + 
-                                std::to_string((uint64_t)ArgTy) +  "#" + 
-                                std::to_string((uint64_t)ArgTy) +  "#" + 
-                                std::to_string(tid) + "#" ;
-        
-        ArgMetas.push_back(llvm::MDString::get(C, metaString));
+        uint64_t fields[llvm::TyCheMDNumFields] = {
+            line, col, getTyCheMetaID(Meta),
+            tInfo.hashes.find(type_meta)->second.i64[0],
+            tInfo.hashes.find(type_meta)->second.i64[1], 0, 0,
+            getTyCheArgumentID(*Arg), getTyCheArgumentID(*Arg), tid};
+        ArgMetas.push_back(
+            llvm::getTyCheMD(C, fields, tInfo.names.find(type_meta)->second));
     }
 
     llvm::ArrayRef<llvm::Metadata *> ArgTys1(ArgMetas.data(), ArgMetas.size());
@@ -4214,22 +5533,11 @@ static void emitTyCHEFunctionInfo(llvm::Module &M, llvm::Function &FuncTy, TypeI
             //   // Fall back on type inference.
             //   Meta = inferMallocType(entry, M, FuncTy, &I, tInfo, &AllocTy);
             // }
-            Meta = (Meta == nullptr ? Int8TyMeta : Meta);
+            Meta = (Meta == nullptr ? Ctx->Int8TyMeta : Meta);
 
 
-            llvm::DIType* type_meta = nullptr;
-            bool found = false;
             uint64_t tid = 0;
-            for (auto &elem : tInfo.cache)
-            {
-              if (elem.second.typeMeta == Meta)
-              {
-                  type_meta = elem.first;
-                  tid = elem.second.type_id;     
-                  found = true;
-              }
-
-            }
+            llvm::DIType* type_meta = lookupTypeMeta(tInfo, Meta, tid);
 
 
 
@@ -4252,69 +5560,48 @@ static void emitTyCHEFunctionInfo(llvm::Module &M, llvm::Function &FuncTy, TypeI
 
             llvm::Function * caller =  I.getParent()->getParent();
             auto CallerName = (caller != nullptr) ? std::string(caller->getName()) : std::string("NULL");
-            file << "EffectiveSan::\nLLVM IR Location (Inlined): [" << M.getSourceFileName() << 
-                      "][Caller Name: " << CallerName  <<
-                      "][Allocator Name: " <<  "Return" << 
-                      "][Location: " << line << "," << col << 
-                      "][Inlined Location: " << I.getDebugLoc().getInlinedLocation().first << "," << I.getDebugLoc().getInlinedLocation().second << 
-                      "][BB ID: " << (uint64_t)I.getParent() << 
-                      "][Inst ID: " << (uint64_t)(&I) <<
-                      "]\n";
-
-            I.print(file); file << "\n";
+            if (Ctx->ORE != nullptr)
+              emitTyCheRemark(*I.getFunction(), &I, "Return",
+                              tInfo.names.find(type_meta)->second, tid,
+                              line, col, getTyCheSiteID(I));
             
-            StackAPfile << TypeIDCache[tid-1];
-            StackAPfile << std::dec << "METAID " << 
+            llvm::raw_ostream &StackAPfile = sidecarRecord(SIDECAR_STACK_AP);
+            StackAPfile << getTyCheLayoutDump(Meta);
+            StackAPfile << "METAID " << 
                 M.getSourceFileName()  <<
                 "#" << loc << 
                 "#" << tInfo.names.find(type_meta)->second << 
-                "#" << std::to_string((uint64_t)(Meta)) <<
+                "#" << std::to_string(getTyCheMetaID(Meta)) <<
                 "#" << tInfo.hashes.find(type_meta)->second.i64[0] <<
                 "#" << tInfo.hashes.find(type_meta)->second.i64[1] << 
                 "#" << "Alloca" <<
                 "#" << CallerName <<
                 "#" << I.getDebugLoc().getInlinedLocation().first << 
                 "#" << I.getDebugLoc().getInlinedLocation().second << 
-                "#" << (uint64_t)I.getParent() << 
-                "#" << (uint64_t)(&I) <<
+                "#" << getTyCheBlockID(*I.getParent()) << 
+                "#" << getTyCheSiteID(I) <<
                 "#" << tid <<  
                 "\n" ;
+            addTyCheDBSite(M, llvm::tyche::DBSiteReturn, "Return", CallerName,
+                           tInfo.names.find(type_meta)->second,
+                           &tInfo.hashes.find(type_meta)->second, tid,
+                           line, col, I.getDebugLoc().getInlinedLocation().first,
+                           I.getDebugLoc().getInlinedLocation().second,
+                           getTyCheBlockID(*I.getParent()), getTyCheSiteID(I));
 
 
 
 
 
-            llvm::LLVMContext& C = I.getContext();
-            llvm::SmallVector<llvm::Metadata *, 32> Ops;
-
-            Ops.push_back(llvm::MDString::get(C, M.getSourceFileName()));
-            Ops.push_back(llvm::MDString::get(C, std::to_string(line)));
-            Ops.push_back(llvm::MDString::get(C, std::to_string(col))); 
-            Ops.push_back(llvm::MDString::get(C, tInfo.names.find(type_meta)->second));
-            Ops.push_back(llvm::MDString::get(C, std::to_string((uint64_t)(Meta)))); 
-            Ops.push_back(llvm::MDString::get(C, std::to_string(tInfo.hashes.find(type_meta)->second.i64[0])));
-            Ops.push_back(llvm::MDString::get(C, std::to_string(tInfo.hashes.find(type_meta)->second.i64[1]))); 
-            Ops.push_back(llvm::MDString::get(C, "Return"));
-            Ops.push_back(llvm::MDString::get(C, CallerName));
-            Ops.push_back(llvm::MDString::get(C, std::to_string(I.getDebugLoc().getInlinedLocation().first)));
-            Ops.push_back(llvm::MDString::get(C, std::to_string(I.getDebugLoc().getInlinedLocation().second)));
-            Ops.push_back(llvm::MDString::get(C, std::to_string((uint64_t)((uint64_t)I.getParent()))));
-            Ops.push_back(llvm::MDString::get(C, std::to_string((uint64_t)(&I)))); 
-            Ops.push_back(llvm::MDString::get(C, std::to_string(tid)));
-
-
-
-            
-            auto *N =  llvm::MDTuple::get(C, Ops);
-            //llvm::MDNode* N = llvm::MDNode::get(C, llvm::MDString::get(C, std::to_string(123456)));
-            I.setMetadata("TYCHE_MD", N);
+            setTyCheMD(I, tInfo.names.find(type_meta)->second,
+                       &tInfo.hashes.find(type_meta)->second,
+                       getTyCheMetaID(Meta), tid, line, col);
          }
       }
     }
 
 
 
-    file.close();
 
 
 
@@ -4325,7 +5612,7 @@ static void emitTyCHEFunctionInfo(llvm::Module &M, llvm::Function &FuncTy, TypeI
  */
 static void replaceMalloc(llvm::Module &M, llvm::Function &F,
                           llvm::Instruction &I, TypeInfo &tInfo,
-                          CheckInfo &cInfo,
+                          CheckInfo &cInfo, const FunctionAnalysis &FA,
                           std::vector<llvm::Instruction *> &Dels) {
   llvm::CallSite Call(&I);
   if (!Call.isCall() && !Call.isInvoke())
@@ -4350,32 +5637,18 @@ static void replaceMalloc(llvm::Module &M, llvm::Function &F,
         Name == "_ZnamRKSt9nothrow_t"))) // new[] (nothrow)
   {
     
-    std::ofstream APfile(APFileName, std::ios::app);
-    std::error_code EC;
-    llvm::raw_fd_ostream file("tyche.debug", EC, llvm::sys::fs::F_Append);
 
     TypeEntry entry;
     // malloc, new, new[]:
     Meta = getDeclaredType(entry, M, &I, tInfo, &Ty, true);
     if (Meta == nullptr)
-      Meta = inferMallocType(entry, M, F, &I, tInfo, &Ty);
+      Meta = inferMallocType(entry, M, FA, &I, tInfo, &Ty);
 
-    Meta = (Meta == nullptr ? Int8TyMeta : Meta);
+    Meta = (Meta == nullptr ? Ctx->Int8TyMeta : Meta);
 
 
-    llvm::DIType* type_meta = nullptr;
-    bool found = false;
     uint64_t tid = 0;
-    for (auto &elem : tInfo.cache)
-    {
-      if (elem.second.typeMeta == Meta)
-      {
-          type_meta = elem.first;
-          tid = elem.second.type_id;     
-          found = true;
-      }
-
-    }
+    llvm::DIType* type_meta = lookupTypeMeta(tInfo, Meta, tid);
 
 
 
@@ -4398,62 +5671,41 @@ static void replaceMalloc(llvm::Module &M, llvm::Function &F,
 
     llvm::Function * caller =  I.getParent()->getParent();
     auto CallerName = (caller != nullptr) ? std::string(caller->getName()) : std::string("NULL");
-    file << "EffectiveSan::\nLLVM IR Location (Inlined): [" << M.getSourceFileName() << 
-              "][Caller Name: " << CallerName  <<
-              "][Allocator Name: " <<  std::string(Name) << 
-              "][isCall: " << Call.isCall() << 
-              "][isInvoke: " << Call.isInvoke() << 
-              "][isMustTailCall: " << Call.isMustTailCall() << 
-              "][isTailCall: " << Call.isTailCall() << 
-              "][Location: " << line << "," << col << 
-              "][Inlined Location: " << I.getDebugLoc().getInlinedLocation().first << "," << I.getDebugLoc().getInlinedLocation().second << 
-              "][BB ID: " << (uint64_t)I.getParent() << 
-              "][Inst ID: " << (uint64_t)(&I) <<
-              "]\n";
-
-    I.print(file); file << "\n";
+    if (Ctx->ORE != nullptr)
+      emitTyCheRemark(*I.getFunction(), &I, Name,
+                      tInfo.names.find(type_meta)->second, tid, line, col,
+                      getTyCheSiteID(I));
     
-    APfile << TypeIDCache[tid-1];
-    APfile << std::dec << "METAID " << 
+    llvm::raw_ostream &APfile = sidecarRecord(SIDECAR_HEAP_AP);
+    APfile << getTyCheLayoutDump(Meta);
+    APfile << "METAID " << 
         M.getSourceFileName()  <<
         "#" << loc << 
         "#" << tInfo.names.find(type_meta)->second << 
-        "#" << std::to_string((uint64_t)(Meta)) <<
+        "#" << std::to_string(getTyCheMetaID(Meta)) <<
         "#" << tInfo.hashes.find(type_meta)->second.i64[0] <<
         "#" << tInfo.hashes.find(type_meta)->second.i64[1] << 
         "#" << std::string(Name) <<
         "#" << CallerName <<
         "#" << I.getDebugLoc().getInlinedLocation().first << 
         "#" << I.getDebugLoc().getInlinedLocation().second << 
-        "#" << (uint64_t)I.getParent() << 
-        "#" << (uint64_t)(&I) <<
+        "#" << getTyCheBlockID(*I.getParent()) << 
+        "#" << getTyCheSiteID(I) <<
         "#" << tid <<  
         "\n" ;
+    addTyCheDBSite(M, llvm::tyche::DBSiteHeap, Name, CallerName,
+                   tInfo.names.find(type_meta)->second,
+                   &tInfo.hashes.find(type_meta)->second, tid,
+                   line, col, I.getDebugLoc().getInlinedLocation().first,
+                   I.getDebugLoc().getInlinedLocation().second,
+                   getTyCheBlockID(*I.getParent()), getTyCheSiteID(I));
 
 
 
-    file.close();
 
-    llvm::LLVMContext& C = I.getContext();
-    llvm::SmallVector<llvm::Metadata *, 32> Ops;
-    Ops.push_back(llvm::MDString::get(C, std::to_string(line)));
-    Ops.push_back(llvm::MDString::get(C, std::to_string(col))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string((uint64_t)(Meta)))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string(tInfo.hashes.find(type_meta)->second.i64[0])));
-    Ops.push_back(llvm::MDString::get(C, std::to_string(tInfo.hashes.find(type_meta)->second.i64[1]))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string(I.getDebugLoc().getInlinedLocation().first)));
-    Ops.push_back(llvm::MDString::get(C, std::to_string(I.getDebugLoc().getInlinedLocation().second))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string((uint64_t)((uint64_t)I.getParent()))));
-    Ops.push_back(llvm::MDString::get(C, std::to_string((uint64_t)(&I)))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string(tid))); 
-    Ops.push_back(llvm::MDString::get(C, Name));
-    Ops.push_back(llvm::MDString::get(C, tInfo.names.find(type_meta)->second));
-    Ops.push_back(llvm::MDString::get(C, CallerName));
-
-    
-    auto *N =  llvm::MDTuple::get(C, Ops);
-    //llvm::MDNode* N = llvm::MDNode::get(C, llvm::MDString::get(C, std::to_string(123456)));
-    I.setMetadata("TYCHE_MD", N);
+    setTyCheMD(I, tInfo.names.find(type_meta)->second,
+               &tInfo.hashes.find(type_meta)->second,
+               getTyCheMetaID(Meta), tid, line, col);
     // std::string newName = "effective_";
     // newName += Name.str();
     // llvm::Constant *NewFn =
@@ -4464,32 +5716,18 @@ static void replaceMalloc(llvm::Module &M, llvm::Function &F,
   } else if (Call.getNumArgOperands() == 2 && Name == "calloc") {
     // calloc:
    
-    std::ofstream APfile(APFileName, std::ios::app);
-    std::error_code EC;
-    llvm::raw_fd_ostream file("tyche.debug", EC, llvm::sys::fs::F_Append);
 
     TypeEntry entry;
     // malloc, new, new[]:
     Meta = getDeclaredType(entry, M, &I, tInfo, &Ty, true);
     if (Meta == nullptr)
-      Meta = inferMallocType(entry, M, F, &I, tInfo, &Ty);
+      Meta = inferMallocType(entry, M, FA, &I, tInfo, &Ty);
 
-    Meta = (Meta == nullptr ? Int8TyMeta : Meta);
+    Meta = (Meta == nullptr ? Ctx->Int8TyMeta : Meta);
 
 
-    llvm::DIType* type_meta = nullptr;
-    bool found = false;
     uint64_t tid = 0;
-    for (auto &elem : tInfo.cache)
-    {
-      if (elem.second.typeMeta == Meta)
-      {
-          type_meta = elem.first;
-          tid = elem.second.type_id;     
-          found = true;
-      }
-
-    }
+    llvm::DIType* type_meta = lookupTypeMeta(tInfo, Meta, tid);
 
 
 
@@ -4514,61 +5752,41 @@ static void replaceMalloc(llvm::Module &M, llvm::Function &F,
 
     llvm::Function * caller =  I.getParent()->getParent();
     auto CallerName = (caller != nullptr) ? std::string(caller->getName()) : std::string("NULL");
-    file << "EffectiveSan::\nLLVM IR Location (Inlined): [" << M.getSourceFileName() << 
-              "][Caller Name: " << CallerName  <<
-              "][Allocator Name: " <<  std::string(Name) << 
-              "][isCall: " << Call.isCall() << 
-              "][isInvoke: " << Call.isInvoke() << 
-              "][isMustTailCall: " << Call.isMustTailCall() << 
-              "][isTailCall: " << Call.isTailCall() << 
-              "][Location: " << line << "," << col << 
-              "][Inlined Location: " << I.getDebugLoc().getInlinedLocation().first << "," << I.getDebugLoc().getInlinedLocation().second << 
-              "][BB ID: " << (uint64_t)I.getParent() <<          
-              "][Inst ID: " << (uint64_t)(&I) << 
-              "]\n";
-
-    I.print(file); file << "\n";
+    if (Ctx->ORE != nullptr)
+      emitTyCheRemark(*I.getFunction(), &I, Name,
+                      tInfo.names.find(type_meta)->second, tid, line, col,
+                      getTyCheSiteID(I));
     
-    APfile << TypeIDCache[tid-1];
-    APfile << std::dec << "METAID " << 
+    llvm::raw_ostream &APfile = sidecarRecord(SIDECAR_HEAP_AP);
+    APfile << getTyCheLayoutDump(Meta);
+    APfile << "METAID " << 
         M.getSourceFileName()  <<
         "#" << loc << 
         "#" << tInfo.names.find(type_meta)->second << 
-        "#" << std::to_string((uint64_t)(Meta)) <<
+        "#" << std::to_string(getTyCheMetaID(Meta)) <<
         "#" << tInfo.hashes.find(type_meta)->second.i64[0] <<
         "#" << tInfo.hashes.find(type_meta)->second.i64[1] << 
         "#" << std::string(Name) <<
         "#" << CallerName <<
         "#" << I.getDebugLoc().getInlinedLocation().first << 
         "#" << I.getDebugLoc().getInlinedLocation().second << 
-        "#" << (uint64_t)I.getParent() << 
-        "#" << (uint64_t)(&I) <<
+        "#" << getTyCheBlockID(*I.getParent()) << 
+        "#" << getTyCheSiteID(I) <<
         "#" << tid <<  
         "\n" ;
+    addTyCheDBSite(M, llvm::tyche::DBSiteCalloc, Name, CallerName,
+                   tInfo.names.find(type_meta)->second,
+                   &tInfo.hashes.find(type_meta)->second, tid,
+                   line, col, I.getDebugLoc().getInlinedLocation().first,
+                   I.getDebugLoc().getInlinedLocation().second,
+                   getTyCheBlockID(*I.getParent()), getTyCheSiteID(I));
 
 
 
-    file.close();
-
-    llvm::LLVMContext& C = I.getContext();
-    llvm::SmallVector<llvm::Metadata *, 32> Ops;
-    Ops.push_back(llvm::MDString::get(C, std::to_string(line)));
-    Ops.push_back(llvm::MDString::get(C, std::to_string(col))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string((uint64_t)(Meta)))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string(tInfo.hashes.find(type_meta)->second.i64[0])));
-    Ops.push_back(llvm::MDString::get(C, std::to_string(tInfo.hashes.find(type_meta)->second.i64[1]))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string(I.getDebugLoc().getInlinedLocation().first)));
-    Ops.push_back(llvm::MDString::get(C, std::to_string(I.getDebugLoc().getInlinedLocation().second))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string((uint64_t)((uint64_t)I.getParent()))));
-    Ops.push_back(llvm::MDString::get(C, std::to_string((uint64_t)(&I)))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string(tid))); 
-    Ops.push_back(llvm::MDString::get(C, Name));
-    Ops.push_back(llvm::MDString::get(C, tInfo.names.find(type_meta)->second));
-    Ops.push_back(llvm::MDString::get(C, CallerName));
-    
-    auto *N =  llvm::MDTuple::get(C, Ops);
-    //llvm::MDNode* N = llvm::MDNode::get(C, llvm::MDString::get(C, std::to_string(123456)));
-    I.setMetadata("TYCHE_MD", N);
+
+    setTyCheMD(I, tInfo.names.find(type_meta)->second,
+               &tInfo.hashes.find(type_meta)->second,
+               getTyCheMetaID(Meta), tid, line, col);
     // llvm::Constant *NewFn = M.getOrInsertFunction(
     //     "effective_calloc", BoundsTy, builder.getInt64Ty(),
     //     builder.getInt64Ty(), TypeTy->getPointerTo(), nullptr);
@@ -4582,9 +5800,6 @@ static void replaceMalloc(llvm::Module &M, llvm::Function &F,
     //     builder.getInt64Ty(), nullptr);
     // size = getSize(I.getOperand(1));
     // Bounds = builder.CreateCall(NewFn, {I.getOperand(0), I.getOperand(1)});
-    std::ofstream APfile(APFileName, std::ios::app);
-    std::error_code EC;
-    llvm::raw_fd_ostream file("tyche.debug", EC, llvm::sys::fs::F_Append);
 
     const llvm::DebugLoc &location = I.getDebugLoc();
     std::string loc = "";
@@ -4605,23 +5820,13 @@ static void replaceMalloc(llvm::Module &M, llvm::Function &F,
 
     llvm::Function * caller =  I.getParent()->getParent();
     auto CallerName = (caller != nullptr) ? std::string(caller->getName()) : std::string("NULL");
-    file << "EffectiveSan::\nLLVM IR Location (Inlined): [" << M.getSourceFileName() << 
-              "][Caller Name: " << CallerName  <<
-              "][Allocator Name: " <<  std::string(Name) << 
-              "][isCall: " << Call.isCall() << 
-              "][isInvoke: " << Call.isInvoke() << 
-              "][isMustTailCall: " << Call.isMustTailCall() << 
-              "][isTailCall: " << Call.isTailCall() << 
-              "][Location: " << line << "," << col << 
-              "][Inlined Location: " << I.getDebugLoc().getInlinedLocation().first << "," << I.getDebugLoc().getInlinedLocation().second << 
-              "][BB ID: " << (uint64_t)I.getParent() << 
-              "][Inst ID: " << (uint64_t)(&I) <<
-              "]\n";
-
-    I.print(file); file << "\n";
+    if (Ctx->ORE != nullptr)
+      emitTyCheRemark(*I.getFunction(), &I, Name, "REALLOC", ReallocTID, line,
+                      col, getTyCheSiteID(I));
     
+    llvm::raw_ostream &APfile = sidecarRecord(SIDECAR_HEAP_AP);
     APfile << "FILENAME " << M.getSourceFileName() << "\n" << ReallocMetaID;
-    APfile << std::dec << "METAID " << 
+    APfile << "METAID " << 
         M.getSourceFileName()  <<
         "#" << loc << 
         "#" << "REALLOC" << 
@@ -4632,35 +5837,21 @@ static void replaceMalloc(llvm::Module &M, llvm::Function &F,
         "#" << CallerName <<
         "#" << I.getDebugLoc().getInlinedLocation().first << 
         "#" << I.getDebugLoc().getInlinedLocation().second << 
-        "#" << (uint64_t)I.getParent() << 
-        "#" << (uint64_t)(&I) <<
+        "#" << getTyCheBlockID(*I.getParent()) << 
+        "#" << getTyCheSiteID(I) <<
         "#" << ReallocTID <<  
         "\n" ;
+    addTyCheDBSite(M, llvm::tyche::DBSiteRealloc, Name, CallerName,
+                   "REALLOC",
+                   nullptr, ReallocTID,
+                   line, col, I.getDebugLoc().getInlinedLocation().first,
+                   I.getDebugLoc().getInlinedLocation().second,
+                   getTyCheBlockID(*I.getParent()), getTyCheSiteID(I));
 
 
 
-    file.close();
 
-    llvm::LLVMContext& C = I.getContext();
-    llvm::SmallVector<llvm::Metadata *, 32> Ops;
-    Ops.push_back(llvm::MDString::get(C, std::to_string(line)));
-    Ops.push_back(llvm::MDString::get(C, std::to_string(col))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string((uint64_t)(/*Meta*/ 0)))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string(/*tInfo.hashes.find(type_meta)->second.i64[0]*/ 0)));
-    Ops.push_back(llvm::MDString::get(C, std::to_string(/*tInfo.hashes.find(type_meta)->second.i64[1]*/ 0))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string(I.getDebugLoc().getInlinedLocation().first)));
-    Ops.push_back(llvm::MDString::get(C, std::to_string(I.getDebugLoc().getInlinedLocation().second))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string((uint64_t)((uint64_t)I.getParent()))));
-    Ops.push_back(llvm::MDString::get(C, std::to_string((uint64_t)(&I)))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string(ReallocTID))); 
-    Ops.push_back(llvm::MDString::get(C, Name));
-    Ops.push_back(llvm::MDString::get(C, /*tInfo.names.find(type_meta)->second*/ "REALLOC"));
-    Ops.push_back(llvm::MDString::get(C, CallerName));
-
-    
-    auto *N =  llvm::MDTuple::get(C, Ops);
-    //llvm::MDNode* N = llvm::MDNode::get(C, llvm::MDString::get(C, std::to_string(123456)));
-    I.setMetadata("TYCHE_MD", N);
+    setTyCheMD(I, "REALLOC", nullptr, 0, ReallocTID, line, col);
 
   } else if (Call.getNumArgOperands() == 1 &&
              (Name == "free" || Name == "_ZdlPv" || // delete
@@ -4674,9 +5865,6 @@ static void replaceMalloc(llvm::Module &M, llvm::Function &F,
     // builder.CreateCall(NewFn, {I.getOperand(0)});
     // Dels.push_back(&I);
     // return;
-    std::ofstream APfile(APFileName, std::ios::app);
-    std::error_code EC;
-    llvm::raw_fd_ostream file("tyche.debug", EC, llvm::sys::fs::F_Append);
 
     const llvm::DebugLoc &location = I.getDebugLoc();
     std::string loc = "";
@@ -4697,23 +5885,13 @@ static void replaceMalloc(llvm::Module &M, llvm::Function &F,
 
     llvm::Function * caller =  I.getParent()->getParent();
     auto CallerName = (caller != nullptr) ? std::string(caller->getName()) : std::string("NULL");
-    file << "EffectiveSan::\nLLVM IR Location (Inlined): [" << M.getSourceFileName() << 
-              "][Caller Name: " << CallerName  <<
-              "][Allocator Name: " <<  std::string(Name) << 
-              "][isCall: " << Call.isCall() << 
-              "][isInvoke: " << Call.isInvoke() << 
-              "][isMustTailCall: " << Call.isMustTailCall() << 
-              "][isTailCall: " << Call.isTailCall() << 
-              "][Location: " << line << "," << col << 
-              "][Inlined Location: " << I.getDebugLoc().getInlinedLocation().first << "," << I.getDebugLoc().getInlinedLocation().second << 
-              "][BB ID: " << (uint64_t)I.getParent() << 
-              "][Inst ID: " << (uint64_t)(&I) <<
-              "]\n";
-
-    I.print(file); file << "\n";
+    if (Ctx->ORE != nullptr)
+      emitTyCheRemark(*I.getFunction(), &I, Name, "FREE", FreeTID, line,
+                      col, getTyCheSiteID(I));
     
+    llvm::raw_ostream &APfile = sidecarRecord(SIDECAR_HEAP_AP);
     APfile << "FILENAME " << M.getSourceFileName() << "\n" <<  FreeMetaID;
-    APfile << std::dec << "METAID " << 
+    APfile << "METAID " << 
         M.getSourceFileName()  <<
         "#" << loc << 
         "#" << "FREE" << 
@@ -4724,35 +5902,21 @@ static void replaceMalloc(llvm::Module &M, llvm::Function &F,
         "#" << CallerName <<
         "#" << I.getDebugLoc().getInlinedLocation().first << 
         "#" << I.getDebugLoc().getInlinedLocation().second << 
-        "#" << (uint64_t)I.getParent() << 
-        "#" << (uint64_t)(&I) <<
+        "#" << getTyCheBlockID(*I.getParent()) << 
+        "#" << getTyCheSiteID(I) <<
         "#" << FreeTID <<  
         "\n" ;
+    addTyCheDBSite(M, llvm::tyche::DBSiteFree, Name, CallerName,
+                   "FREE",
+                   nullptr, FreeTID,
+                   line, col, I.getDebugLoc().getInlinedLocation().first,
+                   I.getDebugLoc().getInlinedLocation().second,
+                   getTyCheBlockID(*I.getParent()), getTyCheSiteID(I));
 
 
 
-    file.close();
-
-    llvm::LLVMContext& C = I.getContext();
-    llvm::SmallVector<llvm::Metadata *, 32> Ops;
-    Ops.push_back(llvm::MDString::get(C, std::to_string(line)));
-    Ops.push_back(llvm::MDString::get(C, std::to_string(col))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string((uint64_t)(/*Meta*/ 0)))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string(/*tInfo.hashes.find(type_meta)->second.i64[0])*/ 0)));
-    Ops.push_back(llvm::MDString::get(C, std::to_string(/*tInfo.hashes.find(type_meta)->second.i64[1])*/ 0))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string(I.getDebugLoc().getInlinedLocation().first)));
-    Ops.push_back(llvm::MDString::get(C, std::to_string(I.getDebugLoc().getInlinedLocation().second))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string((uint64_t)((uint64_t)I.getParent()))));
-    Ops.push_back(llvm::MDString::get(C, std::to_string((uint64_t)(&I)))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string(FreeTID))); 
-    Ops.push_back(llvm::MDString::get(C, Name));
-    Ops.push_back(llvm::MDString::get(C, /*tInfo.names.find(type_meta)->second*/ "FREE"));
-    Ops.push_back(llvm::MDString::get(C, CallerName));
 
-    
-    auto *N =  llvm::MDTuple::get(C, Ops);
-    //llvm::MDNode* N = llvm::MDNode::get(C, llvm::MDString::get(C, std::to_string(123456)));
-    I.setMetadata("TYCHE_MD", N);
+    setTyCheMD(I, "FREE", nullptr, 0, FreeTID, line, col);
 
   } else
     return;
@@ -4782,13 +5946,12 @@ static void replaceMalloc(llvm::Module &M, llvm::Function &F,
 
 static EFFECTIVE_NOINLINE void replaceMallocs(llvm::Module &M,
                                               llvm::Function &F,
+                                              const FunctionAnalysis &FA,
                                               TypeInfo &tInfo,
                                               CheckInfo &cInfo) {
   std::vector<llvm::Instruction *> Dels;
-  for (auto &BB : F) {
-    for (auto &I : BB)
-      replaceMalloc(M, F, I, tInfo, cInfo, Dels);
-  }
+  for (auto *I : FA.Calls)
+    replaceMalloc(M, F, *I, tInfo, cInfo, FA, Dels);
   // for (auto I : Dels)
   //   I->eraseFromParent();
 }
@@ -4802,7 +5965,7 @@ static EFFECTIVE_NOINLINE void replaceMallocs(llvm::Module &M,
  */
 static void replaceAlloca(llvm::Module &M, llvm::Function &F,
                           llvm::Instruction &I, TypeInfo &tInfo,
-                          CheckInfo &cInfo,
+                          CheckInfo &cInfo, const FunctionAnalysis &FA,
                           std::set<llvm::Instruction *> &Ignore,
                           std::vector<llvm::Instruction *> &Dels) {
   // if (option_no_stack)
@@ -4886,9 +6049,6 @@ static void replaceAlloca(llvm::Module &M, llvm::Function &F,
   // llvm::Value *Ptr = builder.CreateBitCast(Ptr0, Alloca->getType());
 
 
-    std::ofstream StackAPfile(StackAPFileName, std::ios::app);
-    std::error_code EC;
-    llvm::raw_fd_ostream file("tyche.debug", EC, llvm::sys::fs::F_Append);
 
     // STEP (4) Insert the object meta data:
     llvm::DIType *AllocTy = nullptr;
@@ -4896,24 +6056,13 @@ static void replaceAlloca(llvm::Module &M, llvm::Function &F,
     llvm::Constant *Meta = getDeclaredType(entry, M, &I, tInfo, &AllocTy, true);
     if (Meta == nullptr) {
       // Fall back on type inference.
-      Meta = inferMallocType(entry, M, F, &I, tInfo, &AllocTy);
+      Meta = inferMallocType(entry, M, FA, &I, tInfo, &AllocTy);
     }
-    Meta = (Meta == nullptr ? Int8TyMeta : Meta);
+    Meta = (Meta == nullptr ? Ctx->Int8TyMeta : Meta);
 
 
-    llvm::DIType* type_meta = nullptr;
-    bool found = false;
     uint64_t tid = 0;
-    for (auto &elem : tInfo.cache)
-    {
-      if (elem.second.typeMeta == Meta)
-      {
-          type_meta = elem.first;
-          tid = elem.second.type_id;     
-          found = true;
-      }
-
-    }
+    llvm::DIType* type_meta = lookupTypeMeta(tInfo, Meta, tid);
 
 
 
@@ -4936,62 +6085,41 @@ static void replaceAlloca(llvm::Module &M, llvm::Function &F,
 
     llvm::Function * caller =  I.getParent()->getParent();
     auto CallerName = (caller != nullptr) ? std::string(caller->getName()) : std::string("NULL");
-    file << "EffectiveSan::\nLLVM IR Location (Inlined): [" << M.getSourceFileName() << 
-              "][Caller Name: " << CallerName  <<
-              "][Allocator Name: " <<  "Alloca" << 
-              "][Location: " << line << "," << col << 
-              "][Inlined Location: " << I.getDebugLoc().getInlinedLocation().first << "," << I.getDebugLoc().getInlinedLocation().second << 
-              "][BB ID: " << (uint64_t)I.getParent() << 
-              "][Inst ID: " << (uint64_t)(&I) <<
-              "]\n";
-
-    I.print(file); file << "\n";
+    if (Ctx->ORE != nullptr)
+      emitTyCheRemark(*I.getFunction(), &I, "Alloca",
+                      tInfo.names.find(type_meta)->second, tid, line, col,
+                      getTyCheSiteID(I));
     
-    StackAPfile << TypeIDCache[tid-1];
-    StackAPfile << std::dec << "METAID " << 
+    llvm::raw_ostream &StackAPfile = sidecarRecord(SIDECAR_STACK_AP);
+    StackAPfile << getTyCheLayoutDump(Meta);
+    StackAPfile << "METAID " << 
         M.getSourceFileName()  <<
         "#" << loc << 
         "#" << tInfo.names.find(type_meta)->second << 
-        "#" << std::to_string((uint64_t)(Meta)) <<
+        "#" << std::to_string(getTyCheMetaID(Meta)) <<
         "#" << tInfo.hashes.find(type_meta)->second.i64[0] <<
         "#" << tInfo.hashes.find(type_meta)->second.i64[1] << 
         "#" << "Alloca" <<
         "#" << CallerName <<
         "#" << I.getDebugLoc().getInlinedLocation().first << 
         "#" << I.getDebugLoc().getInlinedLocation().second << 
-        "#" << (uint64_t)I.getParent() << 
-        "#" << (uint64_t)(&I) <<
+        "#" << getTyCheBlockID(*I.getParent()) << 
+        "#" << getTyCheSiteID(I) <<
         "#" << tid <<  
         "\n" ;
+    addTyCheDBSite(M, llvm::tyche::DBSiteStack, "Alloca", CallerName,
+                   tInfo.names.find(type_meta)->second,
+                   &tInfo.hashes.find(type_meta)->second, tid,
+                   line, col, I.getDebugLoc().getInlinedLocation().first,
+                   I.getDebugLoc().getInlinedLocation().second,
+                   getTyCheBlockID(*I.getParent()), getTyCheSiteID(I));
 
 
 
-    file.close();
-
-    llvm::LLVMContext& C = I.getContext();
-    llvm::SmallVector<llvm::Metadata *, 32> Ops;
-
-    Ops.push_back(llvm::MDString::get(C, M.getSourceFileName()));
-    Ops.push_back(llvm::MDString::get(C, std::to_string(line)));
-    Ops.push_back(llvm::MDString::get(C, std::to_string(col))); 
-    Ops.push_back(llvm::MDString::get(C, tInfo.names.find(type_meta)->second));
-    Ops.push_back(llvm::MDString::get(C, std::to_string((uint64_t)(Meta)))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string(tInfo.hashes.find(type_meta)->second.i64[0])));
-    Ops.push_back(llvm::MDString::get(C, std::to_string(tInfo.hashes.find(type_meta)->second.i64[1]))); 
-    Ops.push_back(llvm::MDString::get(C, "Alloca"));
-    Ops.push_back(llvm::MDString::get(C, CallerName));
-    Ops.push_back(llvm::MDString::get(C, std::to_string(I.getDebugLoc().getInlinedLocation().first)));
-    Ops.push_back(llvm::MDString::get(C, std::to_string(I.getDebugLoc().getInlinedLocation().second)));
-    Ops.push_back(llvm::MDString::get(C, std::to_string((uint64_t)((uint64_t)I.getParent()))));
-    Ops.push_back(llvm::MDString::get(C, std::to_string((uint64_t)(&I)))); 
-    Ops.push_back(llvm::MDString::get(C, std::to_string(tid)));
-
 
-
-    
-    auto *N =  llvm::MDTuple::get(C, Ops);
-    //llvm::MDNode* N = llvm::MDNode::get(C, llvm::MDString::get(C, std::to_string(123456)));
-    I.setMetadata("TYCHE_MD", N);
+    setTyCheMD(I, tInfo.names.find(type_meta)->second,
+               &tInfo.hashes.find(type_meta)->second,
+               getTyCheMetaID(Meta), tid, line, col);
   // llvm::Value *MetaPtr =
   //     builder.CreateBitCast(MirroredPtr, ObjMetaTy->getPointerTo());
   // llvm::Value *TypePtr =
@@ -5053,13 +6181,12 @@ static void replaceAlloca(llvm::Module &M, llvm::Function &F,
 }
 
 static EFFECTIVE_NOINLINE void
-replaceAllocas(llvm::Module &M, llvm::Function &F, TypeInfo &tInfo,
-               CheckInfo &cInfo, std::set<llvm::Instruction *> &Ignore) {
+replaceAllocas(llvm::Module &M, llvm::Function &F, const FunctionAnalysis &FA,
+               TypeInfo &tInfo, CheckInfo &cInfo,
+               std::set<llvm::Instruction *> &Ignore) {
   std::vector<llvm::Instruction *> Dels;
-  for (auto &BB : F) {
-    for (auto &I : BB)
-      replaceAlloca(M, F, I, tInfo, cInfo, Ignore, Dels);
-  }
+  for (auto *I : FA.Allocas)
+    replaceAlloca(M, F, *I, tInfo, cInfo, FA, Ignore, Dels);
   // for (auto I : Dels)
   //   I->eraseFromParent();
 }
@@ -5137,7 +6264,7 @@ static void replaceGlobal(llvm::Module &M, llvm::GlobalVariable &GV,
   NewName += GV.getName();
   llvm::LLVMContext &Cxt = M.getContext();
   llvm::StructType *NewTy = llvm::StructType::create(
-      Cxt, {ObjMetaTy, Ty}, "EFFECTIVE_GLOBAL_WRAPPER", /*isPacked=*/true);
+      Cxt, {Ctx->ObjMetaTy, Ty}, "EFFECTIVE_GLOBAL_WRAPPER", /*isPacked=*/true);
   llvm::Constant *NewGV0 = M.getOrInsertGlobal(NewName, NewTy);
   llvm::GlobalVariable *NewGV = llvm::dyn_cast<llvm::GlobalVariable>(NewGV0);
   if (NewGV == nullptr)
@@ -5156,9 +6283,9 @@ static void replaceGlobal(llvm::Module &M, llvm::GlobalVariable &GV,
   NewGV->setSection(section);
   TypeEntry entry;
   llvm::Constant *Meta = getDeclaredType(entry, M, &GV, tInfo, nullptr, true);
-  Meta = (Meta == nullptr ? Int8TyMeta : Meta);
+  Meta = (Meta == nullptr ? Ctx->Int8TyMeta : Meta);
   llvm::Constant *MetaInit = llvm::ConstantStruct::get(
-      ObjMetaTy,
+      Ctx->ObjMetaTy,
       {Meta, llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt), objSize)});
   llvm::Constant *Init = nullptr;
   if (GV.hasInitializer())
@@ -5282,16 +6409,16 @@ static EFFECTIVE_NOINLINE void emitInstrumentationFunctions(llvm::Module &M) {
                               llvm::AtomicOrdering::SequentiallyConsistent);
 #endif /* EFFECTIVE_FLAG_PROFILE */
       llvm::Value *IPtr = builder.CreatePtrToInt(Ptr, builder.getInt64Ty());
-      llvm::Value *Ptrs = llvm::UndefValue::get(BoundsTy);
+      llvm::Value *Ptrs = llvm::UndefValue::get(Ctx->BoundsTy);
       Ptrs = builder.CreateInsertElement(Ptrs, IPtr, builder.getInt32(0));
       Ptrs = builder.CreateInsertElement(Ptrs, IPtr, builder.getInt32(1));
-      llvm::Value *Sizes = llvm::UndefValue::get(BoundsTy);
+      llvm::Value *Sizes = llvm::UndefValue::get(Ctx->BoundsTy);
       LB = builder.CreateAdd(LB, builder.getInt64(1));
       Sizes = builder.CreateInsertElement(Sizes, LB, builder.getInt32(0));
       Sizes = builder.CreateInsertElement(Sizes, UB, builder.getInt32(1));
       Bounds = builder.CreateSub(Bounds, Sizes);
       llvm::Value *Cmp = builder.CreateICmpSGT(Ptrs, Bounds);
-      Cmp = builder.CreateSExt(Cmp, BoundsTy);
+      Cmp = builder.CreateSExt(Cmp, Ctx->BoundsTy);
       llvm::Type *Int8x16Ty = llvm::VectorType::get(builder.getInt8Ty(), 16);
       Cmp = builder.CreateBitCast(Cmp, Int8x16Ty);
       llvm::Intrinsic::ID Id = llvm::Intrinsic::getIntrinsicForGCCBuiltin(
@@ -5313,7 +6440,7 @@ static EFFECTIVE_NOINLINE void emitInstrumentationFunctions(llvm::Module &M) {
       llvm::Value *Size = builder.CreateSub(UB, LB);
       Size = builder.CreateAdd(Size, builder.getInt64(1));
       llvm::Constant *BoundsErr = M.getOrInsertFunction(
-          "effective_bounds_error", builder.getVoidTy(), BoundsTy,
+          "effective_bounds_error", builder.getVoidTy(), Ctx->BoundsTy,
           builder.getInt8PtrTy(), builder.getInt64Ty(), nullptr);
       builder.CreateCall(BoundsErr, {Bounds0, Ptr, Size});
 #else /* EFFECTIVE_FLAG_COUNT */
@@ -5352,9 +6479,9 @@ static EFFECTIVE_NOINLINE void emitInstrumentationFunctions(llvm::Module &M) {
     llvm::BasicBlock *Entry = llvm::BasicBlock::Create(M.getContext(), "", F);
     llvm::IRBuilder<> builder(Entry);
     llvm::Value *Cmp = builder.CreateICmpSGT(BoundsA, BoundsB);
-    Cmp = builder.CreateSExt(Cmp, BoundsTy);
+    Cmp = builder.CreateSExt(Cmp, Ctx->BoundsTy);
     llvm::Value *Mask =
-        M.getOrInsertGlobal("EFFECTIVE_BOUNDS_NEG_1_0", BoundsTy);
+        M.getOrInsertGlobal("EFFECTIVE_BOUNDS_NEG_1_0", Ctx->BoundsTy);
     Mask = builder.CreateAlignedLoad(Mask, 16);
     Cmp = builder.CreateXor(Cmp, Mask);
     llvm::Type *Int8x16Ty = llvm::VectorType::get(builder.getInt8Ty(), 16);
@@ -5365,7 +6492,7 @@ static EFFECTIVE_NOINLINE void emitInstrumentationFunctions(llvm::Module &M) {
         "x86", "__builtin_ia32_pblendvb128");
     llvm::Function *I = llvm::Intrinsic::getDeclaration(&M, Id);
     llvm::Value *Bounds = builder.CreateCall(I, {BoundsA, BoundsB, Cmp});
-    Bounds = builder.CreateBitCast(Bounds, BoundsTy);
+    Bounds = builder.CreateBitCast(Bounds, Ctx->BoundsTy);
     builder.CreateRet(Bounds);
 
     F->addFnAttr(llvm::Attribute::AlwaysInline);
@@ -5393,12 +6520,102 @@ static EFFECTIVE_NOINLINE void emitInstrumentationFunctions(llvm::Module &M) {
   }
 }
 
+/*****************************************************************************/
+/* DROPPED ANNOTATIONS                                                       */
+/*****************************************************************************/
+
+/*
+ * The pass runs after the optimization pipeline, so it depends on the
+ * optimizer keeping the "effectiveSan" annotations inserted by the frontend
+ * (see LLVMContext::MD_effective_san).  A transform that drops one anyway
+ * goes unnoticed, since getDeclaredTypeAnnotation() silently falls back to
+ * the (weaker) IR type.  Under -effective-verify-metadata, the tracking pass
+ * runs first and takes a handle on every annotated instruction.  A handle
+ * follows its instruction through replaceAllUsesWith() and is cleared when
+ * the instruction is deleted, so when the EffectiveSan pass runs, every
+ * handle that still points to an unannotated instruction is a dropped
+ * annotation.
+ *
+ * The tracking pass and the EffectiveSan pass may run in different pass
+ * managers, so the handles are kept in a process-wide table keyed by the
+ * module.
+ */
+struct AnnotationHandle final : public llvm::CallbackVH {
+  AnnotationHandle(llvm::Value *V) : llvm::CallbackVH(V) {}
+  void allUsesReplacedWith(llvm::Value *New) override { setValPtr(New); }
+};
+
+typedef std::vector<AnnotationHandle> AnnotationHandles;
+
+static std::mutex AnnotationHandlesLock;
+static std::map<const llvm::Module *, AnnotationHandles> AnnotationHandlesMap;
+
+/*
+ * Take a handle on every annotated instruction of F.
+ */
+static void trackAnnotations(llvm::Function &F) {
+  AnnotationHandles Handles;
+  for (auto &BB : F)
+    for (auto &I : BB)
+      if (I.getMetadata(llvm::LLVMContext::MD_effective_san) != nullptr)
+        Handles.emplace_back(&I);
+  if (Handles.empty())
+    return;
+
+  std::lock_guard<std::mutex> Lock(AnnotationHandlesLock);
+  AnnotationHandles &ModuleHandles = AnnotationHandlesMap[F.getParent()];
+  ModuleHandles.insert(ModuleHandles.end(), Handles.begin(), Handles.end());
+}
+
+/*
+ * Report the annotations of M dropped since trackAnnotations(), and forget
+ * the handles.
+ */
+static void reportDroppedAnnotations(llvm::Module &M) {
+  AnnotationHandles Handles;
+  {
+    std::lock_guard<std::mutex> Lock(AnnotationHandlesLock);
+    auto i = AnnotationHandlesMap.find(&M);
+    if (i == AnnotationHandlesMap.end())
+      return;
+    Handles.swap(i->second);
+    AnnotationHandlesMap.erase(i);
+  }
+
+  llvm::SmallPtrSet<llvm::Value *, 32> Seen;
+  for (auto &Handle : Handles) {
+    llvm::Value *V = Handle;
+    auto *I = llvm::dyn_cast_or_null<llvm::Instruction>(V);
+    if (I == nullptr || I->getParent() == nullptr ||
+        I->getMetadata(llvm::LLVMContext::MD_effective_san) != nullptr ||
+        !Seen.insert(I).second)
+      continue;
+    count(COUNTER_DROPPED_ANNOTATIONS);
+    std::string msg("type annotation dropped by the optimizer for value (");
+    msg += showValue(I);
+    msg += ") in function ";
+    msg += I->getFunction()->getName();
+    M.getContext().diagnose(DiagnosticInfoEffectiveSan(msg));
+  }
+}
+
 /*****************************************************************************/
 /* LLVM INTERFACE                                                            */
 /*****************************************************************************/
 
 namespace {
 
+/*
+ * Process-wide initialization, done once for all modules.
+ */
+static std::once_flag InitFlag;
+
+static void initEffectiveSan(void) {
+  if (getenv("EFFECTIVE_DEBUG") != nullptr)
+    option_debug = true;
+  DiagnosticInfoEffectiveSan::init();
+}
+
 /*
  * EffectiveSan LLVM pass.
  */
@@ -5408,15 +6625,12 @@ struct EffectiveSan : public llvm::ModulePass {
   EffectiveSan() : ModulePass(ID) {}
 
   virtual bool runOnModule(llvm::Module &M) {
-    // Ahmad
-    static int count = 0;
-    static bool runOnce = false;
-    if (runOnce)
-      EFFECTIVE_FATAL_ERROR("invoked twice");
-    runOnce = true;
-
-    if (getenv("EFFECTIVE_DEBUG") != nullptr)
-      option_debug = true;
+    std::call_once(InitFlag, initEffectiveSan);
+
+    std::unique_ptr<EffectiveContext> Context(new EffectiveContext);
+    Context->Module = &M;
+    Ctx = Context.get();
+
     if (option_debug) {
       fprintf(stderr, "       __  __           _   _           ____\n");
       fprintf(stderr,
@@ -5435,10 +6649,11 @@ struct EffectiveSan : public llvm::ModulePass {
       std::vector<std::string> Paths;
       Paths.push_back(option_blacklist);
       std::string err;
-      Blacklist = llvm::SpecialCaseList::create(Paths, err);
+      Ctx->Blacklist = llvm::SpecialCaseList::create(Paths, err);
     }
 
-    DiagnosticInfoEffectiveSan::init();
+    if (option_verify_metadata)
+      reportDroppedAnnotations(M);
 
     if (option_debug) {
       std::string outName(M.getName());
@@ -5448,9 +6663,12 @@ struct EffectiveSan : public llvm::ModulePass {
       M.print(out, nullptr);
     }
 
-    Module = &M;
     llvm::LLVMContext &Cxt = M.getContext();
 
+    initPhaseTimers();
+    openSidecars(M);
+    initTyCheTypeIDs(M);
+
 
 
     /*
@@ -5458,28 +6676,33 @@ struct EffectiveSan : public llvm::ModulePass {
      */
     initializeTyCheCapabilityTypes(M);
 
-    BoundsTy = llvm::VectorType::get(llvm::Type::getInt64Ty(Cxt), 2);
-    InfoEntryTy = llvm::StructType::create(Cxt, "EFFECTIVE_INFO_ENTRY");
-    InfoTy = makeTypeInfoType(M, 0);
-    EntryTy = llvm::StructType::create(Cxt, "EFFECTIVE_ENTRY");
+    Ctx->BoundsTy = llvm::VectorType::get(llvm::Type::getInt64Ty(Cxt), 2);
+    Ctx->InfoEntryTy = llvm::StructType::create(Cxt, "EFFECTIVE_INFO_ENTRY");
+    Ctx->InfoTy = makeTypeInfoType(M, 0);
+    Ctx->EntryTy = llvm::StructType::create(Cxt, "EFFECTIVE_ENTRY");
+    Ctx->ColdEntryTy = llvm::StructType::create(Cxt, "EFFECTIVE_ENTRY_COLD");
+    Ctx->PeriodTy = llvm::StructType::create(Cxt,
+        {llvm::Type::getInt64Ty(Cxt), llvm::Type::getInt64Ty(Cxt),
+         llvm::Type::getInt64Ty(Cxt), llvm::Type::getInt64Ty(Cxt)},
+        "EFFECTIVE_PERIOD");
 
-    // make a dummy array of TyCheCacheLineEntryTy and pass it
-    llvm::ArrayType *DummyTyCheSectionLayoutTy = llvm::ArrayType::get(TyCheCacheLineEntryTy, 0);
-    TypeTy = makeTypeMetaType(M, 0, DummyTyCheSectionLayoutTy);
+    Ctx->TypeTy = makeTypeMetaType(M, 0);
 
     std::vector<llvm::Type *> Fields;
-    Fields.push_back(llvm::Type::getInt8PtrTy(Cxt)); /* name */
-    Fields.push_back(llvm::Type::getInt64Ty(Cxt)); /* offset */
     Fields.push_back(llvm::Type::getInt64Ty(Cxt)); /* type */
     Fields.push_back(llvm::Type::getInt64Ty(Cxt)); /* _pad */
-    Fields.push_back(BoundsTy);                    /* bounds */
-    EntryTy->setBody(Fields, false);
+    Fields.push_back(Ctx->BoundsTy);                    /* bounds */
+    Ctx->EntryTy->setBody(Fields, false);
+    Fields.clear();
+    Fields.push_back(llvm::Type::getInt8PtrTy(Cxt)); /* name */
+    Fields.push_back(llvm::Type::getInt64Ty(Cxt)); /* offset */
+    Ctx->ColdEntryTy->setBody(Fields, false);
     Fields.clear();
-    Fields.push_back(InfoTy->getPointerTo());      /* type */
+    Fields.push_back(Ctx->InfoTy->getPointerTo());      /* type */
     Fields.push_back(llvm::Type::getInt32Ty(Cxt)); /* flags */
     Fields.push_back(llvm::Type::getInt64Ty(Cxt)); /* lb */
     Fields.push_back(llvm::Type::getInt64Ty(Cxt)); /* ub */
-    InfoEntryTy->setBody(Fields, false);
+    Ctx->InfoEntryTy->setBody(Fields, false);
 
 
     std::vector<llvm::Constant *> Elems;
@@ -5491,24 +6714,26 @@ struct EffectiveSan : public llvm::ModulePass {
     llvm::Constant *TypeEntryName = llvm::ConstantExpr::getPointerCast(TypeEntryNameGV, llvm::Type::getInt8PtrTy(Cxt));
     Elems.push_back(TypeEntryName);
     Elems.push_back(llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt), UINT64_MAX));
+    Ctx->EmptyColdEntry = llvm::ConstantStruct::get(Ctx->ColdEntryTy, Elems);
+    Elems.clear();
     Elems.push_back(llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt), EFFECTIVE_ENTRY_EMPTY_HASH));
     Elems.push_back(llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt), 0));
     Elems.push_back(llvm::ConstantVector::get(
         {llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt), 0),
          llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt), 0)}));
-    EmptyEntry = llvm::ConstantStruct::get(EntryTy, Elems);
+    Ctx->EmptyEntry = llvm::ConstantStruct::get(Ctx->EntryTy, Elems);
 
 
 
-    ObjMetaTy = llvm::StructType::get(Cxt, /*isPacked=*/true);
-    ObjMetaTy->setName("EFFECTIVE_META");
+    Ctx->ObjMetaTy = llvm::StructType::get(Cxt, /*isPacked=*/true);
+    Ctx->ObjMetaTy->setName("EFFECTIVE_META");
     Fields.clear();
-    Fields.push_back(TypeTy->getPointerTo());      /* type */
+    Fields.push_back(Ctx->TypeTy->getPointerTo());      /* type */
     Fields.push_back(llvm::Type::getInt64Ty(Cxt)); /* size */
     Fields.push_back(llvm::Type::getInt64Ty(Cxt)); /* pid */
     Fields.push_back(llvm::Type::getInt64Ty(Cxt)); /* number of allocations */
     Fields.push_back(llvm::Type::getInt64Ty(Cxt)); /* number of freed allocations */
-    ObjMetaTy->setBody(Fields, false);
+    Ctx->ObjMetaTy->setBody(Fields, false);
 
 
 
@@ -5523,54 +6748,76 @@ struct EffectiveSan : public llvm::ModulePass {
     TyCheInfo tycheInfo;
 
     llvm::DIBuilder builder(M);
-    Int8Ty = builder.createBasicType("char", CHAR_BIT,
+    Ctx->Int8Ty = builder.createBasicType("char", CHAR_BIT,
                                      llvm::dwarf::DW_ATE_signed_char);
-    Int16Ty = builder.createBasicType("short", 2 * CHAR_BIT,
+    Ctx->Int16Ty = builder.createBasicType("short", 2 * CHAR_BIT,
                                       llvm::dwarf::DW_ATE_signed);
-    Int32Ty = builder.createBasicType("int", 4 * CHAR_BIT,
+    Ctx->Int32Ty = builder.createBasicType("int", 4 * CHAR_BIT,
                                       llvm::dwarf::DW_ATE_signed);
-    Int64Ty = builder.createBasicType("long long int", 8 * CHAR_BIT,
+    Ctx->Int64Ty = builder.createBasicType("long long int", 8 * CHAR_BIT,
                                       llvm::dwarf::DW_ATE_signed);
-    Int128Ty = builder.createBasicType("__int128", 16 * CHAR_BIT,
+    Ctx->Int128Ty = builder.createBasicType("__int128", 16 * CHAR_BIT,
                                        llvm::dwarf::DW_ATE_signed);
 
 
 
 
-    Int8TyMeta = compileType(M, nullptr, tInfo).typeMeta;
+    Ctx->Int8TyMeta = compileType(M, nullptr, tInfo).typeMeta;
 
-    Int8PtrTy = builder.createPointerType(Int8Ty, sizeof(void *) * CHAR_BIT);
-    BoundsNonFat = llvm::ConstantVector::get(
+    Ctx->Int8PtrTy = builder.createPointerType(Ctx->Int8Ty,
+                                               sizeof(void *) * CHAR_BIT);
+    Ctx->BoundsNonFat = llvm::ConstantVector::get(
         {llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt), 0),
          llvm::ConstantInt::get(llvm::Type::getInt64Ty(Cxt), INTPTR_MAX)});
 
 
     /*
-     * Main instrumentation loop:
+     * Main instrumentation loop.  The functions are analyzed first (possibly
+     * in parallel) and then rewritten in module order:
      */
 
+    std::vector<llvm::Function *> Funcs;
     for (auto &F : M) {
         if (F.isDeclaration())
           continue;
         if (isBlacklisted("fun", F.getName()))
           continue;
+        Funcs.push_back(&F);
+    }
+    std::vector<FunctionAnalysis> Analyses;
+    analyzeFunctions(Funcs, Analyses);
+
+    for (size_t i = 0; i < Funcs.size(); i++) {
+        llvm::Function &F = *Funcs[i];
+        const FunctionAnalysis &FA = Analyses[i];
         CheckInfo cInfo;
         std::set<llvm::Instruction *> Ignore;
+        if (llvm::areTyCheRemarksEnabled())
+          Ctx->ORE.reset(new llvm::OptimizationRemarkEmitter(&F));
 
         /*
         * Step #1: emit malloc() type metadata:
         */
-        replaceMallocs(M, F, tInfo, cInfo);
+        {
+          PhaseRegion Timer(PHASE_REPLACE_MALLOCS);
+          replaceMallocs(M, F, FA, tInfo, cInfo);
+        }
 
         /*
         * Step #2: emit allocas type metadata:
         */
-        replaceAllocas(M, F, tInfo, cInfo, Ignore);
+        {
+          PhaseRegion Timer(PHASE_REPLACE_ALLOCAS);
+          replaceAllocas(M, F, FA, tInfo, cInfo, Ignore);
+        }
         
         /*
         * Step #3: emit function arguments and return type metadata:
         */
-        emitTyCHEFunctionInfo(M, F, tInfo, cInfo, Ignore);
+        {
+          PhaseRegion Timer(PHASE_FUNCTION_INFO);
+          emitTyCHEFunctionInfo(M, F, tInfo, cInfo, Ignore);
+        }
 
         /*
         * Step #3: Do bounds-check/type-check instrumentation:
@@ -5586,6 +6833,7 @@ struct EffectiveSan : public llvm::ModulePass {
         //   }
         // }
     }
+    Ctx->ORE.reset();
     
 
 
@@ -5638,9 +6886,14 @@ struct EffectiveSan : public llvm::ModulePass {
     // }
    
 
-    metaCache.clear();
-    infoCache.clear();
-    
+    emitTypeStrings(M);
+    closeSidecars();
+    writeTyCheDB(M);
+    if (option_debug)
+      printSidecarStats(llvm::errs(), M);
+    if (option_stats_json.getNumOccurrences() > 0)
+      writeStatsJSON(M);
+    pruneLayoutCache();
 
 
 
@@ -5652,10 +6905,32 @@ struct EffectiveSan : public llvm::ModulePass {
       M.print(out, nullptr);
     }
 
+    Ctx = nullptr;
     return true;
   }
 };
 
+/*
+ * Records the annotated instructions of each function for
+ * reportDroppedAnnotations().  Does nothing without
+ * -effective-verify-metadata.
+ */
+struct EffectiveSanTrackMetadata : public llvm::FunctionPass {
+  static char ID;
+
+  EffectiveSanTrackMetadata() : FunctionPass(ID) {}
+
+  bool runOnFunction(llvm::Function &F) override {
+    if (option_verify_metadata)
+      trackAnnotations(F);
+    return false;
+  }
+
+  void getAnalysisUsage(llvm::AnalysisUsage &AU) const override {
+    AU.setPreservesAll();
+  }
+};
+
 } // namespace
 
 
@@ -5665,8 +6940,16 @@ struct EffectiveSan : public llvm::ModulePass {
  */
 char EffectiveSan::ID = 0;
 
+char EffectiveSanTrackMetadata::ID = 0;
+
 static llvm::RegisterPass<EffectiveSan> X("effectivesan", "EffectiveSan pass");
+static llvm::RegisterPass<EffectiveSanTrackMetadata>
+    Y("effectivesan-track-metadata",
+      "Record EffectiveSan type annotations for -effective-verify-metadata");
 
 namespace llvm {
 ModulePass *createEffectiveSanPass() { return new EffectiveSan(); }
+FunctionPass *createEffectiveSanTrackMetadataPass() {
+  return new EffectiveSanTrackMetadata();
+}
 } // namespace llvm
@@ -0,0 +1,409 @@
+//===- TyCheDB.cpp - TyChe allocation-point database ----------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Writer and reader for the binary allocation-point database.  See
+// TyCheDB.h for the file layout.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Instrumentation/TyCheDB.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MathExtras.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace llvm;
+using namespace llvm::tyche;
+
+static Error makeDBError(const Twine &Msg) {
+  return make_error<StringError>(Msg, inconvertibleErrorCode());
+}
+
+//===----------------------------------------------------------------------===//
+// DBWriter
+//===----------------------------------------------------------------------===//
+
+DBWriter::DBWriter() {
+  // Offset 0 is reserved for the empty string.
+  Strings.push_back('\0');
+  StringOffsets[""] = 0;
+}
+
+uint32_t DBWriter::addString(StringRef S) {
+  auto I = StringOffsets.insert(std::make_pair(S, (uint32_t)Strings.size()));
+  if (I.second) {
+    Strings.append(S.begin(), S.end());
+    Strings.push_back('\0');
+  }
+  return I.first->second;
+}
+
+void DBWriter::addType(DBType T, ArrayRef<DBField> TypeFields) {
+  T.FirstField = Fields.size();
+  T.NumFields = TypeFields.size();
+  Fields.insert(Fields.end(), TypeFields.begin(), TypeFields.end());
+  Types.push_back(T);
+}
+
+void DBWriter::addSite(const DBSite &S) { Sites.push_back(S); }
+
+void DBWriter::addTypeRemap(uint64_t From, uint64_t To) {
+  TypeRemaps.push_back({From, To});
+}
+
+static void writePadding(raw_ostream &OS, uint64_t &Pos) {
+  static const char Zeros[8] = {0};
+  uint64_t Aligned = alignTo(Pos, 8);
+  OS.write(Zeros, Aligned - Pos);
+  Pos = Aligned;
+}
+
+template <typename T>
+static void writeArray(raw_ostream &OS, uint64_t &Pos, const T *Data,
+                       size_t N) {
+  OS.write(reinterpret_cast<const char *>(Data), N * sizeof(T));
+  Pos += N * sizeof(T);
+  writePadding(OS, Pos);
+}
+
+/// Build an index of \p Records by ID: open addressing with linear probing,
+/// load factor <= 1/2.  Duplicate IDs keep the first record.
+template <typename T>
+static std::vector<uint32_t> buildIndex(const std::vector<T> &Records) {
+  std::vector<uint32_t> Index;
+  if (Records.empty())
+    return Index;
+  Index.assign(NextPowerOf2(2 * Records.size() - 1), DBNoIndex);
+  uint64_t Mask = Index.size() - 1;
+  for (size_t i = 0; i < Records.size(); i++) {
+    uint64_t Slot = hashID(Records[i].ID) & Mask;
+    while (Index[Slot] != DBNoIndex && Records[Index[Slot]].ID != Records[i].ID)
+      Slot = (Slot + 1) & Mask;
+    if (Index[Slot] == DBNoIndex)
+      Index[Slot] = i;
+  }
+  return Index;
+}
+
+void DBWriter::write(raw_ostream &OS) const {
+  std::vector<uint32_t> TypeIndex = buildIndex(Types);
+
+  // Type remaps: sorted by original ID, first remap wins.
+  std::vector<DBTypeRemap> Remaps(TypeRemaps);
+  std::stable_sort(Remaps.begin(), Remaps.end(),
+                   [](const DBTypeRemap &A, const DBTypeRemap &B) {
+                     return A.From < B.From;
+                   });
+  Remaps.erase(std::unique(Remaps.begin(), Remaps.end(),
+                           [](const DBTypeRemap &A, const DBTypeRemap &B) {
+                             return A.From == B.From;
+                           }),
+               Remaps.end());
+
+  std::vector<uint32_t> SiteIndex = buildIndex(Sites);
+
+  DBHeader H;
+  memset(&H, 0, sizeof(H));
+  H.Magic = DBMagic;
+  H.Version = DBVersion;
+  H.HeaderSize = sizeof(DBHeader);
+  uint64_t Pos = sizeof(DBHeader);
+  H.NumTypes = Types.size();
+  H.TypesOffset = Pos;
+  Pos = alignTo(Pos + Types.size() * sizeof(DBType), 8);
+  H.NumFields = Fields.size();
+  H.FieldsOffset = Pos;
+  Pos = alignTo(Pos + Fields.size() * sizeof(DBField), 8);
+  H.NumSites = Sites.size();
+  H.SitesOffset = Pos;
+  Pos = alignTo(Pos + Sites.size() * sizeof(DBSite), 8);
+  H.TypeIndexSize = TypeIndex.size();
+  H.TypeIndexOffset = Pos;
+  Pos = alignTo(Pos + TypeIndex.size() * sizeof(uint32_t), 8);
+  H.SiteIndexSize = SiteIndex.size();
+  H.SiteIndexOffset = Pos;
+  Pos = alignTo(Pos + SiteIndex.size() * sizeof(uint32_t), 8);
+  H.NumTypeRemaps = Remaps.size();
+  H.TypeRemapsOffset = Pos;
+  Pos = alignTo(Pos + Remaps.size() * sizeof(DBTypeRemap), 8);
+  H.StringsSize = Strings.size();
+  H.StringsOffset = Pos;
+  H.MetaBytes = MetaBytes;
+  H.DenseMetaBytes = DenseMetaBytes;
+
+  Pos = 0;
+  writeArray(OS, Pos, &H, 1);
+  writeArray(OS, Pos, Types.data(), Types.size());
+  writeArray(OS, Pos, Fields.data(), Fields.size());
+  writeArray(OS, Pos, Sites.data(), Sites.size());
+  writeArray(OS, Pos, TypeIndex.data(), TypeIndex.size());
+  writeArray(OS, Pos, SiteIndex.data(), SiteIndex.size());
+  writeArray(OS, Pos, Remaps.data(), Remaps.size());
+  writeArray(OS, Pos, Strings.data(), Strings.size());
+}
+
+Error DBWriter::writeToFile(StringRef Path) const {
+  // Write to a temporary file and rename it into place so that readers never
+  // observe a partially written database.
+  int FD;
+  SmallString<128> TmpPath;
+  if (std::error_code EC =
+          sys::fs::createUniqueFile(Path + "-%%%%%%.tmp", FD, TmpPath))
+    return makeDBError("failed to create \"" + Path + "\": " + EC.message());
+  {
+    raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    write(OS);
+    OS.close();
+    if (OS.has_error()) {
+      OS.clear_error();
+      sys::fs::remove(TmpPath);
+      return makeDBError("failed to write \"" + TmpPath + "\"");
+    }
+  }
+  if (std::error_code EC = sys::fs::rename(TmpPath, Path)) {
+    sys::fs::remove(TmpPath);
+    return makeDBError("failed to rename \"" + TmpPath + "\" to \"" + Path +
+                       "\": " + EC.message());
+  }
+  return Error::success();
+}
+
+//===----------------------------------------------------------------------===//
+// DBReader
+//===----------------------------------------------------------------------===//
+
+Expected<std::unique_ptr<DBReader>> DBReader::create(const Twine &Path) {
+  auto BufferOrErr = MemoryBuffer::getFile(Path, /*FileSize=*/-1,
+                                           /*RequiresNullTerminator=*/false);
+  if (std::error_code EC = BufferOrErr.getError())
+    return makeDBError("failed to open \"" + Path + "\": " + EC.message());
+  return create(std::move(BufferOrErr.get()));
+}
+
+Expected<std::unique_ptr<DBReader>>
+DBReader::create(std::unique_ptr<MemoryBuffer> Buffer) {
+  std::unique_ptr<DBReader> Reader(new DBReader(std::move(Buffer)));
+  if (Error E = Reader->validate())
+    return std::move(E);
+  return std::move(Reader);
+}
+
+static bool inBounds(uint64_t Offset, uint64_t Count, uint64_t Size,
+                     uint64_t BufferSize) {
+  if (Offset % 8 != 0)
+    return false;
+  if (Offset > BufferSize)
+    return false;
+  return Count <= (BufferSize - Offset) / Size;
+}
+
+Error DBReader::validate() {
+  StringRef Name = Buffer->getBufferIdentifier();
+  const char *Start = Buffer->getBufferStart();
+  uint64_t Size = Buffer->getBufferSize();
+  if (Size < sizeof(DBHeader))
+    return makeDBError(Name + ": file too small");
+  if (reinterpret_cast<uintptr_t>(Start) % 8 != 0)
+    return makeDBError(Name + ": misaligned buffer");
+  Header = reinterpret_cast<const DBHeader *>(Start);
+  if (Header->Magic != DBMagic)
+    return makeDBError(Name + ": not a TyChe database");
+  if (Header->Version != DBVersion)
+    return makeDBError(Name + ": unsupported version " +
+                       Twine(Header->Version) + " (expected " +
+                       Twine(DBVersion) + ")");
+  if (Header->HeaderSize != sizeof(DBHeader))
+    return makeDBError(Name + ": bad header size");
+  if (!inBounds(Header->TypesOffset, Header->NumTypes, sizeof(DBType), Size) ||
+      !inBounds(Header->FieldsOffset, Header->NumFields, sizeof(DBField),
+                Size) ||
+      !inBounds(Header->SitesOffset, Header->NumSites, sizeof(DBSite), Size) ||
+      !inBounds(Header->TypeIndexOffset, Header->TypeIndexSize,
+                sizeof(uint32_t), Size) ||
+      !inBounds(Header->SiteIndexOffset, Header->SiteIndexSize,
+                sizeof(uint32_t), Size) ||
+      !inBounds(Header->TypeRemapsOffset, Header->NumTypeRemaps,
+                sizeof(DBTypeRemap), Size) ||
+      !inBounds(Header->StringsOffset, Header->StringsSize, 1, Size))
+    return makeDBError(Name + ": section out of bounds");
+  if (Header->TypeIndexSize & (Header->TypeIndexSize - 1))
+    return makeDBError(Name + ": bad type index size");
+  if (Header->SiteIndexSize & (Header->SiteIndexSize - 1))
+    return makeDBError(Name + ": bad site index size");
+  if (Header->StringsSize == 0 ||
+      Start[Header->StringsOffset + Header->StringsSize - 1] != '\0')
+    return makeDBError(Name + ": unterminated string pool");
+  for (const DBType &T : types())
+    if (uint64_t(T.FirstField) + T.NumFields > Header->NumFields)
+      return makeDBError(Name + ": type " + Twine(T.ID) +
+                         " has out of bounds fields");
+  return Error::success();
+}
+
+template <typename T>
+static ArrayRef<T> getArray(const MemoryBuffer &Buffer, uint64_t Offset,
+                            uint64_t Count) {
+  return ArrayRef<T>(
+      reinterpret_cast<const T *>(Buffer.getBufferStart() + Offset), Count);
+}
+
+ArrayRef<DBType> DBReader::types() const {
+  return getArray<DBType>(*Buffer, Header->TypesOffset, Header->NumTypes);
+}
+
+ArrayRef<DBField> DBReader::fields() const {
+  return getArray<DBField>(*Buffer, Header->FieldsOffset, Header->NumFields);
+}
+
+ArrayRef<DBField> DBReader::fields(const DBType &T) const {
+  return fields().slice(T.FirstField, T.NumFields);
+}
+
+ArrayRef<DBSite> DBReader::sites() const {
+  return getArray<DBSite>(*Buffer, Header->SitesOffset, Header->NumSites);
+}
+
+ArrayRef<DBTypeRemap> DBReader::typeRemaps() const {
+  return getArray<DBTypeRemap>(*Buffer, Header->TypeRemapsOffset,
+                               Header->NumTypeRemaps);
+}
+
+/// Find the record with ID \p ID in \p Records through \p Index (see
+/// buildIndex()).
+template <typename T>
+static const T *lookupIndex(ArrayRef<uint32_t> Index, ArrayRef<T> Records,
+                            uint64_t ID) {
+  if (Index.empty())
+    return nullptr;
+  uint64_t Mask = Index.size() - 1;
+  uint64_t Slot = hashID(ID) & Mask;
+  for (uint64_t i = 0; i < Index.size(); i++) {
+    uint32_t Idx = Index[Slot];
+    if (Idx >= Records.size())
+      return nullptr;
+    if (Records[Idx].ID == ID)
+      return &Records[Idx];
+    Slot = (Slot + 1) & Mask;
+  }
+  return nullptr;
+}
+
+const DBType *DBReader::lookupType(uint64_t ID) const {
+  return lookupIndex(getArray<uint32_t>(*Buffer, Header->TypeIndexOffset,
+                                        Header->TypeIndexSize),
+                     types(), ID);
+}
+
+uint64_t DBReader::remapTypeID(uint64_t ID) const {
+  ArrayRef<DBTypeRemap> Remaps = typeRemaps();
+  auto I = std::lower_bound(
+      Remaps.begin(), Remaps.end(), ID,
+      [](const DBTypeRemap &R, uint64_t ID) { return R.From < ID; });
+  if (I == Remaps.end() || I->From != ID)
+    return ID;
+  return I->To;
+}
+
+const DBSite *DBReader::lookupSite(uint64_t ID) const {
+  return lookupIndex(getArray<uint32_t>(*Buffer, Header->SiteIndexOffset,
+                                        Header->SiteIndexSize),
+                     sites(), ID);
+}
+
+StringRef DBReader::getString(uint32_t Offset) const {
+  if (Offset >= Header->StringsSize)
+    return StringRef();
+  return StringRef(Buffer->getBufferStart() + Header->StringsOffset + Offset);
+}
+
+//===----------------------------------------------------------------------===//
+// CallSiteTable
+//===----------------------------------------------------------------------===//
+
+Error CallSiteTable::addSection(StringRef Contents, uint64_t Address) {
+  if (Contents.size() % sizeof(CallSiteRecord) != 0)
+    return makeDBError("truncated " + Twine(CallSiteSectionName) +
+                       " section");
+  size_t Begin = Sites.size();
+  for (size_t Pos = 0; Pos < Contents.size(); Pos += sizeof(CallSiteRecord)) {
+    CallSiteRecord R;
+    memcpy(&R, Contents.data() + Pos, sizeof(R));
+    Sites.push_back(
+        CallSiteInfo{Address + Pos + R.PCOffset, R.SiteID, R.TypeID, R.Kind});
+  }
+
+  // The records of each object are in address order already; keep the whole
+  // table sorted as the sections of several objects (or binaries) come in.
+  auto ByPC = [](const CallSiteInfo &A, const CallSiteInfo &B) {
+    return A.PC < B.PC;
+  };
+  auto Mid = Sites.begin() + Begin;
+  if (!std::is_sorted(Mid, Sites.end(), ByPC))
+    std::sort(Mid, Sites.end(), ByPC);
+  std::inplace_merge(Sites.begin(), Mid, Sites.end(), ByPC);
+  return Error::success();
+}
+
+const CallSiteInfo *CallSiteTable::lookup(uint64_t PC) const {
+  auto I = std::lower_bound(
+      Sites.begin(), Sites.end(), PC,
+      [](const CallSiteInfo &S, uint64_t PC) { return S.PC < PC; });
+  if (I == Sites.end() || I->PC != PC)
+    return nullptr;
+  return &*I;
+}
+
+//===----------------------------------------------------------------------===//
+// FrameTable
+//===----------------------------------------------------------------------===//
+
+Error FrameTable::addSection(StringRef Contents, uint64_t Address) {
+  size_t Begin = Frames.size();
+  auto truncated = [&]() {
+    Frames.erase(Frames.begin() + Begin, Frames.end());
+    return makeDBError("truncated " + Twine(FrameSectionName) + " section");
+  };
+  size_t Pos = 0;
+  while (Pos < Contents.size()) {
+    FrameRecord R;
+    if (Contents.size() - Pos < sizeof(R))
+      return truncated();
+    memcpy(&R, Contents.data() + Pos, sizeof(R));
+    uint64_t SlotsSize = (uint64_t)R.NumSlots * sizeof(FrameSlotRecord);
+    if (Contents.size() - Pos - sizeof(R) < SlotsSize)
+      return truncated();
+
+    FrameInfo Frame;
+    Frame.Function = Address + Pos + R.FunctionOffset;
+    Frame.Slots.resize(R.NumSlots);
+    memcpy(Frame.Slots.data(), Contents.data() + Pos + sizeof(R), SlotsSize);
+    Frames.push_back(std::move(Frame));
+    Pos += sizeof(R) + SlotsSize;
+  }
+
+  auto ByFunction = [](const FrameInfo &A, const FrameInfo &B) {
+    return A.Function < B.Function;
+  };
+  auto Mid = Frames.begin() + Begin;
+  if (!std::is_sorted(Mid, Frames.end(), ByFunction))
+    std::sort(Mid, Frames.end(), ByFunction);
+  std::inplace_merge(Frames.begin(), Mid, Frames.end(), ByFunction);
+  return Error::success();
+}
+
+const FrameInfo *FrameTable::lookup(uint64_t Function) const {
+  auto I = std::lower_bound(
+      Frames.begin(), Frames.end(), Function,
+      [](const FrameInfo &F, uint64_t Function) {
+        return F.Function < Function;
+      });
+  if (I == Frames.end() || I->Function != Function)
+    return nullptr;
+  return &*I;
+}
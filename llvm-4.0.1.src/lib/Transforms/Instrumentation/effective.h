@@ -84,7 +84,15 @@
 
 #define NUMBER_OF_ENTRIES_IN_EACH_CACHELINE 14
 #define TYCHE_OFFSETS_DEVIDER     32
-#define TYCHE_NUMBER_OF_TYPES     128
+/*
+ * TyChe type IDs are module-ranged: the low TYCHE_TYPE_ID_LOCAL_BITS bits
+ * number the types of one module, the upper bits identify the module.  IDs
+ * are renumbered densely when the per-module databases are merged.  Under
+ * LTO the IDs are derived from the type hash instead and have the top bit
+ * set.
+ */
+#define TYCHE_TYPE_ID_LOCAL_BITS  24
+#define TYCHE_TYPE_ID_MODULE_BITS 39
 #define TYCHE_NUMBER_OF_SECTIONS  8
 #define TYCHE_NUMBER_OF_OFFSETS() ((1 * 16384 * 32)/TYCHE_OFFSETS_DEVIDER) // 1MB objects devided into 32B ofssets   
 
@@ -101,20 +109,101 @@ typedef struct EFFECTIVE_TYPE EFFECTIVE_TYPE;
 typedef intptr_t EFFECTIVE_BOUNDS EFFECTIVE_VECTOR_SIZE(16);
 
 /*
- * Type meta-data layout entry.
+ * Type meta-data layout entry.  Only the fields read by the type check are
+ * kept here, so that two entries share a cacheline; the rest are in the
+ * parallel EFFECTIVE_TYPE::cold array.
  */
 struct EFFECTIVE_ENTRY
 {
-    const char *name;
-    uint64_t offset;
     uint64_t hash;              // Layout entry type.
     uint64_t _pad;              // Padding.
     EFFECTIVE_BOUNDS bounds;    // Sub-object bounds.
 } ;
 typedef struct EFFECTIVE_ENTRY EFFECTIVE_ENTRY;
 
+/*
+ * Rarely used part of a layout entry.
+ */
+struct EFFECTIVE_ENTRY_COLD
+{
+    const char *name;
+    uint64_t offset;
+};
+typedef struct EFFECTIVE_ENTRY_COLD EFFECTIVE_ENTRY_COLD;
+
 #define EFFECTIVE_ENTRY_EMPTY_HASH  EFFECTIVE_TYPE_NIL_HASH
 
+/*
+ * A large inner array of a type, whose elements are described by the layout
+ * entries of element 0 only.  The type check normalizes an offset into the
+ * array to element 0, and looks up the entries of element 0 with the number
+ * of enclosing periods ("level") stored above EFFECTIVE_PERIOD_SHIFT in the
+ * offset.  Periods are listed outermost first and terminated by a zero span.
+ */
+struct EFFECTIVE_PERIOD
+{
+    uint64_t base;              // Offset of element 0.
+    uint64_t span;              // Size of the array.
+    uint64_t stride;            // Size of an element.
+    size_t magic;               // EFFECTIVE_MAGIC(stride)
+};
+typedef struct EFFECTIVE_PERIOD EFFECTIVE_PERIOD;
+
+#define EFFECTIVE_PERIOD_SHIFT      48
+#define EFFECTIVE_PERIOD_OFFSET(x)  ((x) & (((uint64_t)1 << EFFECTIVE_PERIOD_SHIFT) - 1))
+#define EFFECTIVE_PERIOD_LEVEL(x)   ((x) >> EFFECTIVE_PERIOD_SHIFT)
+#define EFFECTIVE_MAX_PERIOD_DEPTH  4
+
+/*
+ * Layout hash table formats (EFFECTIVE_TYPE::format).
+ *
+ * EFFECTIVE_LAYOUT_PROBE tables use linear probing: a lookup starts at
+ * (hval & mask) and scans until it finds the entry or an empty one.
+ *
+ * EFFECTIVE_LAYOUT_PERFECT tables are built by hash-and-displace so that
+ * every entry sits at the single slot effective_perfect_entry() computes for
+ * its hash.  The table is followed by one 16-bit displacement per
+ * (1 << EFFECTIVE_PERFECT_DISP_SHIFT) slots.  A lookup is thus one probe of
+ * the table, plus one of the displacements.
+ *
+ * EFFECTIVE_LAYOUT_GROUPED tables are split into groups of
+ * EFFECTIVE_GROUP_SIZE slots and followed by one tag byte per slot: the low
+ * EFFECTIVE_GROUP_TAG_BITS bits of the entry's hash, or EFFECTIVE_GROUP_EMPTY.
+ * A lookup compares the tags of the entry's home group against its tag with
+ * one SSE2 compare, checks the full hash of the matching slots only, and
+ * moves on to the next group only if the group is full.  The tags start at
+ * layout[length], which is 16-byte aligned.
+ */
+#define EFFECTIVE_LAYOUT_PROBE          0
+#define EFFECTIVE_LAYOUT_PERFECT        1
+#define EFFECTIVE_LAYOUT_GROUPED        2
+
+#define EFFECTIVE_PERFECT_DISP_SHIFT    2
+#define EFFECTIVE_PERFECT_MULT          0x9E3779B97F4A7C15ull
+
+/*
+ * The slot of hash `hval' under displacement `d'.  This must not be linear
+ * in `hval' (e.g. (hval ^ d) & mask), or entries that collide would collide
+ * under every displacement.
+ */
+#define EFFECTIVE_PERFECT_SLOT(hval, d, mask)                               \
+    (((((hval) ^ (d)) * EFFECTIVE_PERFECT_MULT) >> 32) & (mask))
+
+#define EFFECTIVE_GROUP_SHIFT           4
+#define EFFECTIVE_GROUP_SIZE            (1 << EFFECTIVE_GROUP_SHIFT)
+#define EFFECTIVE_GROUP_TAG_BITS        7
+#define EFFECTIVE_GROUP_EMPTY           0x80
+
+#define EFFECTIVE_GROUP_TAG(hval)                                           \
+    ((uint8_t)((hval) & ((1 << EFFECTIVE_GROUP_TAG_BITS) - 1)))
+#define EFFECTIVE_GROUP_HOME(hval, mask)                                    \
+    (((hval) >> EFFECTIVE_GROUP_TAG_BITS) & ((mask) >> EFFECTIVE_GROUP_SHIFT))
+
+/*
+ * The tags of one EFFECTIVE_LAYOUT_GROUPED group.
+ */
+typedef char EFFECTIVE_TAGS EFFECTIVE_VECTOR_SIZE(EFFECTIVE_GROUP_SIZE);
+
 typedef struct TYCHE_METADATA_CACHELINE TYCHE_METADATA_CACHELINE;
 /** If a meta type capability needs more than 32 bits, we can use multiple entry in the cacheline. 
  * It is still better than having 64 bits type capabilities which is too much for most type. */
@@ -136,10 +225,40 @@ struct TYCHE_METADATA_CACHELINE {
     TYCHE_METADATA_CACHELINE * next_cacheline;
 };
 
-struct TyCheSectionMetadata {
-    struct TYCHE_METADATA_CACHELINE TypeMetadata[TYCHE_NUMBER_OF_OFFSETS()]; // an aligned 64 Byte CacheLine
+/*
+ * Sparse TyChe meta-data of a type.  The offsets of a type are divided into
+ * TYCHE_OFFSETS_DEVIDER-byte buckets; only the cachelines of populated
+ * buckets are emitted.  bucket[b] is the index in lines[] of the section 0
+ * cacheline of bucket b, or TYCHE_EMPTY_BUCKET.  The cachelines of the
+ * higher sections of a bucket are reached through next_cacheline.
+ */
+#define TYCHE_EMPTY_BUCKET        0xFFFF
+
+typedef struct TYCHE_SPARSE_META TYCHE_SPARSE_META;
+struct TYCHE_SPARSE_META {
+    TYCHE_METADATA_CACHELINE *lines;    // Populated section 0 cachelines.
+    uint32_t num_buckets;               // Last populated bucket + 1.
+    uint16_t bucket[];                  // Bucket -> index into lines[].
 };
 
+/*
+ * Find the section 0 cacheline for the given offset, or NULL if the type has
+ * no entries in its bucket.  Takes at most three memory accesses (the header,
+ * the bucket entry and the cacheline), and the header shares a cacheline with
+ * the first 26 bucket entries.
+ */
+static inline TYCHE_METADATA_CACHELINE *tyche_meta_lookup(
+    const TYCHE_SPARSE_META *meta, size_t offset)
+{
+    size_t b = offset / TYCHE_OFFSETS_DEVIDER;
+    if (b >= meta->num_buckets)
+        return NULL;
+    uint16_t idx = meta->bucket[b];
+    if (idx == TYCHE_EMPTY_BUCKET)
+        return NULL;
+    return meta->lines + idx;
+}
+
 /*
  * Type meta-data representation.
  */
@@ -147,7 +266,7 @@ typedef struct EFFECTIVE_INFO EFFECTIVE_INFO;
 
 struct EFFECTIVE_TYPE
 {
-    TYCHE_METADATA_CACHELINE *tyche_meta; // TyCHE metadata
+    const TYCHE_SPARSE_META *tyche_meta; // TyCHE metadata
     uint64_t hash;              // Type-specific hash value.
     uint64_t hash2;             // 2nd type-specific hash value.
     uint32_t size;              // sizeof(T)
@@ -158,10 +277,59 @@ struct EFFECTIVE_TYPE
     size_t mask;                // Mask for layout[]
     const EFFECTIVE_INFO *info; // Type info
     uint64_t next;              // Hash of next type coercion
+    const EFFECTIVE_ENTRY_COLD *cold; // cold[i] is the rest of layout[i]
+    const EFFECTIVE_PERIOD *periods; // Periodic inner arrays, or NULL
     uint32_t length;            // length of layout
+    uint32_t format;            // EFFECTIVE_LAYOUT_*
     EFFECTIVE_ENTRY layout[];   // The layout hash table.
 };
 
+/*
+ * Find the only slot that may hold the entry with hash `hval' in a
+ * EFFECTIVE_LAYOUT_PERFECT layout.
+ */
+static inline const EFFECTIVE_ENTRY *effective_perfect_entry(
+    const EFFECTIVE_TYPE *t, uint64_t hval)
+{
+    const uint16_t *disp = (const uint16_t *)(t->layout + t->length);
+    uint64_t d = disp[(hval >> 32) & (t->mask >> EFFECTIVE_PERFECT_DISP_SHIFT)];
+    return t->layout + EFFECTIVE_PERFECT_SLOT(hval, d, t->mask);
+}
+
+/*
+ * Find the entry with hash `hval' in a EFFECTIVE_LAYOUT_GROUPED layout, or
+ * NULL.  Empty tags have the top bit set, so the movemask of the tags
+ * themselves tells whether the group has a free slot, i.e., whether the
+ * entry could have been placed further on.
+ */
+static inline const EFFECTIVE_ENTRY *effective_grouped_entry(
+    const EFFECTIVE_TYPE *t, uint64_t hval)
+{
+    const EFFECTIVE_TAGS *tags = (const EFFECTIVE_TAGS *)(t->layout + t->length);
+    size_t gmask = t->mask >> EFFECTIVE_GROUP_SHIFT;
+    size_t g = EFFECTIVE_GROUP_HOME(hval, t->mask);
+    EFFECTIVE_TAGS tag = {0};
+    tag += (char)EFFECTIVE_GROUP_TAG(hval);
+    for (size_t i = 0; i <= gmask; i++)
+    {
+        EFFECTIVE_TAGS group = tags[g];
+        unsigned match = (unsigned)__builtin_ia32_pmovmskb128(
+            (EFFECTIVE_TAGS)(group == tag));
+        while (match != 0)
+        {
+            const EFFECTIVE_ENTRY *entry = t->layout +
+                (g << EFFECTIVE_GROUP_SHIFT) + __builtin_ctz(match);
+            if (entry->hash == hval)
+                return entry;
+            match &= match - 1;
+        }
+        if (__builtin_ia32_pmovmskb128(group) != 0)
+            return NULL;
+        g = (g + 1) & gmask;
+    }
+    return NULL;
+}
+
 /*
  * Per-allocated-object meta-data representation.
  */
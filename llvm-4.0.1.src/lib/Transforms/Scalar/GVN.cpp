@@ -1612,7 +1612,7 @@ bool GVN::PerformLoadPRE(LoadInst *LI, AvailValInBlkVect &ValuesPerBlock,
     // EFFECTIVESAN
     auto *Ty = getEffectiveSanType(LI);
     if (Ty)
-      NewLoad->setMetadata("effectiveSan", Ty);
+      NewLoad->setMetadata(LLVMContext::MD_effective_san, Ty);
 
     // We do not propagate the old load's debug location, because the new
     // load now lives in a different BB, and we want to avoid a jumpy line
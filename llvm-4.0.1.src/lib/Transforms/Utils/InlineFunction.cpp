@@ -1268,7 +1268,7 @@ static Value *HandleByValArgument(Value *Arg, Instruction *TheCall,
   DIType *Ty = getEffectiveSanType(Arg);
   auto *I = dyn_cast<Instruction>(NewAlloca);
   if (Ty != nullptr && I != nullptr)
-    I->setMetadata("effectiveSan", Ty);
+    I->setMetadata(LLVMContext::MD_effective_san, Ty);
 
   // Uses of the argument in the function should use our new alloca
   // instead.
@@ -1450,7 +1450,7 @@ BasicBlock *llvm::changeToInvokeAndSplitBasicBlock(CallInst *CI,
   II->setAttributes(CI->getAttributes());
   DIType *Ty = getEffectiveSanType(CI);     // EFFECTIVESAN
   if (Ty != nullptr)
-    II->setMetadata("effectiveSan", Ty);
+    II->setMetadata(LLVMContext::MD_effective_san, Ty);
 
   // Make sure that anything using the call now uses the invoke!  This also
   // updates the CallGraph if present, because it uses a WeakVH.
@@ -1725,6 +1725,9 @@ void llvm::combineMetadata(Instruction *K, const Instruction *J,
       case LLVMContext::MD_invariant_group:
         // Preserve !invariant.group in K.
         break;
+      case LLVMContext::MD_effective_san:
+        // Preserve the EffectiveSan type annotation in K.
+        break;
       case LLVMContext::MD_align:
         K->setMetadata(Kind, 
           MDNode::getMostGenericAlignmentOrDereferenceable(JMD, KMD));
@@ -1746,10 +1749,11 @@ void llvm::combineMetadata(Instruction *K, const Instruction *J,
     if (isa<LoadInst>(K) || isa<StoreInst>(K))
       K->setMetadata(LLVMContext::MD_invariant_group, JMD);
 
-  // EFFECTIVESAN
-  auto *Ty = getEffectiveSanType(J);
-  if (Ty)
-    K->setMetadata("effectiveSan", Ty);
+  // EFFECTIVESAN: K computes the same value as J, so if only J is annotated
+  // then J's annotation applies to K as well.
+  if (!K->getMetadata(LLVMContext::MD_effective_san))
+    if (auto *Ty = J->getMetadata(LLVMContext::MD_effective_san))
+      K->setMetadata(LLVMContext::MD_effective_san, Ty);
 }
 
 void llvm::combineMetadataForCSE(Instruction *K, const Instruction *J) {
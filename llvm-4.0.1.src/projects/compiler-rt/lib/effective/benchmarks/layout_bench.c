@@ -0,0 +1,334 @@
+// Mini-benchmark for EffectiveSan: slow-path layout lookups in each of the
+// EFFECTIVE_LAYOUT_* formats.
+//
+// Builds `ntypes' synthetic types of `nentries' layout entries each, sized
+// like the pass sizes them (20-35% full), and times the lookups done by the
+// slow path of effective_type_check(): the query itself, then the coercion
+// and (char[]) fallbacks on a miss.  `hits' is the percentage of queries that
+// match on the first lookup.  Where the kernel exposes hardware counters,
+// the L1 data cache read misses per lookup are reported too.
+//
+// Build and run with:
+//   cc -O2 -msse4.2 -I.. layout_bench.c -o layout_bench
+//   ./layout_bench [nentries] [ntypes] [hits]
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "effective.h"
+
+static const int kNumQueries = 1 << 16;
+static const int kNumIter = 100;
+
+struct Key {
+    uint64_t hash;
+    uint64_t offset;
+};
+
+static uint64_t rng_state = 0x2545F4914F6CDD1Dull;
+static uint64_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Open a counter of L1 data cache read misses, or return -1.
+static int l1_open(void) {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_L1D |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+static size_t layout_length(size_t n) {
+    size_t len = 2;
+    while ((double)n / len > 0.35)
+        len *= 2;
+    while (len > 2 && (double)n / len < 0.20)
+        len /= 2;
+    return len;
+}
+
+static EFFECTIVE_TYPE *alloc_type(size_t len, size_t tail, uint32_t format,
+                                  uint64_t seed) {
+    size_t size = sizeof(EFFECTIVE_TYPE) + len * sizeof(EFFECTIVE_ENTRY) + tail;
+    EFFECTIVE_TYPE *t;
+    if (posix_memalign((void **)&t, 64, size) != 0)
+        abort();
+    memset(t, 0, size);
+    t->hash2 = seed;
+    t->length = len;
+    t->format = format;
+    for (size_t i = 0; i < len; i++)
+        t->layout[i].hash = EFFECTIVE_ENTRY_EMPTY_HASH;
+    return t;
+}
+
+// The seed only XORs every hash with the same value, so some collisions
+// survive any seed.  Like compileType(), double the table after
+// kMaxSeeds failed seeds.
+static const int kMaxSeeds = 64;
+
+// EFFECTIVE_LAYOUT_PROBE, with the overflow slots of the runtime probe loop.
+static EFFECTIVE_TYPE *build_probe(const struct Key *ks, size_t n) {
+    size_t len = layout_length(n);
+    for (uint64_t seed = rng(), tries = 1;; seed = rng(), tries++) {
+        if (tries % kMaxSeeds == 0)
+            len *= 2;
+        EFFECTIVE_TYPE *t = alloc_type(len + EFFECTIVE_MAX_PROBE + 1, 0,
+                                       EFFECTIVE_LAYOUT_PROBE, seed);
+        t->mask = len - 1;
+        size_t i;
+        for (i = 0; i < n; i++) {
+            uint64_t h = EFFECTIVE_HASH(seed, ks[i].hash, ks[i].offset);
+            EFFECTIVE_ENTRY *e = t->layout + (h & t->mask);
+            size_t p = 0;
+            while (e[p].hash != EFFECTIVE_ENTRY_EMPTY_HASH &&
+                   p < EFFECTIVE_MAX_PROBE)
+                p++;
+            if (p >= EFFECTIVE_MAX_PROBE)
+                break;
+            e[p].hash = h;
+        }
+        if (i == n)
+            return t;
+        free(t);
+    }
+}
+
+// EFFECTIVE_LAYOUT_PERFECT, built like buildPerfectLayout() in the pass.
+static EFFECTIVE_TYPE *build_perfect(const struct Key *ks, size_t n) {
+    size_t len = layout_length(n), ndisp = len >> EFFECTIVE_PERFECT_DISP_SHIFT;
+    size_t *count = calloc(ndisp + 1, sizeof(size_t));
+    size_t *order = calloc(ndisp, sizeof(size_t));
+    uint64_t *hs = calloc(n, sizeof(uint64_t));
+    size_t *slots = calloc(n, sizeof(size_t));
+    for (uint64_t seed = rng();; seed = rng()) {
+        EFFECTIVE_TYPE *t = alloc_type(len, ndisp * sizeof(uint16_t),
+                                       EFFECTIVE_LAYOUT_PERFECT, seed);
+        uint16_t *disp = (uint16_t *)(t->layout + len);
+        t->mask = len - 1;
+        memset(count, 0, (ndisp + 1) * sizeof(size_t));
+        for (size_t i = 0; i < n; i++) {
+            hs[i] = EFFECTIVE_HASH(seed, ks[i].hash, ks[i].offset);
+            count[(hs[i] >> 32) & (ndisp - 1)]++;
+        }
+        for (size_t g = 0; g < ndisp; g++)
+            order[g] = g;
+        for (size_t i = 1; i < ndisp; i++)     // Largest group first.
+            for (size_t j = i; j > 0 && count[order[j]] > count[order[j-1]];
+                 j--) {
+                size_t tmp = order[j];
+                order[j] = order[j-1];
+                order[j-1] = tmp;
+            }
+        bool ok = true;
+        for (size_t gi = 0; ok && gi < ndisp && count[order[gi]] > 0; gi++) {
+            size_t g = order[gi];
+            ok = false;
+            for (uint64_t d = 0; !ok && d <= UINT16_MAX; d++) {
+                size_t m = 0;
+                ok = true;
+                for (size_t i = 0; ok && i < n; i++) {
+                    if (((hs[i] >> 32) & (ndisp - 1)) != g)
+                        continue;
+                    size_t s = EFFECTIVE_PERFECT_SLOT(hs[i], d, t->mask);
+                    ok = (t->layout[s].hash == EFFECTIVE_ENTRY_EMPTY_HASH);
+                    for (size_t j = 0; ok && j < m; j++)
+                        ok = (slots[j] != s);
+                    slots[m++] = s;
+                }
+                if (!ok)
+                    continue;
+                disp[g] = d;
+                for (size_t i = 0, j = 0; i < n; i++)
+                    if (((hs[i] >> 32) & (ndisp - 1)) == g)
+                        t->layout[slots[j++]].hash = hs[i];
+            }
+        }
+        if (ok) {
+            free(count); free(order); free(hs); free(slots);
+            return t;
+        }
+        free(t);
+    }
+}
+
+// EFFECTIVE_LAYOUT_GROUPED, built like buildGroupedLayout() in the pass.
+static EFFECTIVE_TYPE *build_grouped(const struct Key *ks, size_t n) {
+    size_t len = layout_length(n);
+    if (len < EFFECTIVE_GROUP_SIZE)
+        len = EFFECTIVE_GROUP_SIZE;
+    size_t ngroups = len / EFFECTIVE_GROUP_SIZE;
+    size_t *used = calloc(ngroups, sizeof(size_t));
+    for (uint64_t seed = rng(), tries = 1;; seed = rng(), tries++) {
+        if (tries % kMaxSeeds == 0) {
+            len *= 2;
+            ngroups *= 2;
+            used = realloc(used, ngroups * sizeof(size_t));
+        }
+        EFFECTIVE_TYPE *t = alloc_type(len, len, EFFECTIVE_LAYOUT_GROUPED,
+                                       seed);
+        uint8_t *tags = (uint8_t *)(t->layout + len);
+        t->mask = len - 1;
+        memset(tags, EFFECTIVE_GROUP_EMPTY, len);
+        memset(used, 0, ngroups * sizeof(size_t));
+        size_t i;
+        for (i = 0; i < n; i++) {
+            uint64_t h = EFFECTIVE_HASH(seed, ks[i].hash, ks[i].offset);
+            size_t g = EFFECTIVE_GROUP_HOME(h, t->mask), p = 0;
+            while (used[g] == EFFECTIVE_GROUP_SIZE && p < EFFECTIVE_MAX_PROBE)
+            {
+                g = (g + 1) % ngroups;
+                p++;
+            }
+            if (used[g] == EFFECTIVE_GROUP_SIZE)
+                break;
+            size_t s = g * EFFECTIVE_GROUP_SIZE + used[g]++;
+            tags[s] = EFFECTIVE_GROUP_TAG(h);
+            t->layout[s].hash = h;
+        }
+        if (i == n) {
+            free(used);
+            return t;
+        }
+        free(t);
+    }
+}
+
+static inline const EFFECTIVE_ENTRY *probe_entry(const EFFECTIVE_TYPE *t,
+                                                 uint64_t hval) {
+    const EFFECTIVE_ENTRY *entry = t->layout + (hval & t->mask);
+    while (true) {
+        if (entry->hash == hval)
+            return entry;
+        if (entry->hash == EFFECTIVE_ENTRY_EMPTY_HASH)
+            return NULL;
+        entry++;
+    }
+}
+
+static inline const EFFECTIVE_ENTRY *perfect_entry(const EFFECTIVE_TYPE *t,
+                                                   uint64_t hval) {
+    const EFFECTIVE_ENTRY *entry = effective_perfect_entry(t, hval);
+    return (entry->hash == hval ? entry : NULL);
+}
+
+#define LOOKUP(format, find)                                                \
+    __attribute__((__noinline__)) static const EFFECTIVE_ENTRY *            \
+    lookup_##format(const EFFECTIVE_TYPE *t, uint64_t u, uint64_t next,     \
+                    uint64_t offset) {                                      \
+        const EFFECTIVE_ENTRY *entry;                                       \
+        if ((entry = find(t, EFFECTIVE_HASH(t->hash2, u, offset))) != NULL) \
+            return entry;                                                   \
+        if ((entry = find(t, EFFECTIVE_HASH(t->hash2, next, offset))) !=    \
+                NULL)                                                       \
+            return entry;                                                   \
+        return find(t, EFFECTIVE_HASH(t->hash2, EFFECTIVE_TYPE_INT8_HASH,   \
+                                      offset));                             \
+    }
+LOOKUP(probe, probe_entry)
+LOOKUP(perfect, perfect_entry)
+LOOKUP(grouped, effective_grouped_entry)
+
+typedef const EFFECTIVE_ENTRY *(*lookup_t)(const EFFECTIVE_TYPE *, uint64_t,
+                                           uint64_t, uint64_t);
+
+struct Query {
+    uint32_t type;
+    uint64_t hash;
+    uint64_t offset;
+};
+
+static void run(const char *name, lookup_t lookup, EFFECTIVE_TYPE **ts,
+                const struct Query *qs, double build) {
+    size_t found = 0;
+    double n = (double)kNumIter * kNumQueries;
+    int fd = l1_open();
+#ifdef __linux__
+    if (fd >= 0)
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    double start = now();
+    for (int i = 0; i < kNumIter; i++)
+        for (int j = 0; j < kNumQueries; j++)
+            found += (lookup(ts[qs[j].type], qs[j].hash, qs[j].hash + 1,
+                             qs[j].offset) != NULL);
+    double time = now() - start;
+    printf("%-8s %8.2f ns/lookup  %8.2f us/type built  (%zu found)", name,
+           time * 1e9 / n, build * 1e6, found / kNumIter);
+    uint64_t misses;
+    if (fd >= 0 && read(fd, &misses, sizeof(misses)) == sizeof(misses))
+        printf("  %6.2f L1D misses/lookup", misses / n);
+    if (fd >= 0)
+        close(fd);
+    putchar('\n');
+}
+
+int main(int argc, char **argv) {
+    size_t nentries = (argc > 1 ? atoi(argv[1]) : 100);
+    size_t ntypes = (argc > 2 ? atoi(argv[2]) : 200);
+    int hits = (argc > 3 ? atoi(argv[3]) : 50);
+    printf("%zu types x %zu entries, %d%% hits\n", ntypes, nentries, hits);
+
+    struct Key *ks = calloc(ntypes * nentries, sizeof(struct Key));
+    for (size_t i = 0; i < ntypes * nentries; i++) {
+        ks[i].hash = rng();
+        ks[i].offset = (i % nentries) * 8;
+    }
+    struct Query *qs = calloc(kNumQueries, sizeof(struct Query));
+    for (int i = 0; i < kNumQueries; i++) {
+        qs[i].type = rng() % ntypes;
+        const struct Key *k = ks + qs[i].type * nentries + rng() % nentries;
+        qs[i].hash = ((int)(rng() % 100) < hits ? k->hash : rng());
+        qs[i].offset = k->offset;
+    }
+
+    EFFECTIVE_TYPE **ts = calloc(ntypes, sizeof(EFFECTIVE_TYPE *));
+    static const struct {
+        const char *name;
+        EFFECTIVE_TYPE *(*build)(const struct Key *, size_t);
+        lookup_t lookup;
+    } formats[] = {
+        {"probe", build_probe, lookup_probe},
+        {"perfect", build_perfect, lookup_perfect},
+        {"grouped", build_grouped, lookup_grouped},
+    };
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        double start = now();
+        for (size_t i = 0; i < ntypes; i++)
+            ts[i] = formats[f].build(ks + i * nentries, nentries);
+        double build = (now() - start) / ntypes;
+        run(formats[f].name, formats[f].lookup, ts, qs, build);
+        for (size_t i = 0; i < ntypes; i++)
+            free(ts[i]);
+    }
+    return 0;
+}
@@ -45,6 +45,86 @@ EFFECTIVE_BOUNDS effective_bounds_narrow(EFFECTIVE_BOUNDS bounds1,
     return bounds3;
 }
 
+/*
+ * Find the entry with hash `hval' in the layout of `t', or NULL.
+ */
+static inline const EFFECTIVE_ENTRY *effective_layout_entry(
+    const EFFECTIVE_TYPE *t, uint64_t hval)
+{
+    const EFFECTIVE_ENTRY *entry;
+    switch (t->format)
+    {
+        case EFFECTIVE_LAYOUT_PERFECT:
+            entry = effective_perfect_entry(t, hval);
+            return (entry->hash == hval? entry: NULL);
+        case EFFECTIVE_LAYOUT_GROUPED:
+            return effective_grouped_entry(t, hval);
+        default:
+            entry = t->layout + (hval & t->mask);
+            while (true)
+            {
+                if (entry->hash == hval)
+                    return entry;
+                if (entry->hash == EFFECTIVE_ENTRY_EMPTY_HASH)
+                    return NULL;
+                entry++;
+            }
+    }
+}
+
+/*
+ * Type check an offset within the periodic arrays of `t' (see
+ * EFFECTIVE_PERIOD).  The offset is normalized into element 0 of each
+ * enclosing period in turn, then the entries of each level are searched,
+ * innermost first.  On a match, `bounds' is narrowed to the array that the
+ * entry was found in.
+ */
+static EFFECTIVE_NOINLINE const EFFECTIVE_ENTRY *effective_periodic_entry(
+    const EFFECTIVE_TYPE *u, const EFFECTIVE_TYPE *t, intptr_t ptr,
+    size_t offset, EFFECTIVE_BOUNDS *bounds)
+{
+    const EFFECTIVE_PERIOD *chain[EFFECTIVE_MAX_PERIOD_DEPTH];
+    size_t offsets[EFFECTIVE_MAX_PERIOD_DEPTH + 1];
+    size_t depth = 0;
+    offsets[0] = offset;
+    for (const EFFECTIVE_PERIOD *p = t->periods;
+            p->span != 0 && depth < EFFECTIVE_MAX_PERIOD_DEPTH; p++)
+    {
+        size_t rel = offsets[depth] - p->base;
+        if (rel >= p->span)
+            continue;
+        unsigned __int128 tmp = (unsigned __int128)rel;
+        tmp *= (unsigned __int128)p->magic;
+        size_t idx = (size_t)(tmp >> EFFECTIVE_RADIX);
+        chain[depth] = p;
+        offsets[depth + 1] = offsets[depth] - idx * p->stride;
+        depth++;
+    }
+
+    for (; depth > 0; depth--)
+    {
+        uint64_t key = offsets[depth] |
+            ((uint64_t)depth << EFFECTIVE_PERIOD_SHIFT);
+        const EFFECTIVE_ENTRY *entry = effective_layout_entry(t,
+            EFFECTIVE_HASH(t->hash2, u->hash, key));
+        if (entry == NULL)
+            entry = effective_layout_entry(t,
+                EFFECTIVE_HASH(t->hash2, u->next, key));
+        if (entry == NULL)
+            entry = effective_layout_entry(t,
+                EFFECTIVE_HASH(t->hash2, EFFECTIVE_TYPE_INT8.hash, key));
+        if (entry != NULL)
+        {
+            const EFFECTIVE_PERIOD *p = chain[depth - 1];
+            intptr_t lb = ptr - (intptr_t)offsets[depth - 1] + p->base;
+            EFFECTIVE_BOUNDS array = {lb, lb + p->span};
+            *bounds = effective_bounds_narrow(array, *bounds);
+            return entry;
+        }
+    }
+    return NULL;
+}
+
 /*
  * Do a type check and calculate the (sub-object) bounds.
  *
@@ -119,12 +199,17 @@ EFFECTIVE_HOT EFFECTIVE_BOUNDS effective_type_check(const void *ptr,
     EFFECTIVE_PROFILE_COUNT(effective_num_slow_type_checks);
     EFFECTIVE_BOUNDS ptrs = {(intptr_t)ptr, (intptr_t)ptr};
     uint64_t hval = EFFECTIVE_HASH(t->hash2, u->hash, offset);
+    register const EFFECTIVE_ENTRY *entry;
+    if (EFFECTIVE_UNLIKELY(t->format == EFFECTIVE_LAYOUT_PERFECT))
+        goto perfect_probe;
+    if (EFFECTIVE_UNLIKELY(t->format == EFFECTIVE_LAYOUT_GROUPED))
+        goto grouped_probe;
 
     // Probe the layout.  The compiler pass ensures that the number of
     // probes is limited for each query, i.e., that we will hit an
     // EFFECTIVE_ENTRY_EMPTY_HASH within reasonable time.
     idx = hval & t->mask;
-    register const EFFECTIVE_ENTRY *entry = t->layout + idx;
+    entry = t->layout + idx;
 
     // Look for `u' directly:
     if (entry->hash == hval)
@@ -176,13 +261,53 @@ match_found: {}
         entry++;
     }
 
-    // The probe failed; this must be a type-error.  Handle it here.
+    // The probe failed; this must be a type-error, unless `offset' is within
+    // a periodic array.  Handle it here.
     // Note: we use `ptrs[0]' inplace of `ptr' to reduce register pressure.
+type_error: {}
+    if (EFFECTIVE_UNLIKELY(t->periods != NULL))
+    {
+        entry = effective_periodic_entry(u, t, ptrs[0], offset, &bounds);
+        if (entry != NULL)
+            goto match_found;
+    }
 	effective_type_error(u, t, (void *)ptrs[0], offset,
         __builtin_return_address(0));
     bounds = ptrs + EFFECTIVE_BOUNDS_NEG_DELTA_DELTA;
     EFFECTIVE_DEBUG("%zd..%zd (type error)\n", bounds[0], bounds[1]);
     return bounds;
+
+    // EFFECTIVE_LAYOUT_PERFECT: each of the three lookups above is a single
+    // probe.
+perfect_probe: {}
+    entry = effective_perfect_entry(t, hval);
+    if (entry->hash == hval)
+        goto match_found;
+    hval = EFFECTIVE_HASH(t->hash2, u->next, offset);
+    entry = effective_perfect_entry(t, hval);
+    if (entry->hash == hval)
+        goto match_found;
+    hval = EFFECTIVE_HASH(t->hash2, EFFECTIVE_TYPE_INT8.hash, offset);
+    entry = effective_perfect_entry(t, hval);
+    if (entry->hash == hval)
+        goto match_found;
+    goto type_error;
+
+    // EFFECTIVE_LAYOUT_GROUPED: each of the three lookups above compares the
+    // tags of a whole group at once.
+grouped_probe: {}
+    entry = effective_grouped_entry(t, hval);
+    if (entry != NULL)
+        goto match_found;
+    hval = EFFECTIVE_HASH(t->hash2, u->next, offset);
+    entry = effective_grouped_entry(t, hval);
+    if (entry != NULL)
+        goto match_found;
+    hval = EFFECTIVE_HASH(t->hash2, EFFECTIVE_TYPE_INT8.hash, offset);
+    entry = effective_grouped_entry(t, hval);
+    if (entry != NULL)
+        goto match_found;
+    goto type_error;
 }
 
 /*
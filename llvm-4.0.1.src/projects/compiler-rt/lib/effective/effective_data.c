@@ -297,9 +297,21 @@ __attribute__((__section__("tyche_symbols_section_7"))) EFFECTIVE_ALIGNED(64) st
 
 };
 
+__attribute__((__section__("tyche_symbols_index"))) EFFECTIVE_ALIGNED(64) struct TYCHE_SPARSE_META EFFECTIVE_TYCHE_META_INT8 =
+{
+    .lines = &EFFECTIVE_SEC0_CL_INT8,
+    .num_buckets = 1,
+    .bucket = {0}
+};
+
+static const EFFECTIVE_ENTRY_COLD EFFECTIVE_COLD_FREE[] =
+{
+    {"", UINT64_MAX}
+};
+
 const EFFECTIVE_ALIGNED(64) struct EFFECTIVE_TYPE EFFECTIVE_TYPE_FREE =
 {
-    .tyche_meta = &EFFECTIVE_SEC0_CL_INT8,
+    .tyche_meta = &EFFECTIVE_TYCHE_META_INT8,
 	.hash       = 0xAB63C4D0EB0A6EC4ull,
 	.hash2      = 0xAB63C4D0EB0A6EC4ull,
 	.size       = sizeof(int8_t),
@@ -310,13 +322,21 @@ const EFFECTIVE_ALIGNED(64) struct EFFECTIVE_TYPE EFFECTIVE_TYPE_FREE =
     .mask       = 0,
     .info       = &EFFECTIVE_INFO_FREE,
     .next       = EFFECTIVE_TYPE_NIL_HASH,
+    .cold       = EFFECTIVE_COLD_FREE,
+    .periods    = NULL,
     .length     = 1,
-    .layout     = {{"", UINT64_MAX, -1, 0, {0, 0}}}
+    .layout     = {{-1, 0, {0, 0}}}
+};
+
+static const EFFECTIVE_ENTRY_COLD EFFECTIVE_COLD_INT8[] =
+{
+    {"int8_t", 0},
+    {"", UINT64_MAX}
 };
 
 const EFFECTIVE_ALIGNED(64) struct EFFECTIVE_TYPE EFFECTIVE_TYPE_INT8 =
 {
-    .tyche_meta = &EFFECTIVE_SEC0_CL_INT8, // change this
+    .tyche_meta = &EFFECTIVE_TYCHE_META_INT8,
     .hash       = EFFECTIVE_TYPE_INT8_HASH,
     .hash2      = EFFECTIVE_TYPE_INT8_HASH,
     .size       = sizeof(int8_t),
@@ -327,10 +347,12 @@ const EFFECTIVE_ALIGNED(64) struct EFFECTIVE_TYPE EFFECTIVE_TYPE_INT8 =
     .mask       = 1,
     .info       = &EFFECTIVE_INFO_INT8,
     .next       = EFFECTIVE_TYPE_INT8_HASH,
+    .cold       = EFFECTIVE_COLD_INT8,
+    .periods    = NULL,
     .length     = 2,
     .layout     = {
-        {"int8_t", 0, 0x00000000B79F915Eull, 0, {-EFFECTIVE_DELTA, EFFECTIVE_DELTA}},
-        {"", UINT64_MAX, -1, 0, {0, 0}}
+        {0x00000000B79F915Eull, 0, {-EFFECTIVE_DELTA, EFFECTIVE_DELTA}},
+        {-1, 0, {0, 0}}
     }
 };
 
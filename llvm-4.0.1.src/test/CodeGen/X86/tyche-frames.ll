@@ -0,0 +1,24 @@
+; RUN: llc -O0 -mtriple=x86_64-unknown-linux-gnu -filetype=obj %s -o %t.o
+; RUN: llvm-tyche frames %t.o | FileCheck %s
+
+; Slot offsets are relative to the CFA: the return address is at -8, the
+; saved frame pointer at -16 and the first local at -24, i.e. -8(%rbp).
+
+; CHECK:      FN
+; CHECK-NEXT: OBJ -16 8 {{[0-9]+}} 1 1 0 0 0
+; CHECK-NEXT: OBJ -24 8 8 0 0 0 7 5
+; CHECK-NOT:  OBJ
+
+define void @f() #0 !TYCHE_MD_ARGS !0 {
+entry:
+  %a = alloca i64, align 8, !TYCHE_MD !1
+  store volatile i64 1, i64* %a, align 8
+  ret void
+}
+
+attributes #0 = { "no-frame-pointer-elim"="true" }
+
+!0 = !{}
+; Line, column, meta ID, hash, inlined location, block ID, site ID, type ID
+; and type name.
+!1 = !{i64 3, i64 8, i64 1, i64 0, i64 0, i64 0, i64 0, i64 0, i64 5, i64 7, !"long"}
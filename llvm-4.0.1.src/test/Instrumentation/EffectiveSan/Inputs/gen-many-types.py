@@ -0,0 +1,47 @@
+#!/usr/bin/env python
+"""Generate a module with N distinct struct types, each allocated once.
+
+Usage: gen-many-types.py N > out.ll
+"""
+
+import sys
+
+
+def main():
+    n = int(sys.argv[1])
+    out = sys.stdout
+    out.write('source_filename = "many-types.c"\n')
+    out.write('target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"\n')
+    out.write('target triple = "x86_64-unknown-linux-gnu"\n\n')
+    out.write('declare i8* @malloc(i64)\n\n')
+    out.write('define void @alloc_all() {\nentry:\n')
+    for i in range(n):
+        out.write('  %%p%d = call i8* @malloc(i64 8), !effectiveSan !%d\n'
+                  % (i, 5 + 4 * i))
+    out.write('  ret void\n}\n\n')
+    out.write('!llvm.dbg.cu = !{!0}\n')
+    out.write('!llvm.module.flags = !{!2, !3}\n\n')
+    out.write('!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, '
+              'producer: "gen-many-types", isOptimized: true, '
+              'runtimeVersion: 0, emissionKind: FullDebug)\n')
+    out.write('!1 = !DIFile(filename: "many-types.c", directory: "/")\n')
+    out.write('!2 = !{i32 2, !"Dwarf Version", i32 4}\n')
+    out.write('!3 = !{i32 2, !"Debug Info Version", i32 3}\n')
+    out.write('!4 = !DIBasicType(name: "int", size: 32, '
+              'encoding: DW_ATE_signed)\n')
+    for i in range(n):
+        s = 5 + 4 * i
+        out.write('!%d = distinct !DICompositeType(tag: DW_TAG_structure_type, '
+                  'name: "S%d", file: !1, line: %d, size: 64, elements: !%d)\n'
+                  % (s, i, i + 1, s + 1))
+        out.write('!%d = !{!%d, !%d}\n' % (s + 1, s + 2, s + 3))
+        out.write('!%d = !DIDerivedType(tag: DW_TAG_member, name: "a%d", '
+                  'scope: !%d, file: !1, baseType: !4, size: 32)\n'
+                  % (s + 2, i, s))
+        out.write('!%d = !DIDerivedType(tag: DW_TAG_member, name: "b%d", '
+                  'scope: !%d, file: !1, baseType: !4, size: 32, '
+                  'offset: 32)\n' % (s + 3, i, s))
+
+
+if __name__ == '__main__':
+    main()
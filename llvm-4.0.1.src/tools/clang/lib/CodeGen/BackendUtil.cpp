@@ -255,6 +255,16 @@ static void addEfficiencySanitizerPass(const PassManagerBuilder &Builder,
   PM.add(createEfficiencySanitizerPass(Opts));
 }
 
+static void addEffectiveSanTrackMetadataPass(const PassManagerBuilder &Builder,
+                                             legacy::PassManagerBase &PM) {
+  PM.add(createEffectiveSanTrackMetadataPass());
+}
+
+static void addEffectiveSanPass(const PassManagerBuilder &Builder,
+                                legacy::PassManagerBase &PM) {
+  PM.add(createEffectiveSanPass());
+}
+
 static TargetLibraryInfoImpl *createTLII(llvm::Triple &TargetTriple,
                                          const CodeGenOptions &CodeGenOpts) {
   TargetLibraryInfoImpl *TLII = new TargetLibraryInfoImpl(TargetTriple);
@@ -416,6 +426,17 @@ void EmitAssemblyHelper::CreatePasses(legacy::PassManager &MPM,
                            addEfficiencySanitizerPass);
   }
 
+  // EFFECTIVE: EffectiveSan instruments the fully optimized module, where far
+  // fewer memory operations are left to check.  The optimizer keeps the type
+  // annotations of the frontend for it; -mllvm -effective-verify-metadata
+  // reports the ones it drops anyway.
+  PMBuilder.addExtension(PassManagerBuilder::EP_EarlyAsPossible,
+                         addEffectiveSanTrackMetadataPass);
+  PMBuilder.addExtension(PassManagerBuilder::EP_OptimizerLast,
+                         addEffectiveSanPass);
+  PMBuilder.addExtension(PassManagerBuilder::EP_EnabledOnOptLevel0,
+                         addEffectiveSanPass);
+
   // Set up the per-function pass manager.
   FPM.add(new TargetLibraryInfoWrapperPass(*TLII));
   if (CodeGenOpts.VerifyModule)
@@ -464,6 +485,12 @@ void EmitAssemblyHelper::CreatePasses(legacy::PassManager &MPM,
 
   PMBuilder.populateFunctionPassManager(FPM);
   PMBuilder.populateModulePassManager(MPM);
+
+  // EFFECTIVE: When preparing for ThinLTO, populateModulePassManager() returns
+  // before EP_OptimizerLast, and the ThinLTO backend runs no extensions, so
+  // instrument the pre-link module at the end of its (shorter) pipeline.
+  if (PMBuilder.PrepareForThinLTO && PMBuilder.OptLevel > 0)
+    MPM.add(createEffectiveSanPass());
 }
 
 void EmitAssemblyHelper::setCommandLineOpts() {
@@ -725,31 +752,6 @@ void EmitAssemblyHelper::EmitAssembly(BackendAction Action,
     PerModulePasses.run(*TheModule);
   }
 
-
-  //if (LangOpts.Sanitize.has(SanitizerKind::Effective)) {
-    // EFFECTIVE: Currently EffectiveSan must be run before the function passes.
-    legacy::PassManager MPM;
-
-    if (CodeGenOpts.OptimizationLevel != 2) {
-      // EffectiveSan wants -O2:
-      unsigned DiagID = Diags.getCustomDiagID(
-        DiagnosticsEngine::Warning, "EffectiveSan assumes -O2 optimization "
-                                    "level; got -O%0");
-      Diags.Report(DiagID) << std::to_string(CodeGenOpts.OptimizationLevel);
-    }
-
-    // EFFECTIVE:
-    // Optimization to reduce the number of memory operations and thus
-    // the number of type/bounds checks.  The optimization passes have been
-    // modified to preserve the effectiveSan metadata.
-    // MPM.add(createFunctionInliningPass());
-    // MPM.add(createPromoteMemoryToRegisterPass());
-    // MPM.add(createGVNPass());
-
-    MPM.add(createEffectiveSanPass());
-    MPM.run(*TheModule);
-  //}
-
   {
     PrettyStackTraceString CrashInfo("Code generation");
     CodeGenPasses.run(*TheModule);
@@ -6445,6 +6445,41 @@ void Clang::ConstructJob(Compilation &C, const JobAction &JA,
     }
   }
 
+  // EFFECTIVE: Name the TyChe side files of this translation unit after its
+  // output (like the optimization record file above) so that parallel
+  // compiles do not append to the same files in the working directory.
+  // Without -c or -S the object is a temporary, so use the input path: its
+  // stem alone would collide for inputs like a/x.c and b/x.c.
+  bool HasTyCheOutputPrefix = false;
+  for (StringRef V : Args.getAllArgValues(options::OPT_mllvm))
+    if (V.startswith("-effective-output-prefix"))
+      HasTyCheOutputPrefix = true;
+  if (!HasTyCheOutputPrefix &&
+      (isa<BackendJobAction>(JA) || isa<AssembleJobAction>(JA))) {
+    SmallString<128> F;
+    if (Output.isFilename() && (Args.hasArg(options::OPT_c) ||
+                                Args.hasArg(options::OPT_S)))
+      F = Output.getFilename();
+    else
+      F = Input.getBaseInput();
+    llvm::sys::path::replace_extension(F, "");
+    CmdArgs.push_back("-mllvm");
+    CmdArgs.push_back(
+        Args.MakeArgString(Twine("-effective-output-prefix=") + F));
+  }
+
+  // EFFECTIVE: Under (Thin)LTO all modules end up in one program; give each
+  // type the same TyChe type ID in every module so that the linker keeps a
+  // single copy of its metadata.
+  bool HasTyCheCanonicalIDs = false;
+  for (StringRef V : Args.getAllArgValues(options::OPT_mllvm))
+    if (V.startswith("-effective-canonical-type-ids"))
+      HasTyCheCanonicalIDs = true;
+  if (!HasTyCheCanonicalIDs && D.isUsingLTO() && isa<BackendJobAction>(JA)) {
+    CmdArgs.push_back("-mllvm");
+    CmdArgs.push_back("-effective-canonical-type-ids");
+  }
+
   // Forward -Xclang arguments to -cc1, and -mllvm arguments to the LLVM option
   // parser.
   Args.AddAllArgValues(CmdArgs, options::OPT_Xclang);
@@ -0,0 +1,20 @@
+// RUN: %clang_cc1 -triple x86_64-unknown-linux-gnu -O2 -flto=thin \
+// RUN:   -mllvm -effective-debug=false -mllvm -effective-output-prefix=%t \
+// RUN:   -mllvm -effective-tyche-db=%t.tychedb -emit-llvm-bc -o %t.bc %s
+// RUN: llvm-dis %t.bc -o - | FileCheck %s
+// RUN: llvm-bcanalyzer -dump %t.bc | FileCheck --check-prefix=SUMMARY %s
+
+// The ThinLTO pre-link pipeline stops before EP_OptimizerLast; check that
+// EffectiveSan still instruments the module and the summary is still emitted.
+
+typedef __SIZE_TYPE__ size_t;
+void *malloc(size_t);
+
+long *f(void) {
+  // CHECK-LABEL: define {{.*}}@f(
+  // CHECK: call {{.*}}@malloc(i64 8){{.*}}, !TYCHE_MD
+  return (long *)malloc(sizeof(long));
+}
+
+// CHECK: !tyche.output.prefix = !{
+// SUMMARY: <GLOBALVAL_SUMMARY_BLOCK
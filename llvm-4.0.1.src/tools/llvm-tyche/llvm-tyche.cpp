@@ -0,0 +1,512 @@
+//===- llvm-tyche.cpp - TyChe allocation-point database tool --------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// llvm-tyche inspects the binary allocation-point databases written by the
+// EffectiveSan pass and merges the per-translation-unit databases of a
+// program into a single one.  It also lists the allocator calls and stack
+// frames recorded in the .tyche_callsites and .tyche_frames sections of a
+// linked binary.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/PrettyStackTrace.h"
+#include "llvm/Support/Signals.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Instrumentation/TyCheDB.h"
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
+using namespace llvm;
+using namespace llvm::tyche;
+
+static void exitWithError(const Twine &Message, StringRef Whence = "") {
+  errs() << "error: ";
+  if (!Whence.empty())
+    errs() << Whence << ": ";
+  errs() << Message << "\n";
+  ::exit(1);
+}
+
+static void exitWithError(Error E, StringRef Whence = "") {
+  exitWithError(toString(std::move(E)), Whence);
+}
+
+static void warn(const Twine &Message, StringRef Whence = "") {
+  errs() << "warning: ";
+  if (!Whence.empty())
+    errs() << Whence << ": ";
+  errs() << Message << "\n";
+}
+
+static const char *getSiteKindName(uint32_t Kind) {
+  switch (Kind) {
+  case DBSiteHeap:
+    return "heap";
+  case DBSiteCalloc:
+    return "calloc";
+  case DBSiteRealloc:
+    return "realloc";
+  case DBSiteFree:
+    return "free";
+  case DBSiteStack:
+    return "stack";
+  case DBSiteArgument:
+    return "argument";
+  case DBSiteReturn:
+    return "return";
+  default:
+    return "unknown";
+  }
+}
+
+/// Print a type in the layout of the textual allocation_points.hash files.
+static void showType(const DBReader &Reader, const DBType &T,
+                     raw_ostream &OS) {
+  ArrayRef<DBField> Fields = Reader.fields(T);
+  OS << "TYPE " << T.ID << " " << Reader.getString(T.Name) << "\n"
+     << "HASH " << T.Hash[0] << " " << T.Hash[1] << "\n"
+     << "FILENAME " << Reader.getString(T.File) << "\n"
+     << "APSIZE " << Fields.size() << "\n";
+  for (const DBField &F : Fields) {
+    OS << "OFFSET " << F.Offset << "\n"
+       << "CORECED " << ((F.Flags & DBFieldCoerced) ? "Y" : "N") << "\n"
+       << "LB " << (uint64_t)F.LB << "\n"
+       << "UB " << (uint64_t)F.UB << "\n"
+       << "FAM " << ((F.Flags & DBFieldFAM) ? "Y" : "N") << "\n"
+       << "NAME " << Reader.getString(F.Name) << "\n"
+       << "VPTR " << ((F.Flags & DBFieldVPtr) ? "Y" : "N") << "\n"
+       << "METATYPE " << Reader.getString(F.MetaType) << "\n"
+       << "PARENTTYPE "
+       << (F.ParentType != 0 ? Reader.getString(F.ParentType)
+                             : StringRef("NOPARENT"))
+       << "\n";
+  }
+}
+
+/// Print a site as a METAID line (the type-metadata pointer field of the
+/// textual format is replaced by the site kind).
+static void showSite(const DBReader &Reader, const DBSite &S,
+                     raw_ostream &OS) {
+  OS << "METAID " << Reader.getString(S.File) << "#" << S.Line << "#" << S.Col
+     << "#" << Reader.getString(S.TypeName) << "#" << getSiteKindName(S.Kind)
+     << "#" << S.Hash[0] << "#" << S.Hash[1] << "#"
+     << Reader.getString(S.Allocator) << "#" << Reader.getString(S.Caller)
+     << "#" << S.InlinedLine << "#" << S.InlinedCol << "#" << S.BlockID << "#"
+     << S.ID << "#" << S.TypeID << "\n";
+}
+
+static void addInputFilenames(const cl::list<std::string> &Inputs,
+                              StringRef InputFilenamesFile,
+                              std::vector<std::string> &Filenames) {
+  Filenames.insert(Filenames.end(), Inputs.begin(), Inputs.end());
+  if (InputFilenamesFile.empty())
+    return;
+  auto BufOrErr = MemoryBuffer::getFileOrSTDIN(InputFilenamesFile);
+  if (std::error_code EC = BufOrErr.getError())
+    exitWithError(EC.message(), InputFilenamesFile);
+  // One file name per line; blank lines and '#' comments are skipped.
+  for (line_iterator I(*BufOrErr.get(), /*SkipBlanks=*/true, '#');
+       !I.is_at_eof(); ++I)
+    Filenames.push_back(I->trim());
+}
+
+/// Merge the databases in \p Readers (which are sorted by file name) into
+/// \p Writer.  Types are unified by their layout hash and renumbered densely
+/// in order of first appearance; the sites are remapped accordingly and the
+/// original (module-ranged) type IDs are kept in the remap table.  The
+/// metadata byte counts are summed, as every module brings its own copy of
+/// the section metadata into the binary.  The result only depends on the set
+/// of inputs, not on the order in which they were loaded.
+static void mergeDatabases(ArrayRef<std::unique_ptr<DBReader>> Readers,
+                           ArrayRef<std::string> Filenames, DBWriter &Writer) {
+  std::map<std::pair<uint64_t, uint64_t>, uint64_t> TypeIDs;
+  std::unordered_map<uint64_t, size_t> SiteOwners;
+  std::vector<DBField> Fields;
+  uint64_t NumDuplicateSites = 0;
+
+  for (size_t i = 0; i < Readers.size(); i++) {
+    const DBReader &Reader = *Readers[i];
+    Writer.addMetaBytes(Reader.getHeader().MetaBytes,
+                        Reader.getHeader().DenseMetaBytes);
+    auto copyString = [&](uint32_t Offset) {
+      return Writer.addString(Reader.getString(Offset));
+    };
+
+    std::unordered_map<uint64_t, uint64_t> LocalIDs;
+    for (const DBType &T : Reader.types()) {
+      auto Key = std::make_pair(T.Hash[0], T.Hash[1]);
+      auto I = TypeIDs.insert(std::make_pair(Key, (uint64_t)TypeIDs.size()));
+      LocalIDs[T.ID] = I.first->second;
+      Writer.addTypeRemap(T.ID, I.first->second);
+      if (!I.second)
+        continue;
+      DBType NewT = T;
+      NewT.ID = I.first->second;
+      NewT.Name = copyString(T.Name);
+      NewT.File = copyString(T.File);
+      Fields.clear();
+      for (const DBField &F : Reader.fields(T)) {
+        DBField NewF = F;
+        NewF.Name = copyString(F.Name);
+        NewF.MetaType = copyString(F.MetaType);
+        NewF.ParentType = copyString(F.ParentType);
+        Fields.push_back(NewF);
+      }
+      Writer.addType(NewT, Fields);
+    }
+
+    // Inputs that are merged databases themselves: keep their remaps.
+    for (const DBTypeRemap &R : Reader.typeRemaps()) {
+      auto J = LocalIDs.find(R.To);
+      if (J != LocalIDs.end())
+        Writer.addTypeRemap(R.From, J->second);
+    }
+
+    for (const DBSite &S : Reader.sites()) {
+      auto I = SiteOwners.insert(std::make_pair(S.ID, i));
+      if (!I.second) {
+        if (NumDuplicateSites++ == 0)
+          warn("site " + Twine(S.ID) + " is also defined in " +
+                   Filenames[I.first->second],
+               Filenames[i]);
+        continue;
+      }
+      DBSite NewS = S;
+      auto J = LocalIDs.find(S.TypeID);
+      if (J != LocalIDs.end())
+        NewS.TypeID = J->second;
+      NewS.File = copyString(S.File);
+      NewS.Allocator = copyString(S.Allocator);
+      NewS.Caller = copyString(S.Caller);
+      NewS.TypeName = copyString(S.TypeName);
+      Writer.addSite(NewS);
+    }
+  }
+
+  if (NumDuplicateSites > 1)
+    warn(Twine(NumDuplicateSites) + " duplicate sites were dropped");
+}
+
+static int merge_main(int argc, const char *argv[]) {
+  cl::list<std::string> InputFilenames(cl::Positional,
+                                       cl::desc("<tychedb-files...>"));
+  cl::opt<std::string> InputFilenamesFile(
+      "input-files", cl::init(""),
+      cl::desc("Path to file containing newline-separated database "
+               "file names"));
+  cl::alias InputFilenamesFileA("f", cl::desc("Alias for --input-files"),
+                                cl::aliasopt(InputFilenamesFile));
+  cl::opt<std::string> OutputFilename("output", cl::value_desc("output"),
+                                      cl::Required,
+                                      cl::desc("Output file"));
+  cl::alias OutputFilenameA("o", cl::desc("Alias for --output"),
+                            cl::aliasopt(OutputFilename));
+  cl::opt<unsigned> NumThreads(
+      "num-threads", cl::init(0),
+      cl::desc("Number of threads used to read the inputs "
+               "(default: hardware concurrency)"));
+  cl::alias NumThreadsA("j", cl::desc("Alias for --num-threads"),
+                        cl::aliasopt(NumThreads));
+
+  cl::ParseCommandLineOptions(argc, argv, "TyChe database merger\n");
+
+  std::vector<std::string> Filenames;
+  addInputFilenames(InputFilenames, InputFilenamesFile, Filenames);
+  if (Filenames.empty())
+    exitWithError("no input files specified");
+
+  // Sort the inputs so that the result does not depend on the order in which
+  // the build system listed them.
+  std::sort(Filenames.begin(), Filenames.end());
+  Filenames.erase(std::unique(Filenames.begin(), Filenames.end()),
+                  Filenames.end());
+
+  // Map and validate the inputs in parallel.
+  std::vector<std::unique_ptr<DBReader>> Readers(Filenames.size());
+  std::vector<std::string> Errors(Filenames.size());
+  {
+    if (NumThreads == 0)
+      NumThreads = llvm::heavyweight_hardware_concurrency();
+    NumThreads = std::max(1u, std::min<unsigned>(NumThreads,
+                                                 Filenames.size()));
+    ThreadPool Pool(NumThreads);
+    for (size_t i = 0; i < Filenames.size(); i++)
+      Pool.async([&, i]() {
+        auto ReaderOrErr = DBReader::create(Filenames[i]);
+        if (ReaderOrErr)
+          Readers[i] = std::move(*ReaderOrErr);
+        else
+          Errors[i] = toString(ReaderOrErr.takeError());
+      });
+    Pool.wait();
+  }
+  for (const std::string &E : Errors)
+    if (!E.empty())
+      exitWithError(E);
+
+  DBWriter Writer;
+  mergeDatabases(Readers, Filenames, Writer);
+  if (Error E = Writer.writeToFile(OutputFilename))
+    exitWithError(std::move(E));
+  return 0;
+}
+
+static int show_main(int argc, const char *argv[]) {
+  cl::opt<std::string> Filename(cl::Positional, cl::Required,
+                                cl::desc("<tychedb-file>"));
+  cl::opt<bool> ShowTypes("types", cl::init(false),
+                          cl::desc("Show all type layouts"));
+  cl::opt<bool> ShowSites("sites", cl::init(false),
+                          cl::desc("Show all allocation sites"));
+  cl::list<unsigned long long> ShowType(
+      "type", cl::desc("Show the type with the given ID (or the given ID "
+                       "before merging)"));
+  cl::list<unsigned long long> ShowSite(
+      "site", cl::desc("Show the site with the given ID"));
+  cl::opt<std::string> OutputFilename("output", cl::value_desc("output"),
+                                      cl::init("-"), cl::desc("Output file"));
+  cl::alias OutputFilenameA("o", cl::desc("Alias for --output"),
+                            cl::aliasopt(OutputFilename));
+
+  cl::ParseCommandLineOptions(argc, argv, "TyChe database dump\n");
+
+  std::error_code EC;
+  raw_fd_ostream OS(OutputFilename, EC, sys::fs::F_Text);
+  if (EC)
+    exitWithError(EC.message(), OutputFilename);
+
+  auto ReaderOrErr = DBReader::create(Filename);
+  if (!ReaderOrErr)
+    exitWithError(ReaderOrErr.takeError());
+  const DBReader &Reader = **ReaderOrErr;
+
+  for (uint64_t ID : ShowType) {
+    const DBType *T = Reader.lookupType(ID);
+    if (T == nullptr)
+      T = Reader.lookupType(Reader.remapTypeID(ID));
+    if (T == nullptr)
+      exitWithError("no type with ID " + Twine(ID), Filename);
+    showType(Reader, *T, OS);
+  }
+  for (uint64_t ID : ShowSite) {
+    const DBSite *S = Reader.lookupSite(ID);
+    if (S == nullptr)
+      exitWithError("no site with ID " + Twine(ID), Filename);
+    showSite(Reader, *S, OS);
+  }
+  if (ShowTypes)
+    for (const DBType &T : Reader.types())
+      showType(Reader, T, OS);
+  if (ShowSites)
+    for (const DBSite &S : Reader.sites())
+      showSite(Reader, S, OS);
+
+  if (ShowType.empty() && ShowSite.empty() && !ShowTypes && !ShowSites) {
+    const DBHeader &H = Reader.getHeader();
+    OS << "Version: " << H.Version << "\n"
+       << "Types: " << H.NumTypes << "\n"
+       << "Fields: " << H.NumFields << "\n"
+       << "Sites: " << H.NumSites << "\n"
+       << "Type remaps: " << H.NumTypeRemaps << "\n"
+       << "String pool: " << H.StringsSize << " bytes\n"
+       << "TyChe metadata: " << H.MetaBytes << " bytes (dense: "
+       << H.DenseMetaBytes << " bytes, saved: "
+       << (H.DenseMetaBytes - std::min(H.MetaBytes, H.DenseMetaBytes))
+       << " bytes)\n";
+  }
+  return 0;
+}
+
+/// Add the sections \p SectionName of \p Obj to \p Table.
+template <typename TableT>
+static void addSections(const object::ObjectFile &Obj, StringRef SectionName,
+                        StringRef Filename, TableT &Table) {
+  if (Obj.isRelocatableObject())
+    warn("addresses are only resolved in linked binaries", Filename);
+  for (const object::SectionRef &Section : Obj.sections()) {
+    StringRef Name, Contents;
+    if (Section.getName(Name) || Name != SectionName)
+      continue;
+    if (std::error_code EC = Section.getContents(Contents))
+      exitWithError(EC.message(), Filename);
+    if (Error E = Table.addSection(Contents, Section.getAddress()))
+      exitWithError(std::move(E), Filename);
+  }
+}
+
+/// Print an allocator call as a CALLSITE line.
+static void showCallSite(const CallSiteInfo &S, raw_ostream &OS) {
+  OS << "CALLSITE " << format_hex(S.PC, 18) << " " << S.SiteID << " "
+     << S.TypeID << " " << getSiteKindName(S.Kind) << "\n";
+}
+
+static int callsites_main(int argc, const char *argv[]) {
+  cl::opt<std::string> Filename(cl::Positional, cl::Required,
+                                cl::desc("<binary>"));
+  cl::list<unsigned long long> ShowPC(
+      "pc", cl::desc("Show the allocator call with the given return address"));
+  cl::opt<std::string> OutputFilename("output", cl::value_desc("output"),
+                                      cl::init("-"), cl::desc("Output file"));
+  cl::alias OutputFilenameA("o", cl::desc("Alias for --output"),
+                            cl::aliasopt(OutputFilename));
+
+  cl::ParseCommandLineOptions(argc, argv, "TyChe allocator call sites\n");
+
+  std::error_code EC;
+  raw_fd_ostream OS(OutputFilename, EC, sys::fs::F_Text);
+  if (EC)
+    exitWithError(EC.message(), OutputFilename);
+
+  auto BinaryOrErr = object::ObjectFile::createObjectFile(Filename);
+  if (!BinaryOrErr)
+    exitWithError(BinaryOrErr.takeError(), Filename);
+  CallSiteTable Table;
+  addSections(*BinaryOrErr->getBinary(), CallSiteSectionName, Filename, Table);
+
+  for (uint64_t PC : ShowPC) {
+    const CallSiteInfo *S = Table.lookup(PC);
+    if (S == nullptr)
+      exitWithError("no allocator call returns to " + Twine::utohexstr(PC),
+                    Filename);
+    showCallSite(*S, OS);
+  }
+  if (ShowPC.empty())
+    for (const CallSiteInfo &S : Table.sites())
+      showCallSite(S, OS);
+  return 0;
+}
+
+/// Print a frame as an FN line followed by one OBJ line per stack object,
+/// similar to the former stack_objects.hash files.
+static void showFrame(const FrameInfo &Frame, StringRef Name,
+                      raw_ostream &OS) {
+  OS << "FN " << format_hex(Frame.Function, 18) << " " << Name << "\n";
+  for (const FrameSlotRecord &S : Frame.Slots)
+    OS << "OBJ " << S.Offset << " " << S.Size << " " << S.Alignment << " "
+       << ((S.Flags & FrameSlotFixed) ? 1 : 0) << " "
+       << ((S.Flags & FrameSlotSpill) ? 1 : 0) << " "
+       << ((S.Flags & FrameSlotVariableSized) ? 1 : 0) << " " << S.TypeID
+       << " " << S.SiteID << "\n";
+}
+
+static int frames_main(int argc, const char *argv[]) {
+  cl::opt<std::string> Filename(cl::Positional, cl::Required,
+                                cl::desc("<binary>"));
+  cl::list<unsigned long long> ShowFunction(
+      "function", cl::desc("Show the frame of the function at the given "
+                           "address"));
+  cl::opt<std::string> OutputFilename("output", cl::value_desc("output"),
+                                      cl::init("-"), cl::desc("Output file"));
+  cl::alias OutputFilenameA("o", cl::desc("Alias for --output"),
+                            cl::aliasopt(OutputFilename));
+
+  cl::ParseCommandLineOptions(argc, argv, "TyChe stack frames\n");
+
+  std::error_code EC;
+  raw_fd_ostream OS(OutputFilename, EC, sys::fs::F_Text);
+  if (EC)
+    exitWithError(EC.message(), OutputFilename);
+
+  auto BinaryOrErr = object::ObjectFile::createObjectFile(Filename);
+  if (!BinaryOrErr)
+    exitWithError(BinaryOrErr.takeError(), Filename);
+  const object::ObjectFile &Obj = *BinaryOrErr->getBinary();
+  FrameTable Table;
+  addSections(Obj, FrameSectionName, Filename, Table);
+
+  // Name the frames after the function symbols at their addresses.
+  std::unordered_map<uint64_t, StringRef> Names;
+  for (const object::SymbolRef &Sym : Obj.symbols()) {
+    Expected<object::SymbolRef::Type> Type = Sym.getType();
+    Expected<uint64_t> Address = Sym.getAddress();
+    Expected<StringRef> Name = Sym.getName();
+    if (!Type || !Address || !Name) {
+      consumeError(Type.takeError());
+      consumeError(Address.takeError());
+      consumeError(Name.takeError());
+      continue;
+    }
+    if (*Type == object::SymbolRef::ST_Function)
+      Names.insert(std::make_pair(*Address, *Name));
+  }
+  auto getName = [&](uint64_t Address) {
+    auto I = Names.find(Address);
+    return I == Names.end() ? StringRef("?") : I->second;
+  };
+
+  for (uint64_t Function : ShowFunction) {
+    const FrameInfo *Frame = Table.lookup(Function);
+    if (Frame == nullptr)
+      exitWithError("no frame for function " + Twine::utohexstr(Function),
+                    Filename);
+    showFrame(*Frame, getName(Function), OS);
+  }
+  if (ShowFunction.empty())
+    for (const FrameInfo &Frame : Table.frames())
+      showFrame(Frame, getName(Frame.Function), OS);
+  return 0;
+}
+
+int main(int argc, const char *argv[]) {
+  // Print a stack trace if we signal out.
+  sys::PrintStackTraceOnErrorSignal(argv[0]);
+  PrettyStackTraceProgram X(argc, argv);
+  llvm_shutdown_obj Y; // Call llvm_shutdown() on exit.
+
+  StringRef ProgName(sys::path::filename(argv[0]));
+  if (argc > 1) {
+    int (*func)(int, const char *[]) = nullptr;
+
+    if (strcmp(argv[1], "merge") == 0)
+      func = merge_main;
+    else if (strcmp(argv[1], "show") == 0)
+      func = show_main;
+    else if (strcmp(argv[1], "callsites") == 0)
+      func = callsites_main;
+    else if (strcmp(argv[1], "frames") == 0)
+      func = frames_main;
+
+    if (func) {
+      std::string Invocation(ProgName.str() + " " + argv[1]);
+      argv[1] = Invocation.c_str();
+      return func(argc - 1, argv + 1);
+    }
+
+    if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "-help") == 0 ||
+        strcmp(argv[1], "--help") == 0) {
+
+      errs() << "OVERVIEW: TyChe allocation-point database tools\n\n"
+             << "USAGE: " << ProgName << " <command> [args...]\n"
+             << "USAGE: " << ProgName << " <command> -help\n\n"
+             << "See each individual command --help for more details.\n"
+             << "Available commands: merge, show, callsites, frames\n";
+      return 0;
+    }
+  }
+
+  if (argc < 2)
+    errs() << ProgName << ": No command specified!\n";
+  else
+    errs() << ProgName << ": Unknown command!\n";
+
+  errs() << "USAGE: " << ProgName
+         << " <merge|show|callsites|frames> [args...]\n";
+  return 1;
+}
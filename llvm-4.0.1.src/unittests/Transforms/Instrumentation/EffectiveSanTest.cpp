@@ -0,0 +1,340 @@
+//===- EffectiveSanTest.cpp - Unit tests for the EffectiveSan pass --------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/AsmParser/Parser.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/DiagnosticPrinter.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/YAMLTraits.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Instrumentation.h"
+#include "gtest/gtest.h"
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace llvm;
+
+namespace {
+
+// A stack object and a heap object of the same struct type.  Each module
+// gets its own source file name and output prefix, so the modules are
+// independent and every one writes its own TyChe files.
+const char *ModuleIR = R"IR(
+%struct.S = type { i32, [4 x i8] }
+
+define i32 @f() !dbg !6 {
+entry:
+  %s = alloca %struct.S, align 4
+  call void @llvm.dbg.declare(metadata %struct.S* %s, metadata !10, metadata !DIExpression()), !dbg !16
+  %call = call i8* @malloc(i64 8), !dbg !16
+  %p = bitcast i8* %call to %struct.S*, !dbg !16, !effectiveSan !20
+  call void @free(i8* %call), !dbg !16
+  ret i32 0, !dbg !16
+}
+
+declare i8* @malloc(i64)
+declare void @free(i8*)
+declare void @llvm.dbg.declare(metadata, metadata, metadata)
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang", isOptimized: false, runtimeVersion: 0, emissionKind: FullDebug, enums: !2)
+!1 = !DIFile(filename: "t.c", directory: "/tmp")
+!2 = !{}
+!3 = !{i32 2, !"Dwarf Version", i32 4}
+!4 = !{i32 2, !"Debug Info Version", i32 3}
+!6 = distinct !DISubprogram(name: "f", scope: !1, file: !1, line: 1, type: !7, isLocal: false, isDefinition: true, scopeLine: 1, isOptimized: false, unit: !0, variables: !2)
+!7 = !DISubroutineType(types: !8)
+!8 = !{!9}
+!9 = !DIBasicType(name: "int", size: 32, encoding: DW_ATE_signed)
+!10 = !DILocalVariable(name: "s", scope: !6, file: !1, line: 2, type: !11)
+!11 = !DICompositeType(tag: DW_TAG_structure_type, name: "S", file: !1, line: 1, size: 64, elements: !12)
+!12 = !{!13, !14}
+!13 = !DIDerivedType(tag: DW_TAG_member, name: "a", scope: !11, file: !1, line: 1, baseType: !9, size: 32)
+!14 = !DIDerivedType(tag: DW_TAG_member, name: "b", scope: !11, file: !1, line: 1, baseType: !15, size: 32, offset: 32)
+!15 = !DICompositeType(tag: DW_TAG_array_type, baseType: !17, size: 32, elements: !18)
+!16 = !DILocation(line: 2, column: 3, scope: !6)
+!17 = !DIBasicType(name: "char", size: 8, encoding: DW_ATE_signed_char)
+!18 = !{!19}
+!19 = !DISubrange(count: 4)
+!20 = !DIDerivedType(tag: DW_TAG_pointer_type, baseType: !11, size: 64)
+)IR";
+
+static Instruction *findInstruction(Module &M, StringRef Name) {
+  for (Instruction &I : *M.getFunction("f")->begin())
+    if (I.getName() == Name)
+      return &I;
+  return nullptr;
+}
+
+struct TyCheRemarkCollector {
+  std::vector<std::string> Msgs;
+
+  static void handle(const DiagnosticInfo &DI, void *Context) {
+    auto *R = dyn_cast<OptimizationRemarkAnalysis>(&DI);
+    if (R && R->getPassName() == StringRef("tyche"))
+      static_cast<TyCheRemarkCollector *>(Context)->Msgs.push_back(
+          R->getMsg());
+  }
+};
+
+struct DroppedAnnotationCounter {
+  unsigned Count = 0;
+
+  static void handle(const DiagnosticInfo &DI, void *Context) {
+    std::string Msg;
+    raw_string_ostream OS(Msg);
+    DiagnosticPrinterRawOStream DP(OS);
+    DI.print(DP);
+    if (StringRef(OS.str()).count("type annotation dropped"))
+      static_cast<DroppedAnnotationCounter *>(Context)->Count++;
+  }
+};
+
+class EffectiveSanTest : public testing::Test {
+protected:
+  SmallString<128> Dir;
+  cl::opt<bool> *Debug = nullptr;
+  bool SavedDebug = false;
+
+  void SetUp() override {
+    // -effective-debug (on by default) prints a banner and writes the module
+    // before and after instrumentation to the working directory.
+    Debug = static_cast<cl::opt<bool> *>(
+        cl::getRegisteredOptions()["effective-debug"]);
+    ASSERT_TRUE(Debug);
+    SavedDebug = Debug->getValue();
+    Debug->setValue(false);
+    ASSERT_FALSE(sys::fs::createUniqueDirectory("effectivesan-test", Dir));
+  }
+
+  void TearDown() override {
+    if (Debug)
+      Debug->setValue(SavedDebug);
+    std::error_code EC;
+    std::vector<std::string> Files;
+    for (sys::fs::directory_iterator I(Dir, EC), E; I != E && !EC;
+         I.increment(EC))
+      Files.push_back(I->path());
+    for (const std::string &File : Files)
+      sys::fs::remove(File);
+    sys::fs::remove(Dir);
+  }
+
+  // Parse module number I.
+  std::unique_ptr<Module> parse(LLVMContext &C, unsigned I) {
+    SMDiagnostic Err;
+    std::unique_ptr<Module> M = parseAssemblyString(ModuleIR, Err, C);
+    if (!M)
+      return nullptr;
+    M->setSourceFileName("t" + std::to_string(I) + ".c");
+    SmallString<128> Prefix(Dir);
+    sys::path::append(Prefix, "t" + std::to_string(I));
+    M->getOrInsertNamedMetadata("tyche.output.prefix")
+        ->addOperand(MDNode::get(C, MDString::get(C, Prefix)));
+    return M;
+  }
+
+  // Parse, instrument and print module number I.  Returns the empty string
+  // if the module does not parse or does not verify afterwards.
+  std::string instrument(unsigned I) {
+    LLVMContext C;
+    std::unique_ptr<Module> M = parse(C, I);
+    if (!M)
+      return "";
+
+    legacy::PassManager PM;
+    PM.add(createEffectiveSanPass());
+    PM.run(*M);
+    if (verifyModule(*M, &errs()))
+      return "";
+
+    std::string Out;
+    raw_string_ostream OS(Out);
+    M->print(OS, nullptr);
+    return OS.str();
+  }
+
+  // Track the annotations of module number I, apply Transform to it and run
+  // the pass.  Returns the number of dropped annotations reported.
+  template <typename TransformT>
+  unsigned countDropped(unsigned I, TransformT Transform) {
+    LLVMContext C;
+    DroppedAnnotationCounter Counter;
+    C.setDiagnosticHandler(DroppedAnnotationCounter::handle, &Counter);
+    std::unique_ptr<Module> M = parse(C, I);
+    if (!M)
+      return ~0u;
+
+    legacy::PassManager Track;
+    Track.add(createEffectiveSanTrackMetadataPass());
+    Track.run(*M);
+    Transform(*M);
+    legacy::PassManager Instrument;
+    Instrument.add(createEffectiveSanPass());
+    Instrument.run(*M);
+    return Counter.Count;
+  }
+};
+
+// The pass used to refuse to run more than once per process.
+TEST_F(EffectiveSanTest, SeveralModules) {
+  std::string First = instrument(0);
+  ASSERT_NE("", First);
+  EXPECT_EQ(First, instrument(0));
+  EXPECT_NE("", instrument(1));
+}
+
+#if LLVM_ENABLE_THREADS
+// Independent modules instrumented at the same time must come out the same
+// as when they are instrumented one after the other.
+TEST_F(EffectiveSanTest, ConcurrentModules) {
+  const unsigned N = 8;
+  std::vector<std::string> Expected(N), Actual(N);
+  for (unsigned I = 0; I < N; I++) {
+    Expected[I] = instrument(I);
+    ASSERT_NE("", Expected[I]);
+  }
+
+  std::vector<std::thread> Threads;
+  for (unsigned I = 0; I < N; I++)
+    Threads.emplace_back([this, &Actual, I] { Actual[I] = instrument(I); });
+  for (std::thread &T : Threads)
+    T.join();
+
+  for (unsigned I = 0; I < N; I++)
+    EXPECT_EQ(Expected[I], Actual[I]) << "module " << I;
+}
+#endif
+
+// Transforms that hoist, merge or replace instructions keep the annotation.
+TEST_F(EffectiveSanTest, AnnotationsSurviveTransforms) {
+  LLVMContext C;
+  std::unique_ptr<Module> M = parse(C, 0);
+  ASSERT_TRUE(M);
+  Instruction *P = findInstruction(*M, "p");
+  ASSERT_TRUE(P);
+  MDNode *Ty = P->getMetadata(LLVMContext::MD_effective_san);
+  ASSERT_TRUE(Ty);
+  EXPECT_EQ(Ty, P->getMetadata("effectiveSan"));
+
+  P->dropUnknownNonDebugMetadata();
+  EXPECT_EQ(Ty, P->getMetadata(LLVMContext::MD_effective_san));
+
+  Instruction *Q = P->clone();
+  Q->setMetadata(LLVMContext::MD_effective_san, nullptr);
+  Q->insertAfter(P);
+  P->replaceAllUsesWith(Q);
+  P->eraseFromParent();
+  EXPECT_EQ(Ty, Q->getMetadata(LLVMContext::MD_effective_san));
+}
+
+// An annotation lost between the tracking pass and the EffectiveSan pass is
+// reported; one that follows its value through replaceAllUsesWith() is not.
+TEST_F(EffectiveSanTest, DroppedAnnotations) {
+  auto *Verify = static_cast<cl::opt<bool> *>(
+      cl::getRegisteredOptions()["effective-verify-metadata"]);
+  ASSERT_TRUE(Verify);
+  Verify->setValue(true);
+
+  EXPECT_EQ(0u, countDropped(0, [](Module &M) {
+    Instruction *P = findInstruction(M, "p");
+    Instruction *Q = P->clone();
+    Q->insertAfter(P);
+    P->replaceAllUsesWith(Q);
+    P->eraseFromParent();
+  }));
+  EXPECT_EQ(1u, countDropped(1, [](Module &M) {
+    findInstruction(M, "p")->setMetadata(LLVMContext::MD_effective_san,
+                                         nullptr);
+  }));
+
+  Verify->setValue(false);
+}
+
+// Allocation sites carry their TYCHE_MD as integers plus the type name.
+TEST_F(EffectiveSanTest, TypedSiteMetadata) {
+  LLVMContext C;
+  std::unique_ptr<Module> M = parse(C, 0);
+  ASSERT_TRUE(M);
+  legacy::PassManager PM;
+  PM.add(createEffectiveSanPass());
+  PM.run(*M);
+
+  const CallInst *Free = nullptr;
+  for (Instruction &I : *M->getFunction("f")->begin())
+    if (auto *CI = dyn_cast<CallInst>(&I))
+      if (CI->getCalledFunction() == M->getFunction("free"))
+        Free = CI;
+  ASSERT_TRUE(Free);
+  const MDNode *MD = Free->getMetadata(LLVMContext::MD_tyche);
+  ASSERT_TRUE(MD);
+  ASSERT_EQ(unsigned(TyCheMDNumFields + 1), MD->getNumOperands());
+  EXPECT_TRUE(isa<ConstantAsMetadata>(MD->getOperand(TyCheMDLine)));
+  EXPECT_EQ(2u, getTyCheMDField(MD, TyCheMDLine));
+  EXPECT_EQ(3u, getTyCheMDField(MD, TyCheMDCol));
+  EXPECT_EQ(0u, getTyCheMDField(MD, TyCheMDMetaID));
+  EXPECT_EQ("FREE", getTyCheMDTypeName(MD));
+}
+
+// Allocation sites are reported as "tyche" remarks, streamed to the remarks
+// file, but only under -tyche-remarks.
+TEST_F(EffectiveSanTest, SiteRemarks) {
+  auto *Remarks = static_cast<cl::opt<bool> *>(
+      cl::getRegisteredOptions()["tyche-remarks"]);
+  ASSERT_TRUE(Remarks);
+
+  for (bool Enabled : {false, true}) {
+    Remarks->setValue(Enabled);
+    std::string YAML;
+    raw_string_ostream OS(YAML);
+    LLVMContext C;
+    TyCheRemarkCollector Collector;
+    C.setDiagnosticHandler(TyCheRemarkCollector::handle, &Collector);
+    C.setDiagnosticsOutputFile(llvm::make_unique<yaml::Output>(OS));
+    std::unique_ptr<Module> M = parse(C, 0);
+    ASSERT_TRUE(M);
+    legacy::PassManager PM;
+    PM.add(createEffectiveSanPass());
+    PM.run(*M);
+    OS.flush();
+
+    if (!Enabled) {
+      EXPECT_TRUE(Collector.Msgs.empty());
+      EXPECT_EQ("", YAML);
+      continue;
+    }
+    bool SawFree = false;
+    for (const std::string &Msg : Collector.Msgs)
+      if (StringRef(Msg).startswith("free site")) {
+        EXPECT_NE(std::string::npos, Msg.find("allocates FREE"));
+        EXPECT_NE(std::string::npos, Msg.find(" at 2:3"));
+        SawFree = true;
+      }
+    EXPECT_TRUE(SawFree);
+    EXPECT_NE(std::string::npos, YAML.find("Pass:            tyche"));
+    EXPECT_NE(std::string::npos, YAML.find("Name:            AllocationSite"));
+  }
+  Remarks->setValue(false);
+}
+
+} // end anonymous namespace
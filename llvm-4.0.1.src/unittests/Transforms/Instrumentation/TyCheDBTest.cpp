@@ -0,0 +1,103 @@
+//===- TyCheDBTest.cpp - Unit tests for the TyChe database formats --------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Instrumentation/TyCheDB.h"
+#include "gtest/gtest.h"
+
+using namespace llvm;
+using namespace llvm::tyche;
+
+namespace {
+
+// Lay out Records as a .tyche_callsites section.
+static std::string makeSection(ArrayRef<CallSiteRecord> Records) {
+  return std::string(reinterpret_cast<const char *>(Records.data()),
+                     Records.size() * sizeof(CallSiteRecord));
+}
+
+// Return addresses are relative to their records, and the sections of
+// several objects are merged into one table sorted by return address.
+TEST(TyCheDBTest, CallSiteTable) {
+  std::string A = makeSection({{0x40, 1, 10, DBSiteHeap, 0},
+                               {0x30, 2, 11, DBSiteFree, 0}});
+  std::string B = makeSection({{-0x1100, 3, 12, DBSiteCalloc, 0}});
+
+  CallSiteTable Table;
+  ASSERT_FALSE(bool(Table.addSection(A, 0x1000)));
+  ASSERT_FALSE(bool(Table.addSection(B, 0x2000)));
+  ASSERT_EQ(3u, Table.sites().size());
+  EXPECT_EQ(0xf00u, Table.sites()[0].PC);
+  EXPECT_EQ(0x1040u, Table.sites()[1].PC);
+  EXPECT_EQ(0x1050u, Table.sites()[2].PC);
+
+  const CallSiteInfo *S = Table.lookup(0xf00);
+  ASSERT_TRUE(S);
+  EXPECT_EQ(3u, S->SiteID);
+  EXPECT_EQ(12u, S->TypeID);
+  EXPECT_EQ(uint32_t(DBSiteCalloc), S->Kind);
+  S = Table.lookup(0x1050);
+  ASSERT_TRUE(S);
+  EXPECT_EQ(2u, S->SiteID);
+  EXPECT_EQ(nullptr, Table.lookup(0x1000));
+}
+
+TEST(TyCheDBTest, TruncatedCallSiteSection) {
+  CallSiteTable Table;
+  Error E = Table.addSection(StringRef("\0\0\0\0", 4), 0);
+  EXPECT_TRUE(bool(E));
+  consumeError(std::move(E));
+  EXPECT_TRUE(Table.sites().empty());
+}
+
+// Each frame record is followed by its slots; function addresses are
+// relative to their records.
+TEST(TyCheDBTest, FrameTable) {
+  FrameRecord F1 = {0x100, 2, 0}, F2 = {-0x40, 1, 0};
+  FrameSlotRecord S1 = {-16, 8, 10, 1, 8, 0};
+  FrameSlotRecord S2 = {-24, 8, 0, 0, 8, FrameSlotSpill};
+  FrameSlotRecord S3 = {8, 4, 11, 2, 4, FrameSlotFixed};
+  std::string Section;
+  auto append = [&](const void *Data, size_t Size) {
+    Section.append(static_cast<const char *>(Data), Size);
+  };
+  append(&F1, sizeof(F1));
+  append(&S1, sizeof(S1));
+  append(&S2, sizeof(S2));
+  append(&F2, sizeof(F2));
+  append(&S3, sizeof(S3));
+
+  FrameTable Table;
+  ASSERT_FALSE(bool(Table.addSection(Section, 0x2000)));
+  ASSERT_EQ(2u, Table.frames().size());
+  // The second record starts at 0x2000 + 16 + 2 * 40.
+  EXPECT_EQ(0x2060u - 0x40, Table.frames()[0].Function);
+  EXPECT_EQ(0x2100u, Table.frames()[1].Function);
+
+  const FrameInfo *Frame = Table.lookup(0x2100);
+  ASSERT_TRUE(Frame);
+  ASSERT_EQ(2u, Frame->Slots.size());
+  EXPECT_EQ(-16, Frame->Slots[0].Offset);
+  EXPECT_EQ(10u, Frame->Slots[0].TypeID);
+  EXPECT_EQ(uint32_t(FrameSlotSpill), Frame->Slots[1].Flags);
+  Frame = Table.lookup(0x2020);
+  ASSERT_TRUE(Frame);
+  ASSERT_EQ(1u, Frame->Slots.size());
+  EXPECT_EQ(11u, Frame->Slots[0].TypeID);
+  EXPECT_EQ(nullptr, Table.lookup(0x2000));
+
+  // A record whose slots run past the end of the section is rejected, and
+  // none of the frames of that section are kept.
+  FrameTable Truncated;
+  Error E = Truncated.addSection(StringRef(Section).drop_back(1), 0);
+  EXPECT_TRUE(bool(E));
+  consumeError(std::move(E));
+  EXPECT_TRUE(Truncated.frames().empty());
+}
+
+} // end anonymous namespace